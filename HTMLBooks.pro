@@ -1,4 +1,4 @@
-QT       += core gui widgets webenginewidgets
+QT       += core gui widgets webenginewidgets concurrent network
 QT       += texttospeech      # optional; remove if not available
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
@@ -16,9 +16,27 @@ DEFINES += QT_DEPRECATED_WARNINGS
 # You can also select to disable deprecated APIs only up to a certain version of Qt.
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
+include(engine.pri)
+
 SOURCES += \
-    main.cpp
+    main.cpp \
+    bookprofile.cpp \
+    bookscheme.cpp \
+    pdfexport.cpp \
+    pdfmerge.cpp \
+    perfpanel.cpp \
+    readingsession.cpp \
+    resultsmodel.cpp \
+    searchserver.cpp
 HEADERS += \
+    bookprofile.h \
+    bookscheme.h \
+    pdfexport.h \
+    pdfmerge.h \
+    perfpanel.h \
+    readingsession.h \
+    resultsmodel.h \
+    searchserver.h
 
 FORMS += \
 
@@ -0,0 +1,169 @@
+#include "batchmode.h"
+#include "bookarchive.h"
+#include "memorybudget.h"
+#include "pagetextcache.h"
+#include "perfstats.h"
+#include "searchindex.h"
+#include "sitemanifest.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QFileInfo>
+#include <QTextStream>
+#include <cstring>
+
+static QTextStream &out() {
+    static QTextStream s(stdout);
+    return s;
+}
+
+static QTextStream &err() {
+    static QTextStream s(stderr);
+    return s;
+}
+
+static double secondsSince(qint64 startUs) {
+    return (PerfStats::nowUs() - startUs) / 1e6;
+}
+
+bool isBatchCommand(int argc, char *argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        if (!std::strcmp(argv[i], "--build-index") || !std::strcmp(argv[i], "--search")
+                || !std::strcmp(argv[i], "--pack"))
+            return true;
+    }
+    return false;
+}
+
+// Loads dir's saved index and brings it in line with the pages on disk,
+// collecting page texts into texts if given. Returns the number of pages that
+// had to be (re)indexed.
+static int freshIndex(SearchIndex *index, bool rebuild, PageTextCache::Builder *texts = nullptr) {
+    SiteManifest manifest = SiteManifest::scan(index->siteDir());
+    if (rebuild) {
+        index->build(manifest.pages(), texts);
+        return index->fileCount();
+    }
+    index->load();
+    return index->update(manifest.pages(), texts);
+}
+
+static int buildIndex(const QString &dir, bool rebuild, int threads) {
+    if (BookArchive::isArchivePath(dir)) {
+        err() << dir << " is a packed book; its index is written when it is packed (--pack)\n";
+        return 1;
+    }
+    if (!QFileInfo(dir).isDir()) {
+        err() << "No such book: " << dir << "\n";
+        return 1;
+    }
+    qint64 start = PerfStats::nowUs();
+    SearchIndex index(dir);
+    index.setThreadCount(threads);
+    PageTextCache::Builder texts(dir);
+    int changed = freshIndex(&index, rebuild, &texts);
+    if (changed > 0 && !index.save()) {
+        err() << "Could not write " << SearchIndex::indexFilePath(dir) << "\n";
+        return 1;
+    }
+    if (changed > 0 && !texts.save()) {
+        err() << "Could not write " << PageTextCache::cacheFilePath(dir) << "\n";
+        return 1;
+    }
+    out() << QString("%1: %2 pages, %3 terms, %4 re-indexed in %5 s\n")
+                 .arg(SearchIndex::indexFilePath(dir)).arg(index.fileCount()).arg(index.termCount())
+                 .arg(changed).arg(secondsSince(start), 0, 'f', 2);
+    return 0;
+}
+
+static int search(const QString &dir, const QString &term, int limit, int threads, int flags) {
+    // a packed book's pages and index are entries of the archive, found
+    // through the open archives only while it stays open
+    QSharedPointer<BookArchive> archive;
+    if (BookArchive::isArchivePath(dir) && !(archive = BookArchive::open(dir))) {
+        err() << "Could not open the packed book " << dir << "\n";
+        return 1;
+    }
+    SearchIndex index(dir);
+    index.setThreadCount(threads);
+    if (freshIndex(&index, false) > 0)
+        err() << "Note: the saved index of " << dir << " is out of date; searched the current pages\n";
+    QVector<SearchHit> hits = index.search(term, nullptr, nullptr, flags);
+    for (int i = 0; i < hits.size() && (limit <= 0 || i < limit); ++i) {
+        const SearchHit &hit = hits.at(i);
+        out() << QString("%1\t%2\t%3\n").arg(hit.score, 0, 'f', 3).arg(hit.hits).arg(index.file(hit.file).path);
+    }
+    return 0;
+}
+
+static int pack(const QString &dir, const QString &file, const QString &method, int threads) {
+    BookArchive::Compression compression = BookArchive::Compression::Deflate;
+    if (method == "none") compression = BookArchive::Compression::None;
+    else if (method == "zstd") compression = BookArchive::Compression::Zstd;
+    else if (method != "deflate") {
+        err() << "Unknown compression " << method << " (none, deflate or zstd)\n";
+        return 1;
+    }
+    if (compression == BookArchive::Compression::Zstd && !BookArchive::hasZstd()) {
+        err() << "This build has no zstd support (qmake CONFIG+=zstd)\n";
+        return 1;
+    }
+    // pack an up-to-date index so the archive opens without re-indexing
+    if (int status = buildIndex(dir, false, threads)) return status;
+    QString error;
+    if (!BookArchive::pack(dir, file, &error, compression)) {
+        err() << "Could not write " << file << ": " << (error.isEmpty() ? QString("unknown error") : error) << "\n";
+        return 1;
+    }
+    out() << QString("%1: %2 bytes\n").arg(file).arg(QFileInfo(file).size());
+    return 0;
+}
+
+int runBatchCommand(const QStringList &arguments) {
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Builds and queries HTMLBooks search indexes without the viewer.");
+    parser.addHelpOption();
+    QCommandLineOption buildOption("build-index", "Build or update the search index of <dir>.", "dir");
+    QCommandLineOption searchOption("search", "Search <dir> (a folder or .hbk) for the query given as argument.", "dir");
+    QCommandLineOption packOption("pack", "Index <dir> and pack it into the .hbk file given as argument.", "dir");
+    QCommandLineOption rebuildOption("rebuild", "Re-index every page, not just changed ones.");
+    QCommandLineOption threadsOption("threads", "Threads for indexing (default: one per core).", "n", "0");
+    QCommandLineOption limitOption("limit", "Print at most <n> results (default: all).", "n", "0");
+    QCommandLineOption compressionOption("compression", "none, deflate (default) or zstd.", "method", "deflate");
+    QCommandLineOption stemOption("stem", "Match every word of a query word's stem.");
+    QCommandLineOption fuzzyOption("fuzzy", "Match the closest indexed words to a word no page has.");
+    QCommandLineOption lowMemoryOption("low-memory", "Read pages on one thread, a few at a time.");
+    parser.addOptions({buildOption, searchOption, packOption, rebuildOption, threadsOption, limitOption,
+                       compressionOption, stemOption, fuzzyOption, lowMemoryOption});
+    parser.addPositionalArgument("argument", "The query for --search, the archive for --pack.");
+    parser.process(arguments);
+    if (parser.isSet(lowMemoryOption)) setLowMemoryMode(true);
+
+    const int threads = qMax(0, parser.value(threadsOption).toInt());
+    const QStringList rest = parser.positionalArguments();
+    int commands = int(parser.isSet(buildOption)) + int(parser.isSet(searchOption)) + int(parser.isSet(packOption));
+    if (commands != 1) {
+        err() << "Give one of --build-index, --search or --pack\n";
+        return 1;
+    }
+
+    if (parser.isSet(buildOption)) {
+        if (!rest.isEmpty()) parser.showHelp(1);
+        return buildIndex(QFileInfo(parser.value(buildOption)).absoluteFilePath(), parser.isSet(rebuildOption), threads);
+    }
+    if (rest.isEmpty()) parser.showHelp(1);
+    if (parser.isSet(searchOption)) {
+        QString dir = QFileInfo(parser.value(searchOption)).absoluteFilePath();
+        if (!QFileInfo::exists(dir)) {
+            err() << "No such book: " << dir << "\n";
+            return 1;
+        }
+        int flags = SearchIndex::Exact;
+        if (parser.isSet(stemOption)) flags |= SearchIndex::Stemmed;
+        if (parser.isSet(fuzzyOption)) flags |= SearchIndex::Fuzzy;
+        return search(dir, rest.join(' '), parser.value(limitOption).toInt(), threads, flags);
+    }
+    QString file = rest.first();
+    if (!BookArchive::isArchivePath(file)) file += ".hbk";
+    return pack(QFileInfo(parser.value(packOption)).absoluteFilePath(), file, parser.value(compressionOption), threads);
+}
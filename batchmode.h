@@ -0,0 +1,34 @@
+#ifndef BATCHMODE_H
+#define BATCHMODE_H
+
+/*
+Command-line batch mode, for preparing books on a build server:
+
+    HTMLBooks --build-index DIR [--rebuild] [--threads N] [--low-memory]
+    HTMLBooks --search DIR TERM [--limit N] [--threads N] [--stem] [--fuzzy]
+    HTMLBooks --pack DIR FILE.hbk [--compression none|deflate|zstd]
+
+--build-index brings DIR/.htmlbooks/index and the page text cache
+(pagetextcache.h) up to date, re-indexing only changed pages unless
+--rebuild, so devices that open the book just load them.
+--search prints the ranked pages for a query as "score<TAB>hits<TAB>path",
+matching stems and misspellings with --stem and --fuzzy (see searchindex.h);
+DIR may be a .hbk archive, and a stale or missing index is updated in memory
+only. --pack builds the index and packs the book with it. --threads bounds
+the cores used for indexing (default: all), and --low-memory has every
+command read pages on one thread (memorybudget.h).
+
+The viewer checks isBatchCommand() before creating its QApplication, and the
+headless cli/ target runs the same commands without Qt GUI or WebEngine.
+*/
+
+#include <QStringList>
+
+// True when the command line asks for a batch command rather than the viewer.
+bool isBatchCommand(int argc, char *argv[]);
+
+// Runs the command in arguments (QCoreApplication::arguments()) and returns
+// the process exit status. Needs a QCoreApplication.
+int runBatchCommand(const QStringList &arguments);
+
+#endif // BATCHMODE_H
@@ -0,0 +1,424 @@
+/*
+htmlbooks-bench: times the search engine without the viewer.
+
+Runs the directory walk (SiteManifest::scan), the streaming folder search
+(FolderScan), a full index build and index queries against a book directory
+or .hbk archive, or against a synthetic corpus of N pages of M KB written to
+a temporary directory. Each phase is repeated --repeat times and reported as
+the median, with throughput in MB/s of page bytes, query latency percentiles
+over all repeats and the process's peak resident set size. --json prints the
+same numbers as one JSON object, for comparing runs in scripts.
+
+The synthetic corpus is deterministic (fixed seed): words are drawn from a
+Zipf-like distribution over a generated vocabulary, so common words have long
+posting lists and rare ones short lists, roughly as in real prose.
+*/
+
+#include "bookarchive.h"
+#include "folderscan.h"
+#include "perfstats.h"
+#include "searchindex.h"
+#include "sitemanifest.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QEventLoop>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRandomGenerator>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QThread>
+#include <algorithm>
+#include <cmath>
+
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#endif
+
+static QTextStream &out() {
+    static QTextStream s(stdout);
+    return s;
+}
+
+// Peak resident set size in bytes, or -1 where it is not available.
+static qint64 peakRss() {
+#ifdef Q_OS_UNIX
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return -1;
+#ifdef Q_OS_MACOS
+    return qint64(usage.ru_maxrss);             // bytes
+#else
+    return qint64(usage.ru_maxrss) * 1024;      // kilobytes
+#endif
+#else
+    return -1;
+#endif
+}
+
+// ---- synthetic corpus ------------------------------------------------------
+
+static QByteArray syntheticWord(int rank) {
+    static const char *const syllables[] = {
+        "ka", "lo", "mi", "ne", "ru", "sa", "ti", "vo",
+        "an", "el", "is", "or", "um", "be", "da", "fe"
+    };
+    QByteArray word;
+    for (int n = rank + 16; n; n /= 16) word += syllables[n % 16];
+    return word;
+}
+
+struct Vocabulary {
+    explicit Vocabulary(int size) {
+        words.reserve(size);
+        cumulative.reserve(size);
+        double total = 0;
+        for (int rank = 0; rank < size; ++rank) {
+            words.append(syntheticWord(rank));
+            total += 1.0 / (rank + 1);
+            cumulative.append(total);
+        }
+    }
+    const QByteArray &pick(QRandomGenerator &random) const {
+        double x = random.generateDouble() * cumulative.last();
+        int i = int(std::upper_bound(cumulative.begin(), cumulative.end(), x) - cumulative.begin());
+        return words.at(qMin(i, words.size() - 1));
+    }
+
+    QVector<QByteArray> words;      // by rank, most frequent first
+    QVector<double> cumulative;
+};
+
+// Writes pages pages of about kb KB each, 100 to a folder, plus an index.html.
+static bool writeSyntheticBook(const QString &dir, int pages, int kb, const Vocabulary &vocabulary) {
+    QRandomGenerator random(20240613);
+    QDir root(dir);
+    QFile index(root.filePath("index.html"));
+    if (!index.open(QIODevice::WriteOnly)) return false;
+    index.write("<html><head><title>Synthetic book</title></head><body><h1>Contents</h1></body></html>\n");
+    index.close();
+
+    const int target = qMax(1, kb) * 1024;
+    QByteArray html;
+    for (int page = 0; page < pages; ++page) {
+        QString folder = QString("part%1").arg(page / 100, 3, 10, QChar('0'));
+        if (page % 100 == 0 && !root.mkpath(folder)) return false;
+        html = "<html><head><meta charset=\"utf-8\"><title>Page " + QByteArray::number(page)
+               + "</title></head><body>\n<h2>Chapter " + QByteArray::number(page) + "</h2>\n";
+        while (html.size() < target) {
+            html += "<p>";
+            int words = 40 + int(random.bounded(80));
+            for (int w = 0; w < words; ++w) {
+                if (w) html += (w % 13 == 0) ? ", " : " ";
+                if (w % 29 == 7) html += "<b>" + vocabulary.pick(random) + "</b>";
+                else html += vocabulary.pick(random);
+            }
+            html += ".</p>\n";
+        }
+        html += "</body></html>\n";
+        QFile f(root.filePath(folder + QString("/page%1.html").arg(page, 5, 10, QChar('0'))));
+        if (!f.open(QIODevice::WriteOnly) || f.write(html) != html.size()) return false;
+    }
+    return true;
+}
+
+// Frequent, middling and rare words, two-word queries and prefixes.
+static QStringList syntheticQueries(const Vocabulary &vocabulary) {
+    QStringList queries;
+    const QVector<QByteArray> &w = vocabulary.words;
+    const int n = w.size();
+    for (int rank : {0, 3, 10, 50, 200, 1000, n / 2, n - 1})
+        queries << QString::fromLatin1(w.at(qMin(rank, n - 1)));
+    queries << QString::fromLatin1(w.at(1) + ' ' + w.at(20))
+            << QString::fromLatin1(w.at(5) + ' ' + w.at(qMin(500, n - 1)))
+            << QString::fromLatin1(w.at(2) + ' ' + w.at(30) + ' ' + w.at(qMin(300, n - 1)))
+            << QString::fromLatin1(w.at(0).left(3))
+            << QString::fromLatin1(w.at(qMin(100, n - 1)).left(4));
+    return queries;
+}
+
+// A built index's own terms, for books where no queries were given: the first
+// few terms under each letter, as whole words and as prefixes.
+static QStringList sampledQueries(const SearchIndex &index) {
+    QStringList queries;
+    for (char c = 'a'; c <= 'z'; c += 3) {
+        QList<QByteArray> terms = index.termsWithPrefix(QByteArray(1, c), 8);
+        if (terms.isEmpty()) continue;
+        queries << QString::fromUtf8(terms.last()) + ' ';
+        queries << QString::fromUtf8(terms.first().left(2));
+    }
+    return queries;
+}
+
+// ---- measurement -----------------------------------------------------------
+
+static double median(QVector<double> values) {
+    if (values.isEmpty()) return 0;
+    std::sort(values.begin(), values.end());
+    int n = values.size();
+    return n % 2 ? values.at(n / 2) : (values.at(n / 2 - 1) + values.at(n / 2)) / 2;
+}
+
+// Nearest-rank percentile of sorted values.
+static double percentile(const QVector<double> &sorted, double p) {
+    if (sorted.isEmpty()) return 0;
+    int rank = int(std::ceil(p * sorted.size())) - 1;
+    return sorted.at(qBound(0, rank, sorted.size() - 1));
+}
+
+static double megabytesPerSecond(qint64 bytes, double ms) {
+    return ms > 0 ? (bytes / (1024.0 * 1024.0)) / (ms / 1000.0) : 0;
+}
+
+struct Phase {
+    QString name;
+    double ms = 0;          // median over the repeats
+    double mbPerSecond = 0; // 0 when not meaningful
+    QString detail;
+};
+
+static double elapsedMs(qint64 startUs) {
+    return (PerfStats::nowUs() - startUs) / 1000.0;
+}
+
+static int runFolderScan(const QString &siteDir, const QString &term, const SiteManifest &manifest, int threads) {
+    FolderScan scan;
+    if (threads > 0) scan.setMaxThreads(threads);
+    QEventLoop loop;
+    int matches = 0;
+    QObject::connect(&scan, &FolderScan::finished, &loop, [&](int n) {
+        matches = n;
+        loop.quit();
+    });
+    scan.start(siteDir, term, manifest);
+    loop.exec();
+    return matches;
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("htmlbooks-bench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Benchmarks the HTMLBooks directory walk, folder search and search index.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("book", "Book directory or .hbk archive (omit with --synthetic).");
+    QCommandLineOption syntheticOption("synthetic", "Generate a corpus of <pages> pages instead of using a book.", "pages");
+    QCommandLineOption kbOption("kb", "Size of each synthetic page in KB (default 16).", "kb", "16");
+    QCommandLineOption vocabularyOption("vocabulary", "Distinct words in the synthetic corpus (default 20000).", "words", "20000");
+    QCommandLineOption queriesOption("queries", "Comma-separated queries (default: chosen from the corpus).", "list");
+    QCommandLineOption scanTermOption("scan-term", "Term for the folder search (default: the first query).", "term");
+    QCommandLineOption threadsOption("threads", "Folder search threads (default: all cores).", "n", "0");
+    QCommandLineOption repeatOption("repeat", "Times to run each phase (default 5).", "n", "5");
+    QCommandLineOption jsonOption("json", "Print the results as JSON.");
+    parser.addOptions({syntheticOption, kbOption, vocabularyOption, queriesOption, scanTermOption,
+                       threadsOption, repeatOption, jsonOption});
+    parser.process(app);
+
+    const int repeat = qMax(1, parser.value(repeatOption).toInt());
+    const int threads = qMax(0, parser.value(threadsOption).toInt());
+    const bool synthetic = parser.isSet(syntheticOption);
+
+    QTemporaryDir temporary;
+    QString siteDir;
+    QStringList queries;
+    if (synthetic) {
+        const int pages = parser.value(syntheticOption).toInt();
+        const int kb = parser.value(kbOption).toInt();
+        if (pages <= 0 || kb <= 0 || !temporary.isValid()) {
+            QTextStream(stderr) << "--synthetic needs a page count and --kb a size\n";
+            return 1;
+        }
+        Vocabulary vocabulary(qBound(100, parser.value(vocabularyOption).toInt(), 1000000));
+        qint64 start = PerfStats::nowUs();
+        if (!writeSyntheticBook(temporary.path(), pages, kb, vocabulary)) {
+            QTextStream(stderr) << "Could not write the synthetic corpus to " << temporary.path() << "\n";
+            return 1;
+        }
+        if (!parser.isSet(jsonOption))
+            out() << QString("Generated %1 pages x %2 KB in %3 ms\n").arg(pages).arg(kb).arg(elapsedMs(start), 0, 'f', 0);
+        siteDir = temporary.path();
+        queries = syntheticQueries(vocabulary);
+    } else {
+        if (parser.positionalArguments().size() != 1) parser.showHelp(1);
+        siteDir = QFileInfo(parser.positionalArguments().first()).absoluteFilePath();
+        if (!QFileInfo::exists(siteDir)) {
+            QTextStream(stderr) << "No such book: " << siteDir << "\n";
+            return 1;
+        }
+    }
+    // pages inside an archive are only found while it is open: hold it for the whole run
+    QSharedPointer<BookArchive> archive;
+    if (BookArchive::isArchivePath(siteDir) && !(archive = BookArchive::open(siteDir))) {
+        QTextStream(stderr) << "Could not open the packed book " << siteDir << "\n";
+        return 1;
+    }
+    if (parser.isSet(queriesOption))
+        queries = parser.value(queriesOption).split(',', QString::SkipEmptyParts);
+
+    QVector<Phase> phases;
+    QVector<double> times;
+
+    // directory walk
+    SiteManifest manifest;
+    for (int r = 0; r < repeat; ++r) {
+        qint64 start = PerfStats::nowUs();
+        manifest = SiteManifest::scan(siteDir);
+        times.append(elapsedMs(start));
+    }
+    qint64 bytes = 0;
+    for (const SitePage &page : manifest.pages()) bytes += page.size;
+    Phase walk;
+    walk.name = "manifest scan";
+    walk.ms = median(times);
+    walk.detail = QString("%1 pages, %2 MB").arg(manifest.pages().size()).arg(bytes / (1024.0 * 1024.0), 0, 'f', 1);
+    phases.append(walk);
+    if (manifest.pages().isEmpty()) {
+        QTextStream(stderr) << "No pages in " << siteDir << "\n";
+        return 1;
+    }
+
+    // index build
+    SearchIndex index(siteDir);
+    times.clear();
+    for (int r = 0; r < repeat; ++r) {
+        index = SearchIndex(siteDir);
+        qint64 start = PerfStats::nowUs();
+        index.build(manifest.pages());
+        times.append(elapsedMs(start));
+    }
+    Phase build;
+    build.name = "index build";
+    build.ms = median(times);
+    build.mbPerSecond = megabytesPerSecond(bytes, build.ms);
+    build.detail = QString("%1 terms").arg(index.termCount());
+    phases.append(build);
+    if (index.fileCount() == 0) {
+        QTextStream(stderr) << "None of the " << manifest.pages().size() << " pages of " << siteDir << " could be read\n";
+        return 1;
+    }
+
+    if (queries.isEmpty()) queries = sampledQueries(index);
+    if (queries.isEmpty()) {
+        QTextStream(stderr) << "No queries: the book has no indexed words\n";
+        return 1;
+    }
+
+    // folder search
+    const QString scanTerm = parser.isSet(scanTermOption) ? parser.value(scanTermOption) : queries.first().trimmed();
+    times.clear();
+    int matches = 0;
+    for (int r = 0; r < repeat; ++r) {
+        qint64 start = PerfStats::nowUs();
+        matches = runFolderScan(siteDir, scanTerm, manifest, threads);
+        times.append(elapsedMs(start));
+    }
+    Phase scan;
+    scan.name = "folder search";
+    scan.ms = median(times);
+    scan.mbPerSecond = megabytesPerSecond(bytes, scan.ms);
+    scan.detail = QString("\"%1\": %2 pages, %3 threads").arg(scanTerm).arg(matches)
+                          .arg(threads > 0 ? threads : QThread::idealThreadCount());
+    phases.append(scan);
+
+    // index save and load; a real book's index is only read, never replaced
+    const QString indexFile = SearchIndex::indexFilePath(siteDir);
+    if (synthetic) {
+        times.clear();
+        for (int r = 0; r < repeat; ++r) {
+            qint64 start = PerfStats::nowUs();
+            if (!index.save()) break;
+            times.append(elapsedMs(start));
+        }
+        if (!times.isEmpty()) {
+            Phase save;
+            save.name = "index save";
+            save.ms = median(times);
+            save.detail = QString("%1 MB").arg(QFileInfo(indexFile).size() / (1024.0 * 1024.0), 0, 'f', 1);
+            phases.append(save);
+        }
+    }
+    if (BookArchive::isArchivePath(siteDir) || QFileInfo::exists(indexFile)) {
+        times.clear();
+        SearchIndex loaded(siteDir);
+        for (int r = 0; r < repeat; ++r) {
+            qint64 start = PerfStats::nowUs();
+            if (!loaded.load()) break;
+            times.append(elapsedMs(start));
+        }
+        if (!times.isEmpty()) {
+            Phase load;
+            load.name = "index load";
+            load.ms = median(times);
+            load.detail = QString("%1 pages").arg(loaded.fileCount());
+            phases.append(load);
+        }
+    }
+
+    // index queries: every query once per repeat, timed one by one
+    QVector<double> latencies;
+    latencies.reserve(queries.size() * repeat);
+    qint64 hits = 0;
+    qint64 queryStart = PerfStats::nowUs();
+    for (int r = 0; r < repeat; ++r) {
+        for (const QString &query : queries) {
+            qint64 start = PerfStats::nowUs();
+            QVector<SearchHit> found = index.search(query);
+            latencies.append(elapsedMs(start));
+            if (r == 0) hits += found.size();
+        }
+    }
+    const double queryMs = elapsedMs(queryStart);
+    std::sort(latencies.begin(), latencies.end());
+    const double queriesPerSecond = queryMs > 0 ? latencies.size() / (queryMs / 1000.0) : 0;
+    const qint64 rss = peakRss();
+
+    if (parser.isSet(jsonOption)) {
+        QJsonObject json;
+        json["book"] = synthetic ? QString("synthetic") : siteDir;
+        json["pages"] = manifest.pages().size();
+        json["bytes"] = double(bytes);
+        json["repeat"] = repeat;
+        QJsonArray phaseList;
+        for (const Phase &phase : phases) {
+            QJsonObject p;
+            p["name"] = phase.name;
+            p["ms"] = phase.ms;
+            if (phase.mbPerSecond > 0) p["mbPerSecond"] = phase.mbPerSecond;
+            p["detail"] = phase.detail;
+            phaseList.append(p);
+        }
+        json["phases"] = phaseList;
+        QJsonObject q;
+        q["count"] = latencies.size();
+        q["hits"] = double(hits);
+        q["perSecond"] = queriesPerSecond;
+        q["p50Ms"] = percentile(latencies, 0.50);
+        q["p90Ms"] = percentile(latencies, 0.90);
+        q["p99Ms"] = percentile(latencies, 0.99);
+        q["maxMs"] = latencies.last();
+        json["queries"] = q;
+        json["peakRssBytes"] = double(rss);
+        out() << QJsonDocument(json).toJson(QJsonDocument::Indented);
+        return 0;
+    }
+
+    out() << QString("Book: %1\n").arg(synthetic ? QString("synthetic (%1)").arg(siteDir) : siteDir);
+    out() << QString("Median of %1 runs\n\n").arg(repeat);
+    for (const Phase &phase : phases) {
+        out() << QString("%1 %2 ms").arg(phase.name, -16).arg(phase.ms, 10, 'f', 2);
+        out() << (phase.mbPerSecond > 0 ? QString("%1 MB/s").arg(phase.mbPerSecond, 10, 'f', 1) : QString(15, ' '));
+        out() << "   " << phase.detail << "\n";
+    }
+    out() << QString("\nqueries          %1 x %2, %3 queries/s, %4 hits\n")
+                 .arg(queries.size()).arg(repeat).arg(queriesPerSecond, 0, 'f', 0).arg(hits);
+    out() << QString("  latency ms     p50 %1  p90 %2  p99 %3  max %4\n")
+                 .arg(percentile(latencies, 0.50), 0, 'f', 3).arg(percentile(latencies, 0.90), 0, 'f', 3)
+                 .arg(percentile(latencies, 0.99), 0, 'f', 3).arg(latencies.last(), 0, 'f', 3);
+    if (rss >= 0) out() << QString("peak RSS         %1 MB\n").arg(rss / (1024.0 * 1024.0), 0, 'f', 1);
+    return 0;
+}
@@ -0,0 +1,16 @@
+# Headless benchmark of the search engine (no GUI, no WebEngine):
+#   qmake bench/bench.pro && make
+#   ./htmlbooks-bench --synthetic 2000 --kb 32
+#   ./htmlbooks-bench /path/to/book --queries "light,the lord,shep" --json
+QT       = core concurrent
+CONFIG  += c++11 console
+CONFIG  -= app_bundle
+
+TARGET = htmlbooks-bench
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+include(../engine.pri)
+
+SOURCES += \
+    bench.cpp
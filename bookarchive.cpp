@@ -0,0 +1,335 @@
+#include "bookarchive.h"
+#include "htmltext.h"
+#include "memorybudget.h"
+#include "searchindex.h"
+
+#include <QAtomicInt>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QReadWriteLock>
+#include <QSaveFile>
+#include <QSet>
+#include <QtEndian>
+#include <algorithm>
+#include <climits>
+
+#ifdef HTMLBOOKS_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+static const quint32 ArchiveMagic = 0x4842504B;     // "HBPK"
+static const quint32 ArchiveVersion = 2;            // 1: no compression or signatures
+static const int HeaderSize = 16;   // magic, version, directory offset
+static const int MaxSignatureBits = 1 << 16;
+
+// Open archives by absolute file name. Weak, so an archive is unmapped as soon
+// as its last user lets go of it.
+static QReadWriteLock registryLock;
+static QAtomicInt registrySize;
+
+static QHash<QString, QWeakPointer<BookArchive> > &registry() {
+    static QHash<QString, QWeakPointer<BookArchive> > archives;
+    return archives;
+}
+
+static bool fail(QString *error, const QString &message) {
+    if (error) *error = message;
+    return false;
+}
+
+static inline uchar foldAscii(uchar c) {
+    return (c >= 'A' && c <= 'Z') ? uchar(c + ('a' - 'A')) : c;
+}
+
+static inline quint32 trigramAt(const uchar *p) {
+    return quint32(foldAscii(p[0])) << 16 | quint32(foldAscii(p[1])) << 8 | foldAscii(p[2]);
+}
+
+// Bit of a trigram in a filter of 1 << log2Bits bits (Fibonacci hashing).
+static inline quint32 signatureBit(quint32 trigram, int log2Bits) {
+    return (trigram * 2654435761u) >> (32 - log2Bits);
+}
+
+static int log2Of(quint32 bits) {
+    int n = 0;
+    while ((1u << n) < bits) ++n;
+    return n;
+}
+
+// One-hash Bloom filter of the trigrams of text, about two bits per distinct
+// trigram, so a 5-letter term is ruled out by ~94% of the pages without it.
+static QByteArray trigramSignature(const QByteArray &text) {
+    QSet<quint32> trigrams;
+    const uchar *p = reinterpret_cast<const uchar *>(text.constData());
+    for (int i = 0; i + 3 <= text.size(); ++i) trigrams.insert(trigramAt(p + i));
+    if (trigrams.isEmpty()) return QByteArray();
+    quint32 bits = 64;
+    while (bits < quint32(trigrams.size()) * 2 && bits < quint32(MaxSignatureBits)) bits <<= 1;
+    const int log2Bits = log2Of(bits);
+    QByteArray signature(int(bits / 8), '\0');
+    for (quint32 t : trigrams) {
+        quint32 bit = signatureBit(t, log2Bits);
+        signature[int(bit >> 3)] = char(uchar(signature.at(int(bit >> 3))) | (1u << (bit & 7)));
+    }
+    return signature;
+}
+
+static QByteArray compress(const QByteArray &bytes, BookArchive::Compression compression, quint8 *method) {
+    *method = ArchiveEntry::Stored;
+    if (compression == BookArchive::Compression::None || bytes.size() < 64) return bytes;
+    QByteArray packed;
+#ifdef HTMLBOOKS_HAVE_ZSTD
+    if (compression == BookArchive::Compression::Zstd) {
+        packed.resize(int(ZSTD_compressBound(size_t(bytes.size()))));
+        size_t n = ZSTD_compress(packed.data(), size_t(packed.size()), bytes.constData(), size_t(bytes.size()), 19);
+        if (ZSTD_isError(n)) return bytes;
+        packed.resize(int(n));
+        *method = ArchiveEntry::Zstd;
+    }
+#endif
+    if (*method == ArchiveEntry::Stored) {
+        packed = qCompress(bytes, 9);
+        *method = ArchiveEntry::Deflate;
+    }
+    // not worth inflating for: images, fonts and other compressed formats
+    if (packed.size() > bytes.size() - bytes.size() / 8) {
+        *method = ArchiveEntry::Stored;
+        return bytes;
+    }
+    return packed;
+}
+
+bool BookArchive::hasZstd() {
+#ifdef HTMLBOOKS_HAVE_ZSTD
+    return true;
+#else
+    return false;
+#endif
+}
+
+BookArchive::BookArchive() {
+    inflated.setMaxCost(lowMemoryMode() ? PageCacheBytes / 4 : int(PageCacheBytes));
+}
+
+BookArchive::~BookArchive() {
+    if (name.isEmpty()) return;     // never registered
+    QWriteLocker lock(&registryLock);
+    auto it = registry().find(name);
+    if (it != registry().end() && it.value().isNull()) registry().erase(it);
+    registrySize.store(registry().size());
+}
+
+QSharedPointer<BookArchive> BookArchive::open(const QString &fileName) {
+    const QString path = QFileInfo(fileName).absoluteFilePath();
+    QWriteLocker lock(&registryLock);
+    if (QSharedPointer<BookArchive> open = registry().value(path).toStrongRef()) return open;
+
+    QSharedPointer<BookArchive> archive(new BookArchive);
+    if (!archive->map(path)) return QSharedPointer<BookArchive>();
+    archive->name = path;
+    registry().insert(path, archive);
+    registrySize.store(registry().size());
+    return archive;
+}
+
+void BookArchive::releaseCaches() {
+    QVector<QSharedPointer<BookArchive> > open;
+    {
+        QReadLocker lock(&registryLock);
+        for (const QWeakPointer<BookArchive> &archive : registry()) {
+            if (QSharedPointer<BookArchive> strong = archive.toStrongRef()) open.append(strong);
+        }
+    }
+    // outside the registry lock: the last reference may go here, and unregister
+    for (const QSharedPointer<BookArchive> &archive : open) {
+        QMutexLocker lock(&archive->cacheLock);
+        archive->inflated.clear();
+    }
+}
+
+QSharedPointer<BookArchive> BookArchive::containing(const QString &path, QString *inner) {
+    if (!registrySize.load()) return QSharedPointer<BookArchive>();
+    QReadLocker lock(&registryLock);
+    for (auto it = registry().constBegin(); it != registry().constEnd(); ++it) {
+        const QString &name = it.key();
+        if (path.size() <= name.size() || path.at(name.size()) != QLatin1Char('/') || !path.startsWith(name))
+            continue;
+        QSharedPointer<BookArchive> archive = it.value().toStrongRef();
+        if (!archive) continue;
+        *inner = path.mid(name.size() + 1);
+        return archive;
+    }
+    return QSharedPointer<BookArchive>();
+}
+
+bool BookArchive::fileExists(const QString &path) {
+    QString inner;
+    if (QSharedPointer<BookArchive> archive = containing(path, &inner)) return archive->indexOf(inner) >= 0;
+    return QFile::exists(path);
+}
+
+bool BookArchive::isArchivePath(const QString &fileName) {
+    return fileName.endsWith(QLatin1String(".hbk"), Qt::CaseInsensitive);
+}
+
+bool BookArchive::map(const QString &fileName) {
+    file.setFileName(fileName);
+    if (!file.open(QIODevice::ReadOnly) || file.size() < HeaderSize) return false;
+    base = file.map(0, file.size());
+    if (!base) return false;
+    mappedSize = file.size();
+    const quint32 version = qFromBigEndian<quint32>(base + 4);
+    if (qFromBigEndian<quint32>(base) != ArchiveMagic || version < 1 || version > ArchiveVersion)
+        return false;
+
+    const quint64 directory = qFromBigEndian<quint64>(base + 8);
+    if (directory < quint64(HeaderSize) || directory > quint64(mappedSize)
+            || quint64(mappedSize) - directory > quint64(INT_MAX))
+        return false;
+    QByteArray bytes = QByteArray::fromRawData(reinterpret_cast<const char *>(base + directory),
+                                               int(quint64(mappedSize) - directory));
+    QDataStream in(bytes);
+    in.setVersion(QDataStream::Qt_5_6);
+    quint32 count = 0;
+    in >> count;
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        ArchiveEntry e;
+        if (version == 1) {
+            in >> e.path >> e.offset >> e.size >> e.mtime;
+            e.storedSize = e.size;
+        } else {
+            in >> e.path >> e.offset >> e.size >> e.storedSize >> e.method >> e.mtime
+               >> e.signatureOffset >> e.signatureSize;
+        }
+        // entries must lie between the header and the directory
+        if (e.offset < quint64(HeaderSize) || e.offset > directory || e.storedSize > directory - e.offset
+                || e.size > quint32(INT_MAX) || e.method > ArchiveEntry::Zstd)
+            return false;
+        if (e.signatureSize && (e.signatureOffset < quint64(HeaderSize) || e.signatureOffset > directory
+                                || e.signatureSize > directory - e.signatureOffset
+                                || e.signatureSize > quint32(MaxSignatureBits / 8)
+                                || (e.signatureSize & (e.signatureSize - 1))))
+            return false;
+        list.append(e);
+    }
+    if (in.status() != QDataStream::Ok) return false;
+
+    byPath.reserve(list.size());
+    for (int i = 0; i < list.size(); ++i) byPath.insert(list.at(i).path, i);
+    return true;
+}
+
+QByteArray BookArchive::data(int entry) const {
+    const ArchiveEntry &e = list.at(entry);
+    const uchar *stored = base + e.offset;
+    switch (e.method) {
+    case ArchiveEntry::Deflate: {
+        QByteArray bytes = qUncompress(stored, int(e.storedSize));
+        return bytes.size() == int(e.size) ? bytes : QByteArray();
+    }
+    case ArchiveEntry::Zstd: {
+#ifdef HTMLBOOKS_HAVE_ZSTD
+        QByteArray bytes(int(e.size), Qt::Uninitialized);
+        size_t n = ZSTD_decompress(bytes.data(), e.size, stored, e.storedSize);
+        if (!ZSTD_isError(n) && n == e.size) return bytes;
+#endif
+        return QByteArray();
+    }
+    default:
+        return QByteArray::fromRawData(reinterpret_cast<const char *>(stored), int(e.size));
+    }
+}
+
+QByteArray BookArchive::cachedData(int entry) const {
+    if (list.at(entry).method == ArchiveEntry::Stored) return data(entry);
+    {
+        QMutexLocker lock(&cacheLock);
+        if (QByteArray *bytes = inflated.object(entry)) return *bytes;
+    }
+    QByteArray bytes = data(entry);     // inflate outside the lock
+    QMutexLocker lock(&cacheLock);
+    inflated.insert(entry, new QByteArray(bytes), qMax(1, bytes.size()));
+    return bytes;
+}
+
+bool BookArchive::mayContain(int entry, const QByteArray &folded) const {
+    const ArchiveEntry &e = list.at(entry);
+    if (!e.signatureSize || folded.size() < 3) return true;
+    const uchar *signature = base + e.signatureOffset;
+    const int log2Bits = log2Of(e.signatureSize * 8);
+    const uchar *p = reinterpret_cast<const uchar *>(folded.constData());
+    for (int i = 0; i + 3 <= folded.size(); ++i) {
+        quint32 bit = signatureBit(trigramAt(p + i), log2Bits);
+        if (!(signature[bit >> 3] & (1u << (bit & 7)))) return false;
+    }
+    return true;
+}
+
+bool BookArchive::pack(const QString &siteDir, const QString &archiveFile, QString *error,
+                       Compression compression) {
+    QDir root(siteDir);
+    QStringList paths;
+    QDirIterator it(root.absolutePath(), QDir::Files | QDir::NoSymLinks, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        QString rel = root.relativeFilePath(it.next());
+        if (!rel.startsWith(QLatin1Char('.')) && !rel.contains(QLatin1String("/.")))
+            paths.append(rel);
+    }
+    const QString index = SearchIndex::indexFilePath(siteDir);
+    if (QFile::exists(index)) paths.append(root.relativeFilePath(index));
+    std::sort(paths.begin(), paths.end());
+
+    QSaveFile out(archiveFile);
+    if (!out.open(QIODevice::WriteOnly)) return fail(error, out.errorString());
+    out.write(QByteArray(HeaderSize, '\0'));    // filled in once the directory is written
+
+    QVector<ArchiveEntry> entries;
+    entries.reserve(paths.size());
+    QByteArray text;
+    for (const QString &rel : paths) {
+        QFile f(root.filePath(rel));
+        if (!f.open(QIODevice::ReadOnly) || f.size() > INT_MAX) continue;
+        QByteArray bytes = f.readAll();
+        ArchiveEntry e;
+        e.path = rel;
+        e.size = quint32(bytes.size());
+        e.mtime = QFileInfo(f).lastModified().toMSecsSinceEpoch();
+        QByteArray stored = compress(bytes, compression, &e.method);
+        e.offset = quint64(out.pos());
+        e.storedSize = quint32(stored.size());
+        if (out.write(stored) != stored.size()) return fail(error, out.errorString());
+
+        if (rel.endsWith(QLatin1String(".html"), Qt::CaseInsensitive)
+                || rel.endsWith(QLatin1String(".htm"), Qt::CaseInsensitive)) {
+            text.clear();
+            extractPageText(bytes.constData(), bytes.size(), &text);
+            QByteArray signature = trigramSignature(text);
+            e.signatureOffset = quint64(out.pos());
+            e.signatureSize = quint32(signature.size());
+            if (out.write(signature) != signature.size()) return fail(error, out.errorString());
+        }
+        entries.append(e);
+    }
+
+    const quint64 directory = quint64(out.pos());
+    QDataStream dir(&out);
+    dir.setVersion(QDataStream::Qt_5_6);
+    dir << quint32(entries.size());
+    for (const ArchiveEntry &e : entries) {
+        dir << e.path << e.offset << e.size << e.storedSize << e.method << e.mtime
+            << e.signatureOffset << e.signatureSize;
+    }
+
+    uchar header[HeaderSize];
+    qToBigEndian(ArchiveMagic, header);
+    qToBigEndian(ArchiveVersion, header + 4);
+    qToBigEndian(directory, header + 8);
+    if (dir.status() != QDataStream::Ok || !out.seek(0)
+            || out.write(reinterpret_cast<const char *>(header), HeaderSize) != HeaderSize)
+        return fail(error, out.errorString());
+    if (!out.commit()) return fail(error, out.errorString());
+    return true;
+}
@@ -0,0 +1,120 @@
+#ifndef BOOKARCHIVE_H
+#define BOOKARCHIVE_H
+
+/*
+Packed books: a whole site folder in one .hbk file.
+
+An archive is a 16-byte header, the files' bytes back to back, and a central
+directory at the end (relative path, offset, size and mtime of every entry).
+Opening one maps the file once and reads the directory; after that every page,
+image and the embedded search index (.htmlbooks/index) is a slice of the
+mapping, so reading a page or searching the book costs no open() or stat()
+per file. BookSchemeHandler (bookscheme.h) serves the entries to Qt WebEngine.
+
+Entries that shrink by at least an eighth are stored compressed: deflate
+(zlib, via qCompress) always, zstd when built with CONFIG+=zstd. Text
+compresses three- to five-fold, and inflating a chapter takes well under a
+millisecond; the pages the view shows go through a small LRU of inflated
+entries so going back and forth doesn't inflate them again. Every page also
+carries a Bloom filter of the (ASCII case-folded) trigrams of its visible
+text, so the folder scan can rule most pages out without inflating them.
+
+Paths inside an archive are written as if the archive were a directory,
+"/books/kjv.hbk/john/3.html". readPageText(), SiteManifest and SearchIndex
+resolve them through BookArchive::containing(), so everything that works on a
+site folder works on an open archive unchanged.
+*/
+
+#include <QByteArray>
+#include <QCache>
+#include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QString>
+#include <QVector>
+
+struct ArchiveEntry {
+    enum Method : quint8 {
+        Stored,
+        Deflate,    // qCompress() format: 4-byte size, then a zlib stream
+        Zstd
+    };
+
+    QString path;       // relative to the packed site directory, '/' separated
+    quint64 offset = 0; // of the entry's bytes in the archive
+    quint32 size = 0;   // inflated
+    quint32 storedSize = 0;
+    quint8 method = Stored;
+    qint64 mtime = 0;   // of the packed file, msecs since epoch
+    quint64 signatureOffset = 0;    // trigram Bloom filter of a page's text
+    quint32 signatureSize = 0;      // in bytes, 0 if the entry has none
+};
+
+class BookArchive {
+public:
+    enum class Compression {
+        None,
+        Deflate,
+        Zstd        // falls back to Deflate unless built with HTMLBOOKS_HAVE_ZSTD
+    };
+
+    ~BookArchive();
+
+    // The open archive at fileName, mapping it if no one has it open yet.
+    // Returns null if the file can't be mapped or isn't an archive.
+    static QSharedPointer<BookArchive> open(const QString &fileName);
+
+    // The open archive path lies in, with *inner set to the path inside it, or
+    // null when path is an ordinary file (a single atomic load when no archive
+    // is open).
+    static QSharedPointer<BookArchive> containing(const QString &path, QString *inner);
+
+    // Whether path is a file on disk or an entry of an open archive.
+    static bool fileExists(const QString &path);
+
+    // Whether fileName names an archive (by its .hbk suffix).
+    static bool isArchivePath(const QString &fileName);
+
+    // Pack every non-hidden file below siteDir, plus its search index if there
+    // is one, into archiveFile.
+    static bool pack(const QString &siteDir, const QString &archiveFile, QString *error = nullptr,
+                     Compression compression = Compression::Deflate);
+    static bool hasZstd();
+
+    // Drop the inflated pages every open archive keeps (see cachedData()).
+    static void releaseCaches();
+
+    QString fileName() const { return name; }
+    const QVector<ArchiveEntry> &entries() const { return list; }
+    int indexOf(const QString &path) const { return byPath.value(path, -1); }
+
+    // The bytes of an entry. Stored entries point straight into the mapping
+    // and are valid for as long as this archive is; compressed ones are
+    // inflated on every call (empty if corrupt).
+    QByteArray data(int entry) const;
+    // data(), keeping the last few megabytes of inflated entries around; for
+    // pages that are likely to be asked for again, as the view's are.
+    QByteArray cachedData(int entry) const;
+
+    // False if the entry's text certainly doesn't contain folded (an ASCII
+    // case-folded needle, as CaseInsensitiveMatcher::pattern() returns).
+    bool mayContain(int entry, const QByteArray &folded) const;
+
+    static const int PageCacheBytes = 8 << 20;      // a quarter of it in low-memory mode
+
+private:
+    BookArchive();
+    bool map(const QString &fileName);
+
+    QString name;
+    QFile file;
+    const uchar *base = nullptr;
+    qint64 mappedSize = 0;
+    QVector<ArchiveEntry> list;
+    QHash<QString, int> byPath;
+    mutable QMutex cacheLock;
+    mutable QCache<int, QByteArray> inflated;
+};
+
+#endif // BOOKARCHIVE_H
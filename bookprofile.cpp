@@ -0,0 +1,35 @@
+#include "bookprofile.h"
+#include "memorybudget.h"
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QSettings>
+#include <QStandardPaths>
+#include <QtWebEngineWidgets/QWebEngineProfile>
+
+QString profileNameFor(const QString &siteDir) {
+    if (!QSettings().value("webengine/perBookStorage", true).toBool()) return QStringLiteral("shared");
+    QByteArray hash = QCryptographicHash::hash(QDir::cleanPath(siteDir).toUtf8(), QCryptographicHash::Md5);
+    return QStringLiteral("book-") + QString::fromLatin1(hash.toHex().left(16));
+}
+
+QWebEngineProfile *createBookProfile(const QString &name, QObject *parent) {
+    QSettings settings;
+    QString storage = settings.value("webengine/storagePath",
+                                     QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/webengine").toString();
+    QString cache = settings.value("webengine/cachePath",
+                                   QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/webengine").toString();
+
+    QWebEngineProfile *profile = new QWebEngineProfile(name, parent);
+    profile->setPersistentStoragePath(QDir(storage).filePath(name));
+    profile->setCachePath(QDir(cache).filePath(name));
+
+    // in low-memory mode the cache is kept on disk, where it costs no RAM
+    const bool low = lowMemoryMode();
+    QString type = settings.value("webengine/cache", "disk").toString();
+    if (type == "none") profile->setHttpCacheType(QWebEngineProfile::NoCache);
+    else if (type == "memory" && !low) profile->setHttpCacheType(QWebEngineProfile::MemoryHttpCache);
+    else profile->setHttpCacheType(QWebEngineProfile::DiskHttpCache);
+    profile->setHttpCacheMaximumSize(qMax(0, settings.value("webengine/cacheSizeMB", low ? 16 : 64).toInt()) * 1024 * 1024);
+    return profile;
+}
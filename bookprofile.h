@@ -0,0 +1,37 @@
+#ifndef BOOKPROFILE_H
+#define BOOKPROFILE_H
+
+/*
+The Qt WebEngine profile book pages are shown in.
+
+Instead of the default profile, whose cache and storage are whatever WebEngine
+picks, every book gets a named profile of its own (or all books share one,
+with webengine/perBookStorage off), so its local storage, cookies and HTTP
+cache live under a directory of its own and are found again on the next
+visit. Settings, read when a profile is created:
+
+    webengine/cache          "disk" (default), "memory" or "none"; in low-memory
+                             mode (memorybudget.h) "memory" means "disk"
+    webengine/cacheSizeMB    HTTP cache limit, default 64 (16 in low-memory
+                             mode); 0 lets WebEngine pick
+    webengine/storagePath    root of the per-book storage directories
+    webengine/cachePath      root of the per-book disk caches
+    webengine/perBookStorage default true
+
+The HTTP cache holds what books pull in over http(s), such as web fonts and
+scripts; file:// and book:// pages are never HTTP-cached and are kept warm by
+the OS page cache and the archive's page cache instead (see prefetcher.h).
+*/
+
+#include <QString>
+
+class QObject;
+class QWebEngineProfile;
+
+// Storage name of the profile for the book at siteDir.
+QString profileNameFor(const QString &siteDir);
+
+// A new profile with the given storage name, configured from the settings.
+QWebEngineProfile *createBookProfile(const QString &name, QObject *parent);
+
+#endif // BOOKPROFILE_H
@@ -0,0 +1,83 @@
+#include "bookscheme.h"
+#include "bookarchive.h"
+
+#include <QBuffer>
+#include <QCryptographicHash>
+#include <QMimeDatabase>
+#include <QtWebEngineCore/QWebEngineUrlRequestJob>
+#include <QtWebEngineCore/QWebEngineUrlScheme>
+
+// A reply that keeps its archive, and so the mapping its bytes point into,
+// alive until Qt WebEngine is done reading it.
+class ArchiveReply : public QBuffer {
+public:
+    ArchiveReply(const QSharedPointer<BookArchive> &archive, const QByteArray &bytes, QObject *parent)
+        : QBuffer(parent), archive(archive) {
+        setData(bytes);     // shallow: bytes is the mapping or a cached inflated page
+        open(QIODevice::ReadOnly);
+    }
+
+private:
+    QSharedPointer<BookArchive> archive;
+};
+
+// Stable across runs, so saved URLs into a book stay valid.
+static QString hostFor(const QString &fileName) {
+    return QString::fromLatin1(QCryptographicHash::hash(fileName.toUtf8(), QCryptographicHash::Md5).toHex().left(16));
+}
+
+void BookSchemeHandler::registerScheme() {
+    QWebEngineUrlScheme book(scheme());
+    book.setSyntax(QWebEngineUrlScheme::Syntax::Host);     // relative links need a standard URL
+    book.setFlags(QWebEngineUrlScheme::SecureScheme | QWebEngineUrlScheme::LocalScheme
+                  | QWebEngineUrlScheme::LocalAccessAllowed);
+    QWebEngineUrlScheme::registerScheme(book);
+}
+
+void BookSchemeHandler::mount(const QSharedPointer<BookArchive> &archive) {
+    mounts.insert(hostFor(archive->fileName()), archive);
+}
+
+QUrl BookSchemeHandler::url(const QString &path) const {
+    QString inner;
+    QSharedPointer<BookArchive> archive = BookArchive::containing(path, &inner);
+    if (!archive) return QUrl();
+    QString host = hostFor(archive->fileName());
+    if (!mounts.contains(host)) return QUrl();
+    QUrl url;
+    url.setScheme(QString::fromLatin1(scheme()));
+    url.setHost(host);
+    url.setPath(QLatin1Char('/') + inner);
+    return url;
+}
+
+// The entry a book:// URL names; directories mean their index.html.
+static QString innerPath(const QUrl &url) {
+    QString path = url.path(QUrl::FullyDecoded).mid(1);
+    if (path.isEmpty() || path.endsWith(QLatin1Char('/'))) path += QLatin1String("index.html");
+    return path;
+}
+
+QString BookSchemeHandler::path(const QUrl &url) const {
+    if (url.scheme() != QLatin1String(scheme())) return QString();
+    QSharedPointer<BookArchive> archive = mounts.value(url.host());
+    if (!archive) return QString();
+    return archive->fileName() + QLatin1Char('/') + innerPath(url);
+}
+
+void BookSchemeHandler::requestStarted(QWebEngineUrlRequestJob *job) {
+    if (job->requestMethod() != "GET") {
+        job->fail(QWebEngineUrlRequestJob::RequestDenied);
+        return;
+    }
+    const QUrl url = job->requestUrl();
+    QSharedPointer<BookArchive> archive = mounts.value(url.host());
+    const QString path = innerPath(url);
+    int entry = archive ? archive->indexOf(path) : -1;
+    if (entry < 0) {
+        job->fail(QWebEngineUrlRequestJob::UrlNotFound);
+        return;
+    }
+    QByteArray mime = QMimeDatabase().mimeTypeForFile(path, QMimeDatabase::MatchExtension).name().toUtf8();
+    job->reply(mime, new ArchiveReply(archive, archive->cachedData(entry), job));
+}
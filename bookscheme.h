@@ -0,0 +1,49 @@
+#ifndef BOOKSCHEME_H
+#define BOOKSCHEME_H
+
+/*
+Serves open book archives (see bookarchive.h) to Qt WebEngine.
+
+Every mounted archive gets a host derived from its file name, and its entries
+are loaded as book://<host>/<path>, so relative links, images and stylesheets
+inside a packed book resolve against the archive the same way they do against
+a folder on disk. Replies are QBuffers over the archive's mapping, or over a
+page the archive has inflated and cached: nothing is copied or read from disk
+per request.
+
+The scheme has to be registered with registerScheme() before the
+QApplication is created.
+*/
+
+#include <QHash>
+#include <QSharedPointer>
+#include <QUrl>
+#include <QtWebEngineCore/QWebEngineUrlSchemeHandler>
+
+class BookArchive;
+
+class BookSchemeHandler : public QWebEngineUrlSchemeHandler {
+    Q_OBJECT
+public:
+    explicit BookSchemeHandler(QObject *parent = nullptr) : QWebEngineUrlSchemeHandler(parent) {}
+
+    static QByteArray scheme() { return QByteArrayLiteral("book"); }
+    static void registerScheme();
+
+    // Serve archive until this handler goes away; archives stay mounted after
+    // switching books so history entries into them keep working.
+    void mount(const QSharedPointer<BookArchive> &archive);
+
+    // The book:// URL of a path inside a mounted archive, or an invalid URL.
+    QUrl url(const QString &path) const;
+    // The path ("<archive>/<inner path>") a book:// URL refers to, or an empty
+    // string if its archive isn't mounted.
+    QString path(const QUrl &url) const;
+
+    void requestStarted(QWebEngineUrlRequestJob *job) override;
+
+private:
+    QHash<QString, QSharedPointer<BookArchive> > mounts;   // by host
+};
+
+#endif // BOOKSCHEME_H
@@ -0,0 +1,22 @@
+# Headless build of the viewer's batch commands (see batchmode.h), for build
+# servers without Qt GUI or WebEngine:
+#   qmake cli/cli.pro && make
+#   ./htmlbooks-index --build-index /path/to/book --threads 16
+#   ./htmlbooks-index --search /path/to/book.hbk "the lord"
+QT       = core concurrent
+CONFIG  += c++11 console
+CONFIG  -= app_bundle
+
+TARGET = htmlbooks-index
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+include(../engine.pri)
+
+SOURCES += \
+    main.cpp
+
+# make check: pack and search the fixture book in ../tests
+check.commands = sh $$PWD/../tests/batch_archive.sh $$OUT_PWD/$$TARGET
+check.depends = $(TARGET)
+QMAKE_EXTRA_TARGETS += check
@@ -0,0 +1,15 @@
+/*
+htmlbooks-index: the viewer's --build-index / --search / --pack commands as a
+console program that needs only Qt Core (see batchmode.h).
+*/
+
+#include "batchmode.h"
+
+#include <QCoreApplication>
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    app.setOrganizationName("HTMLBooks");
+    app.setApplicationName("HTMLBooks");
+    return runBatchCommand(app.arguments());
+}
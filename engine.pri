@@ -0,0 +1,41 @@
+# The book/search engine: Qt Core and Qt Concurrent only, no GUI, so the
+# viewer and the command-line tools (bench/) build the same code.
+QT += core concurrent
+INCLUDEPATH += $$PWD
+
+SOURCES += \
+    $$PWD/batchmode.cpp \
+    $$PWD/bookarchive.cpp \
+    $$PWD/folderscan.cpp \
+    $$PWD/htmltext.cpp \
+    $$PWD/library.cpp \
+    $$PWD/memorybudget.cpp \
+    $$PWD/pagetextcache.cpp \
+    $$PWD/perfstats.cpp \
+    $$PWD/prefetcher.cpp \
+    $$PWD/searchindex.cpp \
+    $$PWD/searchkernel.cpp \
+    $$PWD/sitemanifest.cpp \
+    $$PWD/stemmer.cpp \
+    $$PWD/termdictionary.cpp
+HEADERS += \
+    $$PWD/batchmode.h \
+    $$PWD/bookarchive.h \
+    $$PWD/folderscan.h \
+    $$PWD/htmltext.h \
+    $$PWD/library.h \
+    $$PWD/memorybudget.h \
+    $$PWD/pagetextcache.h \
+    $$PWD/perfstats.h \
+    $$PWD/prefetcher.h \
+    $$PWD/searchindex.h \
+    $$PWD/searchkernel.h \
+    $$PWD/sitemanifest.h \
+    $$PWD/stemmer.h \
+    $$PWD/termdictionary.h
+
+# Packed books can be compressed with zstd as well as deflate: qmake CONFIG+=zstd
+zstd {
+    DEFINES += HTMLBOOKS_HAVE_ZSTD
+    LIBS += -lzstd
+}
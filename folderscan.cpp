@@ -0,0 +1,175 @@
+#include "folderscan.h"
+#include "bookarchive.h"
+#include "htmltext.h"
+#include "memorybudget.h"
+#include "perfstats.h"
+#include "searchkernel.h"
+
+#include <QAtomicInt>
+#include <QThread>
+#include <QtConcurrent/QtConcurrentRun>
+
+struct FolderScan::Job {
+    QString siteDir;
+    SiteManifest manifest;
+    QString term;
+    CaseInsensitiveMatcher matcher;
+    bool byteMatch = false; // term has no case-sensitive non-ASCII characters (the usual case)
+    QVector<SitePage> pages;
+    QSharedPointer<BookArchive> archive;    // when siteDir is a packed book
+    QSharedPointer<PageTextCache> texts;
+    QAtomicInt next;        // next page to hand out
+    QAtomicInt running;     // workers still scanning
+    QAtomicInt matches;
+    QAtomicInt cancelled;
+    qint64 startUs = 0;
+};
+
+static bool hasCaseOutsideAscii(const QString &term) {
+    for (const QChar c : term) {
+        if (c.unicode() >= 0x80 && (c.toLower() != c || c.toUpper() != c)) return true;
+    }
+    return false;
+}
+
+void ScanMatches::clear() {
+    paths.clear();
+    hits.clear();
+    offsetStart.clear();
+    offsets.clear();
+}
+
+// UTF-8 length of the characters of s from from up to to.
+static int utf8Length(const QString &s, int from, int to) {
+    int n = 0;
+    for (int i = from; i < to; ++i) {
+        const ushort c = s.at(i).unicode();
+        if (c < 0x80) n += 1;
+        else if (c < 0x800) n += 2;
+        else if (QChar::isHighSurrogate(c)) n += 4;
+        else if (!QChar::isLowSurrogate(c)) n += 3;
+    }
+    return n;
+}
+
+// Find every match in the page, appending the first MaxOffsets offsets to
+// found; returns the number of matches.
+static int matchPage(const SitePage &page, const FolderScan::Job &job, QByteArray *text, QVector<int> *found) {
+    // archived pages whose trigram signature rules the term out are skipped
+    // without inflating them
+    if (job.archive && job.byteMatch) {
+        int entry = job.archive->indexOf(page.path.mid(job.archive->fileName().size() + 1));
+        if (entry >= 0 && !job.archive->mayContain(entry, job.matcher.pattern())) return 0;
+    }
+    // match against the visible text only, not tag names or attributes; most
+    // terms are matched on the UTF-8 bytes by the SIMD kernel without decoding;
+    // pages in the text cache aren't even extracted
+    QByteArray cached;
+    const QByteArray *visible = &cached;
+    // (pages of a narrowed search come without size and mtime: look them up)
+    if (!job.texts || !(page.mtime ? job.texts->text(page, &cached) : job.texts->text(page.path, &cached))) {
+        if (!readPageText(page.path, text)) return 0;
+        visible = text;
+    }
+    int hits = 0;
+    if (job.byteMatch) {
+        const int step = qMax(1, job.matcher.pattern().size());
+        for (int at = job.matcher.indexIn(*visible); at >= 0; at = job.matcher.indexIn(*visible, at + step)) {
+            if (hits++ < ScanMatches::MaxOffsets) found->append(at);
+        }
+        return hits;
+    }
+    // offsets stay UTF-8 byte positions, counted along as the matches go by
+    const QString decoded = QString::fromUtf8(*visible);
+    const int step = qMax(1, job.term.size());
+    int bytes = 0, counted = 0;
+    for (int at = decoded.indexOf(job.term, 0, Qt::CaseInsensitive); at >= 0;
+         at = decoded.indexOf(job.term, at + step, Qt::CaseInsensitive)) {
+        if (hits++ >= ScanMatches::MaxOffsets) continue;
+        bytes += utf8Length(decoded, counted, at);
+        counted = at;
+        found->append(bytes);
+    }
+    return hits;
+}
+
+FolderScan::FolderScan(QObject *parent) : QObject(parent) {
+    pool.setMaxThreadCount(qMax(1, QThread::idealThreadCount()));
+}
+
+FolderScan::~FolderScan() {
+    cancel();
+    pool.waitForDone();
+}
+
+void FolderScan::start(const QString &siteDir, const QString &term, const SiteManifest &manifest,
+                       const QSharedPointer<PageTextCache> &texts) {
+    cancel();
+    QSharedPointer<Job> job(new Job);
+    job->siteDir = siteDir;
+    job->startUs = PerfStats::nowUs();
+    job->manifest = manifest;
+    job->texts = texts;
+    job->term = term;
+    job->byteMatch = !hasCaseOutsideAscii(term);
+    if (job->byteMatch) job->matcher.setPattern(term.toUtf8());
+    current = job;
+    QtConcurrent::run(&pool, [this, job]() { walk(job); });
+}
+
+void FolderScan::cancel() {
+    if (current) current->cancelled.store(1);
+    current.reset();
+}
+
+void FolderScan::walk(const QSharedPointer<Job> &job) {
+    if (!job->manifest.isValid()) job->manifest = SiteManifest::scan(job->siteDir);
+    job->pages = job->manifest.pages();
+    if (BookArchive::isArchivePath(job->siteDir)) job->archive = BookArchive::open(job->siteDir);
+    // in low-memory mode one worker, so one page's text is in memory at a time
+    int workers = lowMemoryMode() ? 1 : qBound(1, pool.maxThreadCount(), qMax(1, job->pages.size()));
+    job->running.store(workers);
+    for (int i = 1; i < workers; ++i) {
+        QtConcurrent::run(&pool, [this, job]() { scan(job); });
+    }
+    scan(job);
+}
+
+void FolderScan::scan(const QSharedPointer<Job> &job) {
+    const int n = job->pages.size();
+    QByteArray text;    // reused for every page this worker reads
+    ScanMatches batch;
+    qint64 batchUs = PerfStats::nowUs();
+    auto deliver = [&]() {
+        if (batch.isEmpty()) return;
+        QMetaObject::invokeMethod(this, [this, job, batch]() {
+            if (job == current) emit matched(batch);
+        }, Qt::QueuedConnection);
+        batch.clear();
+        batchUs = PerfStats::nowUs();
+    };
+    while (!job->cancelled.load()) {
+        int i = job->next.fetchAndAddRelaxed(1);
+        if (i >= n) break;
+        const SitePage &page = job->pages.at(i);
+        const int start = batch.offsets.size();
+        const int hits = matchPage(page, *job, &text, &batch.offsets);
+        if (hits > 0) {
+            batch.paths.append(page.path);
+            batch.hits.append(hits);
+            batch.offsetStart.append(start);
+            job->matches.ref();
+        }
+        if (batch.size() >= BatchPages || (!batch.isEmpty() && PerfStats::nowUs() - batchUs >= BatchMs * 1000)) deliver();
+    }
+    if (!job->cancelled.load()) deliver();
+    if (!job->running.deref()) {
+        // last worker out reports completion
+        if (!job->cancelled.load()) PerfStats::record("folder scan", job->startUs, PerfStats::nowUs() - job->startUs);
+        QMetaObject::invokeMethod(this, [this, job]() {
+            if (job != current) return;
+            current.reset();
+            emit finished(job->matches.load());
+        }, Qt::QueuedConnection);
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef FOLDERSCAN_H
+#define FOLDERSCAN_H
+
+/*
+Background folder search.
+
+FolderScan searches the pages of a site directory on a private thread
+pool sized to the number of cores. Workers pull pages from a shared counter so
+a few huge chapters don't leave the other threads idle. Each page is searched
+in one pass that records every match, not just the first, and matches reach
+the owner's thread in batches (ScanMatches) rather than one signal per page:
+a worker hands its batch over every BatchPages pages or BatchMs milliseconds,
+whichever comes first, so the first results still show up at once.
+start()/cancel() drop any scan still in flight, including results already
+queued for delivery.
+*/
+
+#include <QObject>
+#include <QSharedPointer>
+#include <QString>
+#include <QThreadPool>
+#include <QVector>
+
+#include "pagetextcache.h"
+#include "sitemanifest.h"
+
+// Pages that matched and where, as parallel arrays: page i has hits.at(i)
+// matches, the first offsetCount(i) of which (at most MaxOffsets) are at
+// offsets[offsetStart.at(i)...], byte positions in the page's extracted text.
+struct ScanMatches {
+    QVector<QString> paths;
+    QVector<int> hits;
+    QVector<int> offsetStart;
+    QVector<int> offsets;
+
+    static const int MaxOffsets = 256;
+
+    int size() const { return paths.size(); }
+    bool isEmpty() const { return paths.isEmpty(); }
+    int offsetCount(int i) const {
+        return (i + 1 < offsetStart.size() ? offsetStart.at(i + 1) : offsets.size()) - offsetStart.at(i);
+    }
+    void clear();
+};
+
+class FolderScan : public QObject {
+    Q_OBJECT
+public:
+    explicit FolderScan(QObject *parent = nullptr);
+    ~FolderScan();
+
+    // Pages come from manifest when it is valid, else siteDir is walked first.
+    // Pages whose text is in texts are searched there instead of being decoded.
+    void start(const QString &siteDir, const QString &term, const SiteManifest &manifest,
+               const QSharedPointer<PageTextCache> &texts = QSharedPointer<PageTextCache>());
+    void cancel();
+    bool isRunning() const { return !current.isNull(); }
+    // Upper bound on worker threads (default: the number of cores).
+    void setMaxThreads(int n) { pool.setMaxThreadCount(qMax(1, n)); }
+
+    struct Job;     // state shared by the workers of one scan
+
+    static const int BatchPages = 32;
+    static const int BatchMs = 30;
+
+signals:
+    void matched(const ScanMatches &batch);
+    void finished(int matches);     // not emitted for cancelled scans
+
+private:
+    void walk(const QSharedPointer<Job> &job);
+    void scan(const QSharedPointer<Job> &job);
+
+    QThreadPool pool;
+    QSharedPointer<Job> current;
+};
+
+#endif // FOLDERSCAN_H
@@ -0,0 +1,382 @@
+#include "htmltext.h"
+#include "bookarchive.h"
+#include "perfstats.h"
+
+#include <QFile>
+#include <QTextCodec>
+#include <cstring>
+
+struct NamedEntity {
+    const char *name;
+    uint codepoint;
+};
+
+// The references that actually turn up in books; anything else is kept verbatim.
+static const NamedEntity namedEntities[] = {
+    { "amp", '&' }, { "lt", '<' }, { "gt", '>' }, { "quot", '"' }, { "apos", '\'' },
+    { "nbsp", 0xA0 }, { "shy", 0xAD }, { "copy", 0xA9 }, { "reg", 0xAE }, { "trade", 0x2122 },
+    { "deg", 0xB0 }, { "para", 0xB6 }, { "sect", 0xA7 }, { "middot", 0xB7 }, { "times", 0xD7 },
+    { "laquo", 0xAB }, { "raquo", 0xBB }, { "lsquo", 0x2018 }, { "rsquo", 0x2019 },
+    { "ldquo", 0x201C }, { "rdquo", 0x201D }, { "sbquo", 0x201A }, { "bdquo", 0x201E },
+    { "ndash", 0x2013 }, { "mdash", 0x2014 }, { "hellip", 0x2026 }, { "dagger", 0x2020 },
+    { "Dagger", 0x2021 }, { "bull", 0x2022 }, { "prime", 0x2032 }, { "Prime", 0x2033 },
+    { "frac12", 0xBD }, { "frac14", 0xBC }, { "frac34", 0xBE }, { "pound", 0xA3 },
+    { "cent", 0xA2 }, { "euro", 0x20AC }, { "yen", 0xA5 }, { "iexcl", 0xA1 }, { "iquest", 0xBF },
+    { "agrave", 0xE0 }, { "aacute", 0xE1 }, { "acirc", 0xE2 }, { "atilde", 0xE3 }, { "auml", 0xE4 },
+    { "aring", 0xE5 }, { "aelig", 0xE6 }, { "ccedil", 0xE7 }, { "egrave", 0xE8 }, { "eacute", 0xE9 },
+    { "ecirc", 0xEA }, { "euml", 0xEB }, { "igrave", 0xEC }, { "iacute", 0xED }, { "icirc", 0xEE },
+    { "iuml", 0xEF }, { "ntilde", 0xF1 }, { "ograve", 0xF2 }, { "oacute", 0xF3 }, { "ocirc", 0xF4 },
+    { "otilde", 0xF5 }, { "ouml", 0xF6 }, { "oslash", 0xF8 }, { "ugrave", 0xF9 }, { "uacute", 0xFA },
+    { "ucirc", 0xFB }, { "uuml", 0xFC }, { "yacute", 0xFD }, { "yuml", 0xFF }, { "szlig", 0xDF },
+    { "Agrave", 0xC0 }, { "Aacute", 0xC1 }, { "Acirc", 0xC2 }, { "Auml", 0xC4 }, { "Aring", 0xC5 },
+    { "AElig", 0xC6 }, { "Ccedil", 0xC7 }, { "Egrave", 0xC8 }, { "Eacute", 0xC9 }, { "Ecirc", 0xCA },
+    { "Iacute", 0xCD }, { "Ntilde", 0xD1 }, { "Oacute", 0xD3 }, { "Ouml", 0xD6 }, { "Oslash", 0xD8 },
+    { "Uacute", 0xDA }, { "Uuml", 0xDC }, { "oelig", 0x153 }, { "OElig", 0x152 },
+    { "alpha", 0x3B1 }, { "beta", 0x3B2 }, { "gamma", 0x3B3 }, { "delta", 0x3B4 }, { "pi", 0x3C0 },
+    { "omega", 0x3C9 }, { "Omega", 0x3A9 }, { "thinsp", 0x2009 }, { "ensp", 0x2002 }, { "emsp", 0x2003 },
+};
+
+// Numeric references in 0x80..0x9F mean windows-1252, as in browsers.
+static const ushort cp1252High[32] = {
+    0x20AC, 0xFFFD, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+    0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0xFFFD, 0x017D, 0xFFFD,
+    0xFFFD, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+    0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0xFFFD, 0x017E, 0x0178,
+};
+
+// Inline elements don't break words; every other tag acts as a space.
+static const char *const inlineTags[] = {
+    "a", "abbr", "b", "bdi", "bdo", "big", "cite", "code", "del", "dfn", "em", "font",
+    "i", "ins", "kbd", "mark", "q", "s", "samp", "small", "span", "strike", "strong",
+    "sub", "sup", "time", "tt", "u", "var", "wbr",
+};
+
+static inline bool isAsciiAlpha(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+static inline bool isAsciiSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f';
+}
+
+static inline char asciiLower(char c) {
+    return (c >= 'A' && c <= 'Z') ? char(c + ('a' - 'A')) : c;
+}
+
+// lit must be lower case
+static bool equalsNoCase(const char *s, int len, const char *lit) {
+    for (int i = 0; i < len; ++i) {
+        if (lit[i] == '\0' || asciiLower(s[i]) != lit[i]) return false;
+    }
+    return lit[len] == '\0';
+}
+
+static bool isInlineTag(const char *name, int len) {
+    for (const char *tag : inlineTags) {
+        if (equalsNoCase(name, len, tag)) return true;
+    }
+    return false;
+}
+
+// p points just past the tag name; returns the position after the closing '>'.
+static const char *skipTag(const char *p, const char *end) {
+    char quote = 0;
+    char prev = 0;
+    for (; p < end; ++p) {
+        char c = *p;
+        if (quote) {
+            if (c == quote) quote = 0;
+        } else if (c == '>') {
+            return p + 1;
+        } else if ((c == '"' || c == '\'') && prev == '=') {
+            quote = c;
+        }
+        if (!isAsciiSpace(c)) prev = c;
+    }
+    return end;
+}
+
+// Skip the contents of a raw text element up to and including </name>.
+static const char *skipRawText(const char *p, const char *end, const char *name) {
+    const int len = int(strlen(name));
+    for (; p + 2 + len <= end; ++p) {
+        if (p[0] == '<' && p[1] == '/' && equalsNoCase(p + 2, len, name)) {
+            return skipTag(p + 2 + len, end);
+        }
+    }
+    return end;
+}
+
+// The value of attribute attr (lower case) among the attributes of a tag, which
+// run from p to end (the closing '>'); empty if the tag has none.
+static QByteArray attributeValue(const char *p, const char *end, const char *attr) {
+    while (p < end) {
+        while (p < end && (isAsciiSpace(*p) || *p == '/')) ++p;
+        const char *name = p;
+        while (p < end && !isAsciiSpace(*p) && *p != '=' && *p != '>' && *p != '/') ++p;
+        const int len = int(p - name);
+        while (p < end && isAsciiSpace(*p)) ++p;
+        if (p >= end || *p != '=') {
+            if (len == 0 && p < end) ++p;
+            continue;
+        }
+        ++p;
+        while (p < end && isAsciiSpace(*p)) ++p;
+        const char *value = p;
+        if (p < end && (*p == '"' || *p == '\'')) {
+            const char quote = *p++;
+            value = p;
+            while (p < end && *p != quote) ++p;
+        } else {
+            while (p < end && !isAsciiSpace(*p) && *p != '>') ++p;
+        }
+        if (len > 0 && equalsNoCase(name, len, attr)) return QByteArray(value, int(p - value));
+        if (p < end && (*p == '"' || *p == '\'')) ++p;
+    }
+    return QByteArray();
+}
+
+static const char *findLiteral(const char *p, const char *end, const char *lit) {
+    const int len = int(strlen(lit));
+    for (; p + len <= end; ++p) {
+        if (memcmp(p, lit, size_t(len)) == 0) return p;
+    }
+    return nullptr;
+}
+
+static void appendUtf8(QByteArray *out, uint cp) {
+    if (cp < 0x80) {
+        out->append(char(cp));
+    } else if (cp < 0x800) {
+        out->append(char(0xC0 | (cp >> 6)));
+        out->append(char(0x80 | (cp & 0x3F)));
+    } else if (cp < 0x10000) {
+        out->append(char(0xE0 | (cp >> 12)));
+        out->append(char(0x80 | ((cp >> 6) & 0x3F)));
+        out->append(char(0x80 | (cp & 0x3F)));
+    } else {
+        out->append(char(0xF0 | (cp >> 18)));
+        out->append(char(0x80 | ((cp >> 12) & 0x3F)));
+        out->append(char(0x80 | ((cp >> 6) & 0x3F)));
+        out->append(char(0x80 | (cp & 0x3F)));
+    }
+}
+
+// p points at '&'. On success stores the code point and returns the position
+// after the reference; returns nullptr when this is not a known reference.
+static const char *decodeEntity(const char *p, const char *end, uint *cp) {
+    const char *q = p + 1;
+    if (q < end && *q == '#') {
+        ++q;
+        bool hex = q < end && (*q == 'x' || *q == 'X');
+        if (hex) ++q;
+        const char *digits = q;
+        uint v = 0;
+        for (; q < end; ++q) {
+            char c = *q;
+            int d;
+            if (c >= '0' && c <= '9') d = c - '0';
+            else if (hex && c >= 'a' && c <= 'f') d = c - 'a' + 10;
+            else if (hex && c >= 'A' && c <= 'F') d = c - 'A' + 10;
+            else break;
+            if (v < 0x110000) v = v * (hex ? 16 : 10) + uint(d);
+        }
+        if (q == digits) return nullptr;
+        if (q < end && *q == ';') ++q;
+        if (v >= 0x80 && v < 0xA0) v = cp1252High[v - 0x80];
+        if (v == 0 || v >= 0x110000 || (v >= 0xD800 && v < 0xE000)) v = 0xFFFD;
+        *cp = v;
+        return q;
+    }
+
+    const char *name = q;
+    while (q < end && q - name < 8 && (isAsciiAlpha(*q) || (*q >= '0' && *q <= '9'))) ++q;
+    if (q >= end || *q != ';') return nullptr;
+    const int len = int(q - name);
+    for (const NamedEntity &e : namedEntities) {
+        if (int(strlen(e.name)) == len && memcmp(e.name, name, size_t(len)) == 0) {
+            *cp = e.codepoint;
+            return q + 1;
+        }
+    }
+    return nullptr;
+}
+
+static inline uint latin1ToUnicode(uchar c) {
+    return (c >= 0x80 && c < 0xA0) ? cp1252High[c - 0x80] : c;
+}
+
+PageEncoding sniffPageEncoding(const char *data, int size, QByteArray *name) {
+    const uchar *u = reinterpret_cast<const uchar *>(data);
+    if (size >= 3 && u[0] == 0xEF && u[1] == 0xBB && u[2] == 0xBF) return PageEncoding::Utf8;
+    if (size >= 2 && ((u[0] == 0xFF && u[1] == 0xFE) || (u[0] == 0xFE && u[1] == 0xFF))) {
+        if (name) *name = (u[0] == 0xFF) ? "UTF-16LE" : "UTF-16BE";
+        return PageEncoding::Other;
+    }
+
+    // covers <meta charset="x"> and <meta http-equiv=... content="text/html; charset=x">
+    const char *p = data;
+    const char *end = data + qMin(size, 1024);
+    for (; p + 8 <= end; ++p) {
+        if (!equalsNoCase(p, 8, "charset=")) continue;
+        const char *v = p + 8;
+        while (v < end && (*v == '"' || *v == '\'' || isAsciiSpace(*v))) ++v;
+        const char *e = v;
+        while (e < end && *e != '"' && *e != '\'' && *e != ';' && *e != '>' && *e != '/' && !isAsciiSpace(*e)) ++e;
+        QByteArray charset = QByteArray(v, int(e - v)).toLower();
+        if (charset.isEmpty() || charset == "utf-8" || charset == "utf8") return PageEncoding::Utf8;
+        if (charset == "iso-8859-1" || charset == "iso8859-1" || charset == "latin1" || charset == "latin-1"
+                || charset == "windows-1252" || charset == "cp1252" || charset == "us-ascii" || charset == "ascii")
+            return PageEncoding::Latin1;
+        if (name) *name = charset;
+        return PageEncoding::Other;
+    }
+    return PageEncoding::Utf8;
+}
+
+void appendHtmlText(const char *data, int size, QByteArray *out, PageEncoding encoding, PageStructure *structure) {
+    if (encoding == PageEncoding::Other) encoding = PageEncoding::Utf8;   // caller decoded it
+    const bool latin1 = encoding == PageEncoding::Latin1;
+    const char *p = data;
+    const char *end = data + size;
+    bool pendingSpace = false;
+    int titleStart = -1, headingStart = -1;     // open <title> / first <h1>
+    if (!latin1 && size >= 3 && memcmp(p, "\xEF\xBB\xBF", 3) == 0) p += 3;
+    out->reserve(out->size() + size / 2);
+
+    // emit a collapsed separator before the next piece of text
+    auto beginText = [&]() {
+        if (pendingSpace && !out->isEmpty()) out->append(' ');
+        pendingSpace = false;
+    };
+
+    while (p < end) {
+        const char c = *p;
+        if (c == '<') {
+            const char *q = p + 1;
+            if (q < end && *q == '!') {
+                if (end - q >= 3 && q[1] == '-' && q[2] == '-') {
+                    const char *close = findLiteral(q + 3, end, "-->");
+                    p = close ? close + 3 : end;
+                } else {
+                    p = skipTag(q, end);    // <!DOCTYPE ...>, <![CDATA[ ...
+                }
+                continue;
+            }
+            bool closing = q < end && *q == '/';
+            if (closing) ++q;
+            if (q >= end || !(isAsciiAlpha(*q) || (*q == '?' && !closing))) {
+                beginText();
+                out->append('<');   // a literal '<' in text
+                ++p;
+                continue;
+            }
+            const char *name = q;
+            while (q < end && (isAsciiAlpha(*q) || (*q >= '0' && *q <= '9'))) ++q;
+            const int len = int(q - name);
+            p = skipTag(q, end);
+            if (structure) {
+                // text of the element starts after the separator it may add
+                const int at = out->size() + ((pendingSpace || !isInlineTag(name, len)) && !out->isEmpty() ? 1 : 0);
+                const bool title = equalsNoCase(name, len, "title");
+                const bool heading = equalsNoCase(name, len, "h1") && structure->heading.isEmpty();
+                if (!closing) {
+                    QByteArray anchor = attributeValue(q, p - 1, "id");
+                    if (anchor.isEmpty() && equalsNoCase(name, len, "a")) anchor = attributeValue(q, p - 1, "name");
+                    if (!anchor.isEmpty()) {
+                        PageStructure::Anchor a = { anchor, at };
+                        structure->anchors.append(a);
+                    }
+                    if (title && titleStart < 0) titleStart = at;
+                    if (heading && headingStart < 0) headingStart = at;
+                } else if (title && titleStart >= 0) {
+                    if (structure->title.isEmpty()) structure->title = out->mid(titleStart).trimmed();
+                    titleStart = -1;
+                } else if (heading && headingStart >= 0) {
+                    structure->heading = out->mid(headingStart).trimmed();
+                    headingStart = -1;
+                }
+            }
+            if (!closing && equalsNoCase(name, len, "script")) p = skipRawText(p, end, "script");
+            else if (!closing && equalsNoCase(name, len, "style")) p = skipRawText(p, end, "style");
+            if (!isInlineTag(name, len)) pendingSpace = true;
+        } else if (c == '&') {
+            uint cp = 0;
+            const char *next = decodeEntity(p, end, &cp);
+            if (!next) {
+                beginText();
+                out->append('&');
+                ++p;
+            } else if (cp == 0xA0 || cp == 0x2002 || cp == 0x2003 || cp == 0x2009) {
+                pendingSpace = true;
+                p = next;
+            } else {
+                if (cp != 0xAD) {   // soft hyphen: keeps the word joined
+                    beginText();
+                    appendUtf8(out, cp);
+                }
+                p = next;
+            }
+        } else if (isAsciiSpace(c)) {
+            pendingSpace = true;
+            ++p;
+        } else {
+            // copy a run of plain text in one go
+            const char *run = p;
+            while (p < end && *p != '<' && *p != '&' && !isAsciiSpace(*p) && !(latin1 && uchar(*p) >= 0x80)) ++p;
+            if (p > run) {
+                beginText();
+                out->append(run, int(p - run));
+            } else {
+                // a Latin-1 byte outside ASCII: transcode it
+                uint cp = latin1ToUnicode(uchar(*p++));
+                if (cp == 0xA0) {
+                    pendingSpace = true;
+                } else if (cp != 0xAD) {
+                    beginText();
+                    appendUtf8(out, cp);
+                }
+            }
+        }
+    }
+}
+
+void extractPageText(const char *data, int size, QByteArray *text, PageStructure *structure) {
+    QByteArray charset, decoded;
+    PageEncoding encoding = sniffPageEncoding(data, size, &charset);
+    if (encoding == PageEncoding::Other) {
+        QTextCodec *codec = QTextCodec::codecForName(charset);
+        if (codec) {
+            decoded = codec->toUnicode(data, size).toUtf8();
+            data = decoded.constData();
+            size = decoded.size();
+        }
+    }
+    appendHtmlText(data, size, text, encoding, structure);
+}
+
+bool readPageText(const QString &path, QByteArray *text, PageStructure *structure) {
+    PerfStats::count("page reads");
+    QString inner;
+    if (QSharedPointer<BookArchive> archive = BookArchive::containing(path, &inner)) {
+        int entry = archive->indexOf(inner);
+        if (entry < 0) return false;
+        const QByteArray page = archive->data(entry);   // a slice of the archive's mapping
+        text->clear();
+        extractPageText(page.constData(), page.size(), text, structure);
+        return true;
+    }
+
+    QFile f(path);
+    if (!f.open(QIODevice::ReadOnly)) return false;
+    text->clear();
+    if (f.size() == 0) return true;
+
+    if (uchar *mapped = f.map(0, f.size())) {
+        extractPageText(reinterpret_cast<const char *>(mapped), int(f.size()), text, structure);
+    } else {
+        QByteArray buffer = f.readAll();    // e.g. file systems without mmap support
+        extractPageText(buffer.constData(), buffer.size(), text, structure);
+    }
+    return true;    // the mapping goes away with f
+}
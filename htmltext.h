@@ -0,0 +1,68 @@
+#ifndef HTMLTEXT_H
+#define HTMLTEXT_H
+
+/*
+Streaming HTML-to-text extraction shared by the folder scan and the index
+builder.
+
+appendHtmlText() makes a single pass over the raw page bytes without building
+a DOM or allocating per tag: markup, comments, <script> and <style> contents
+are dropped, character references (&amp; &#8217; &#x2014; ...) are decoded to
+UTF-8, and whitespace and block-level tags collapse into single spaces so
+words on either side of <p>, <br>, <td> ... don't run together. Inline tags
+(<b>, <i>, <span>, ...) don't separate text, so "<b>L</b>ord" stays "Lord".
+
+Pages are read through QFile::map() and cleaned straight from the mapped
+bytes. UTF-8 and Latin-1/windows-1252 pages (as declared by a BOM or <meta
+charset>) are handled in the same pass; only pages in other encodings are
+decoded up front with QTextCodec.
+
+Given a PageStructure, the same pass also notes where the page's named
+elements (id="...", <a name="...">) fall in the text, and the text of its
+<title> and first <h1>, for the verse references of the index (searchindex.h).
+*/
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+enum class PageEncoding {
+    Utf8,
+    Latin1,     // ISO-8859-1 / windows-1252 / US-ASCII
+    Other       // anything QTextCodec has to decode first
+};
+
+// Encoding of a page from its BOM or <meta charset> in the first 1024 bytes;
+// defaults to UTF-8. *name receives the declared charset for PageEncoding::Other.
+PageEncoding sniffPageEncoding(const char *data, int size, QByteArray *name = nullptr);
+
+struct PageStructure {
+    struct Anchor {
+        QByteArray name;    // the id or name, undecoded
+        int offset;         // where the element's text starts in the extracted text
+    };
+    QVector<Anchor> anchors;
+    QByteArray title;       // extracted text of <title>
+    QByteArray heading;     // ...and of the first <h1>
+};
+
+// Append the visible text of html in data to out, as UTF-8. Anchor offsets
+// in structure are positions in out.
+void appendHtmlText(const char *data, int size, QByteArray *out,
+                    PageEncoding encoding = PageEncoding::Utf8, PageStructure *structure = nullptr);
+
+inline QByteArray htmlToText(const QByteArray &html) {
+    QByteArray text;
+    appendHtmlText(html.constData(), html.size(), &text);
+    return text;
+}
+
+// appendHtmlText() for raw page bytes in whatever encoding the page declares.
+void extractPageText(const char *data, int size, QByteArray *text, PageStructure *structure = nullptr);
+
+// Map the page at path and replace *text with its extracted UTF-8 text. Pages
+// inside an open book archive are read from the archive's mapping.
+// Passing the same buffer for every page avoids reallocating it.
+bool readPageText(const QString &path, QByteArray *text, PageStructure *structure = nullptr);
+
+#endif // HTMLTEXT_H
@@ -0,0 +1,149 @@
+#include "library.h"
+#include "perfstats.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QFuture>
+#include <QList>
+#include <QtConcurrent/QtConcurrentRun>
+#include <algorithm>
+
+static QString bookKey(const QString &dir) {
+    return QDir::cleanPath(dir);
+}
+
+int Library::indexOf(const QString &dir) const {
+    const QString key = bookKey(dir);
+    for (int i = 0; i < bookList.size(); ++i) {
+        if (bookKey(bookList.at(i).dir) == key) return i;
+    }
+    return -1;
+}
+
+int Library::bookOf(const QString &path) const {
+    const QString p = bookKey(path);
+    for (int i = 0; i < bookList.size(); ++i) {
+        const QString key = bookKey(bookList.at(i).dir);
+        if (p.startsWith(key) && p.size() > key.size() && p.at(key.size()) == '/') return i;
+    }
+    return -1;
+}
+
+bool Library::add(const QString &dir, QString *error) {
+    if (indexOf(dir) >= 0) return true;
+    Book book;
+    if (BookArchive::isArchivePath(dir)) {
+        book.archive = BookArchive::open(dir);
+        if (!book.archive) {
+            if (error) *error = "not a book archive";
+            return false;
+        }
+        book.dir = book.archive->fileName();
+    } else {
+        if (!QFileInfo(dir).isDir()) {
+            if (error) *error = "no such folder";
+            return false;
+        }
+        book.dir = bookKey(dir);
+    }
+    bookList.append(book);
+    return true;
+}
+
+void Library::remove(const QString &dir) {
+    int i = indexOf(dir);
+    if (i >= 0) bookList.remove(i);
+}
+
+void Library::setSelected(const QString &dir, bool selected) {
+    int i = indexOf(dir);
+    if (i >= 0) bookList[i].selected = selected;
+}
+
+void Library::setSegment(const QString &dir, const BookSegment &segment) {
+    int i = indexOf(dir);
+    if (i >= 0) bookList[i].segment = segment;
+}
+
+int Library::pendingCount() const {
+    int n = 0;
+    for (const Book &book : bookList) {
+        if (book.selected && !book.segment.index) ++n;
+    }
+    return n;
+}
+
+QString Library::nextToRefresh() const {
+    QString unselected;
+    for (const Book &book : bookList) {
+        if (book.segment.index) continue;
+        if (book.selected) return book.dir;
+        if (unselected.isEmpty()) unselected = book.dir;
+    }
+    return unselected;
+}
+
+QVector<LibraryHit> Library::search(const QString &query, int flags) const {
+    ScopedTimer timer("library search");
+    QVector<int> searched;
+    for (int i = 0; i < bookList.size(); ++i) {
+        if (bookList.at(i).selected && bookList.at(i).segment.index) searched.append(i);
+    }
+    QVector<LibraryHit> hits;
+    if (searched.isEmpty()) return hits;
+
+    // Two rounds over the segments, each on the global pool: the statistics
+    // of every segment, then the searches, scored against their sum.
+    QList<QFuture<SearchIndex::Statistics> > counting;
+    for (int i : searched) {
+        QSharedPointer<SearchIndex> index = bookList.at(i).segment.index;
+        counting.append(QtConcurrent::run([index, query, flags]() { return index->statistics(query, flags); }));
+    }
+    SearchIndex::Statistics stats;
+    for (QFuture<SearchIndex::Statistics> &f : counting) stats.add(f.result());
+
+    QList<QFuture<QVector<SearchHit> > > searching;
+    for (int i : searched) {
+        QSharedPointer<SearchIndex> index = bookList.at(i).segment.index;
+        searching.append(QtConcurrent::run([index, query, stats, flags]() {
+            return index->search(query, nullptr, &stats, flags);
+        }));
+    }
+    for (int s = 0; s < searched.size(); ++s) {
+        for (const SearchHit &h : searching[s].result()) {
+            LibraryHit hit;
+            hit.book = searched.at(s);
+            hit.hit = h;
+            hits.append(hit);
+        }
+    }
+    // each segment's hits are already ranked; stable keeps book order on ties
+    std::stable_sort(hits.begin(), hits.end(), [](const LibraryHit &x, const LibraryHit &y) {
+        return x.hit.score > y.hit.score;
+    });
+    return hits;
+}
+
+BookSegment Library::refresh(const QString &dir, const QSharedPointer<SearchIndex> &base) {
+    ScopedTimer timer("index refresh");
+    BookSegment r;
+    QSharedPointer<SearchIndex> index(base ? new SearchIndex(*base) : new SearchIndex(dir));
+    index->setPageTexts(QSharedPointer<PageTextCache>());   // the copy gets the new cache below
+    r.manifest = SiteManifest::scan(dir);
+    if (index->isEmpty()) index->load();
+    if (BookArchive::isArchivePath(dir)) {
+        index->update(r.manifest.pages());
+    } else {
+        // the page texts extracted for the index are kept for searches and speech
+        PageTextCache::Builder texts(dir);
+        if (index->update(r.manifest.pages(), &texts) > 0) {
+            if (!index->save()) qDebug() << "Could not write search index" << SearchIndex::indexFilePath(dir);
+            if (!texts.save()) qDebug() << "Could not write page texts" << PageTextCache::cacheFilePath(dir);
+        }
+        r.texts = PageTextCache::open(dir);
+        index->setPageTexts(r.texts);
+    }
+    r.index = index;
+    return r;
+}
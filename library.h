@@ -0,0 +1,88 @@
+#ifndef LIBRARY_H
+#define LIBRARY_H
+
+/*
+A library of books searched as one.
+
+Each registered book (a site folder or a .hbk archive) keeps the index it has
+anyway (searchindex.h) as its segment of the library, so adding a book to the
+library costs nothing beyond indexing it once, and a book keeps its index
+when it is removed again. search() asks the selected books' segments on the
+global thread pool and merges their hits by score. Scores are computed
+against the collection statistics summed over the selection (page count,
+average page length, pages per query word), so a page ranks the same however
+the library is split into books.
+
+Segments are loaded or brought up to date with refresh(), which the viewer
+runs in the background for one book after the other; a book without a
+segment yet is simply not searched. Library itself belongs to one thread
+(the viewer's GUI thread); the segments are immutable and shared, so a copy
+is cheap and can be searched on another thread. search() waits for its
+segments, so the viewer and searchserver.h call it on a pool of their own.
+*/
+
+#include <QSharedPointer>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include "bookarchive.h"
+#include "pagetextcache.h"
+#include "searchindex.h"
+#include "sitemanifest.h"
+
+// A book's index with the pages and page texts it covers.
+struct BookSegment {
+    QSharedPointer<SearchIndex> index;
+    SiteManifest manifest;
+    QSharedPointer<PageTextCache> texts;    // null for packed books
+};
+
+struct LibraryHit {
+    int book;           // index into Library::books()
+    SearchHit hit;      // file is an id in that book's segment
+};
+
+class Library {
+public:
+    struct Book {
+        QString dir;                            // site folder or .hbk archive
+        bool selected = true;                   // searched by search()
+        QSharedPointer<BookArchive> archive;    // kept open while registered
+        BookSegment segment;                    // index null until refreshed
+    };
+
+    Library() {}
+
+    const QVector<Book> &books() const { return bookList; }
+    int size() const { return bookList.size(); }
+    int indexOf(const QString &dir) const;
+    // The registered book a page path lies in, or -1.
+    int bookOf(const QString &path) const;
+
+    // Register a book (archives are opened); false if it can't be read.
+    // Adding a book already in the library does nothing.
+    bool add(const QString &dir, QString *error = nullptr);
+    void remove(const QString &dir);
+    void setSelected(const QString &dir, bool selected);
+    void setSegment(const QString &dir, const BookSegment &segment);
+
+    // Selected books whose segment hasn't been loaded yet.
+    int pendingCount() const;
+    // The first book without a segment, selected ones first, or an empty string.
+    QString nextToRefresh() const;
+
+    // Pages containing every word of query in all selected books with a
+    // segment, best score first (see SearchIndex::search() for flags).
+    QVector<LibraryHit> search(const QString &query, int flags = SearchIndex::Exact) const;
+
+    // base (or the index saved with the book) brought in line with the book's
+    // pages, saving the index and page text cache of a site folder when they
+    // changed. Runs on any thread.
+    static BookSegment refresh(const QString &dir, const QSharedPointer<SearchIndex> &base);
+
+private:
+    QVector<Book> bookList;
+};
+
+#endif // LIBRARY_H
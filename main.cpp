@@ -4,12 +4,13 @@ Save as: main.cpp
 
 .pro file example (save as viewer.pro):
 
-QT       += core gui widgets webenginewidgets
+QT       += core gui widgets webenginewidgets concurrent network
 QT       += texttospeech      # optional; remove if not available
 
 CONFIG += c++11
 
-SOURCES += main.cpp
+SOURCES += main.cpp batchmode.cpp bookarchive.cpp bookprofile.cpp bookscheme.cpp folderscan.cpp htmltext.cpp library.cpp memorybudget.cpp pagetextcache.cpp pdfexport.cpp pdfmerge.cpp perfpanel.cpp perfstats.cpp prefetcher.cpp readingsession.cpp resultsmodel.cpp searchserver.cpp searchindex.cpp searchkernel.cpp sitemanifest.cpp stemmer.cpp termdictionary.cpp
+HEADERS += batchmode.h bookarchive.h bookprofile.h bookscheme.h folderscan.h htmltext.h library.h memorybudget.h pagetextcache.h pdfexport.h pdfmerge.h perfpanel.h perfstats.h prefetcher.h readingsession.h resultsmodel.h searchserver.h searchindex.h searchkernel.h sitemanifest.h stemmer.h termdictionary.h
 
 # On some platforms you may need to link additional libraries.
 
@@ -24,8 +25,22 @@ Run the app; Home loads index.html by default.
 Notes:
 - Uses QWebEngineView (Qt WebEngine). Make sure Qt was built with WebEngine support.
 - Text-to-speech uses QTextToSpeech (Qt TextToSpeech module). If your Qt build doesn't include it, that section will still compile if the module is present; otherwise remove the QTextToSpeech parts or install the module.
-- Search across subpages reads *.html, *.htm files under the loaded site directory and performs a case-insensitive text search within files (simple string search). It then lists results and allows opening.
-- Printing uses QWebEnginePage::printToPdf and opens the generated PDF.
+- Search across subpages uses an inverted word index of the visible text (tags, scripts and styles stripped, entities decoded; see htmltext.h) of the *.html, *.htm files under the loaded site directory (see searchindex.h). The index is saved in <site>/.htmlbooks/ and kept up to date in the background: a QFileSystemWatcher on the site directories triggers re-indexing of just the pages that were added, removed or modified (size/mtime fingerprints); until it is ready, folder searches scan the pages on a thread pool and stream matches into the list. Results list every page containing all words of the query (case-insensitive), ranked by BM25, with a hit count and a highlighted snippet, and allow opening. Words in double quotes match as a phrase, from the word positions in the index. Queries may also use OR, NOT (or -word), site:subfolder and /regular expressions/; a pattern is matched against the text of only the pages the index can't rule out. A word no page has matches the closest indexed words (1 or 2 edits, see termdictionary.h; search/fuzzy false turns this off), a word followed by ~ always does, and search/stemming true matches every word of the same stem ("bless" finds "blessed", "blessing"). A chapter or verse reference ("John 3:16", "Gen 1.1") is listed first and opens the page at the verse: pages titled like "John 3" and their verse anchors are recorded in the index as it is built.
+- Packed books: Pack Book... writes the site folder (pages, images, styles and its search index) into a single .hbk archive (see bookarchive.h), compressing text with deflate (or zstd, see archive/compression in the settings). Opening an archive maps it once; pages are served to the view as book:// URLs straight from the mapping, and search reads the same mapping, so a packed book costs no per-page open() or stat().
+- Prefetch: once a page has loaded, its rel="next" targets and the next file of a numbered sequence (ch09.html -> ch10.html) are read in the background (see prefetcher.h). With prefetch/prerender set in the settings, the most likely one is also loaded into a hidden page that is swapped into the view when its link is followed, and Back swaps the previous page back in.
+- Tabs: New Tab (Ctrl+T), links opened in a new tab or window, and Close Tab. Tabs share one view, each with a page of its own. Background tabs are frozen after tabs/freezeAfterSec and discarded after tabs/discardAfterSec, or once more than tabs/maxLivePages are alive (frozen and discarded through the WebEngine page lifecycle with Qt 5.14 or later; before that a discarded page is deleted). A discarded tab is loaded again when shown and scrolled back to where it was left.
+- Each book's pages use a WebEngine profile of their own, with its storage and HTTP cache under the application's data and cache directories; cache type and size are in the settings (see bookprofile.h).
+- Library: the Library dock registers any number of books (folders or archives, kept in the settings); the "Library (selected books)" scope searches the checked ones together. Each book's own index is one segment of the library, loaded in the background and kept while other books are open; the segments are searched concurrently and their hits merged by a score computed over the whole selection (see library.h). Opening a result from another book switches to that book.
+- Page text cache: the indexer keeps the extracted text of every page in <site>/.htmlbooks/text.N (see pagetextcache.h); folder searches match it instead of decoding the HTML again, and Read Page speaks it directly when the page is cached.
+- Read Page splits the page into sentence-sized chunks inside the page, fetches them a few at a time and speaks each as the previous one finishes, selecting and scrolling to the sentence being read; Stop or leaving the page ends it.
+- Reading session: the page shown in each book, its scroll position and the back/forward history are kept (see readingsession.h) and saved in batches on a worker thread. Launching, or opening a book again, goes straight to that page and position without loading the home page first; session/resume false turns this off.
+- Start-up: the window is shown before WebEngine is brought up, the home page (or the page reading was left at) is loaded once, text-to-speech is created on first use, and the time to each start-up phase is logged ("Startup: ...").
+- Performance: searches, directory walks, page reads, page loads and speech are timed and counted (see perfstats.h). The Performance dock shows the numbers and can record a Chrome trace (chrome://tracing, Perfetto); setting perf/traceFile traces every session from launch.
+- Low-memory mode (--low-memory or memory/lowMemory, see memorybudget.h), for reading terminals with 1-2 GB of RAM: WebEngine is limited to memory/rendererProcesses renderer processes (default 1) in low-end device mode, one background tab stays alive and is frozen and discarded sooner, nothing is pre-rendered, the HTTP cache stays on disk, pages are indexed and searched on one thread, and the result list holds the first memory/maxResults matches (default 200). Minimizing the window discards background tabs and drops caches (memory/releaseOnMinimize), and the status bar shows the memory used by the viewer and its WebEngine processes against memory/budgetMB (default 768); going over it is logged and releases memory in the same way.
+- Search server: with server/port set, other programs on the kiosk (a voice assistant, a signage app) can search the open book and the library over HTTP on server/address (default 127.0.0.1): GET /search?q=...&scope=book|library&limit=N answers JSON with the ranked pages and snippets, and /books and /status describe the library and the index (see searchserver.h). Connections are kept alive, and searches run on a thread pool of their own against the same indexes the window uses.
+- Batch mode: --build-index DIR, --search DIR TERM and --pack DIR FILE (with --threads N) run without a window, for preparing books on a build server (see batchmode.h); cli/cli.pro builds the same commands as htmlbooks-index, without GUI or WebEngine.
+- Benchmarks: engine.pri holds the search engine (no GUI); bench/bench.pro builds htmlbooks-bench, which times the directory walk, folder search, index build/load and queries on a book or a synthetic corpus (--synthetic N --kb M) and reports MB/s, queries/s, latency percentiles and peak RSS.
+- Printing uses QWebEnginePage::printToPdf and opens the generated PDF. Export Book as PDF... renders every page of the book on a pool of offscreen pages and appends them to one PDF in book order, with progress and cancel in the status bar (see pdfexport.h, pdfmerge.h).
 */
 
 #include <QApplication>
@@ -40,22 +55,49 @@ Notes:
 #include <QDir>
 #include <QFile>
 #include <QTextStream>
+#include <QListView>
 #include <QListWidget>
 #include <QSplitter>
+#include <QTabBar>
 #include <QStatusBar>
 #include <QLabel>
 #include <QKeySequence>
+#include <QPixmapCache>
 #include <QDesktopServices>
 #include <QUrl>
+#include <QPointF>
 #include <QTemporaryFile>
 #include <QStandardPaths>
+#include <QDataStream>
 #include <QDebug>
+#include <QDateTime>
+#include <QDockWidget>
+#include <QElapsedTimer>
 #include <QComboBox>
+#include <QFileSystemWatcher>
+#include <QFutureWatcher>
+#include <QHostAddress>
+#include <QJsonArray>
+#include <QProgressBar>
+#include <QPushButton>
+#include <QJsonDocument>
+#include <QSharedPointer>
+#include <QSet>
+#include <QSettings>
+#include <QSignalBlocker>
+#include <QThreadPool>
+#include <QTimer>
+#include <QtConcurrent/QtConcurrentRun>
+#include <algorithm>
+#include <cstring>
+#include <functional>
 #include <QtWebEngine/QtWebEngine>   // add this include at the top
 
 
 #include <QtWebEngineWidgets/QWebEngineView>
+#include <QtWebEngineWidgets/QWebEngineHistory>
 #include <QtWebEngineWidgets/QWebEnginePage>
+#include <QtWebEngineWidgets/QWebEngineProfile>
 
 
 
@@ -63,6 +105,275 @@ Notes:
 #include <QTextToSpeech>
 #endif
 
+#ifdef __GLIBC__
+#include <malloc.h>     // malloc_trim
+#endif
+
+#include "batchmode.h"
+#include "bookarchive.h"
+#include "bookprofile.h"
+#include "bookscheme.h"
+#include "folderscan.h"
+#include "htmltext.h"
+#include "library.h"
+#include "memorybudget.h"
+#include "pagetextcache.h"
+#include "pdfexport.h"
+#include "perfpanel.h"
+#include "perfstats.h"
+#include "prefetcher.h"
+#include "readingsession.h"
+#include "resultsmodel.h"
+#include "searchindex.h"
+#include "searchkernel.h"
+#include "searchserver.h"
+#include "sitemanifest.h"
+
+// Launch timings since main(), one entry per phase, logged once the home page
+// has loaded so start-up regressions on slow devices show up in the log.
+static QElapsedTimer &startupClock() {
+    static QElapsedTimer clock;
+    return clock;
+}
+
+static QStringList &startupPhases() {
+    static QStringList phases;
+    return phases;
+}
+
+static void startupPhase(const char *name) {
+    startupPhases().append(QString("%1 %2 ms").arg(name).arg(startupClock().elapsed()));
+}
+
+// Selects the nth (0-based) case-insensitive occurrence of needle in the page's
+// visible text and scrolls it into view. Whitespace runs count as one space,
+// as in htmltext.cpp, so multi-word hits and offsets line up with the index.
+static const char *highlightHitJs = R"JS(
+(function(args) {
+    var needle = args[0].toLowerCase(), nth = args[1];
+    var skip = { SCRIPT: 1, STYLE: 1, NOSCRIPT: 1, TEMPLATE: 1 };
+    var walker = document.createTreeWalker(document.documentElement, NodeFilter.SHOW_TEXT, {
+        acceptNode: function(n) {
+            for (var p = n.parentNode; p; p = p.parentNode)
+                if (skip[p.nodeName]) return NodeFilter.FILTER_REJECT;
+            return NodeFilter.FILTER_ACCEPT;
+        }
+    });
+    function isSpace(c) { return c <= 32 || c === 160; }
+    var parts = [], nodes = [], length = 0, space = true;
+    for (var n = walker.nextNode(); n; n = walker.nextNode()) {
+        var s = n.nodeValue, out = '';
+        nodes.push({ node: n, start: length, space: space });
+        for (var i = 0; i < s.length; ++i) {
+            var c = s.charCodeAt(i);
+            if (isSpace(c)) { if (!space) { out += ' '; space = true; } }
+            else { out += s[i]; space = false; }
+        }
+        parts.push(out);
+        length += out.length;
+    }
+    var text = parts.join('').toLowerCase();
+    var pos = -1;
+    for (var k = 0, from = 0; k <= nth; ++k) {
+        var p = text.indexOf(needle, from);
+        if (p < 0) break;
+        pos = p;
+        from = p + 1;
+    }
+    if (pos < 0) return false;
+
+    // map a position in the collapsed text back to (text node, offset)
+    function locate(at) {
+        var lo = 0, hi = nodes.length - 1;
+        while (lo < hi) {
+            var mid = (lo + hi + 1) >> 1;
+            if (nodes[mid].start <= at) lo = mid; else hi = mid - 1;
+        }
+        var e = nodes[lo], s = e.node.nodeValue, sp = e.space, idx = e.start;
+        for (var i = 0; i < s.length; ++i) {
+            var c = s.charCodeAt(i);
+            if (isSpace(c)) { if (sp) continue; sp = true; } else { sp = false; }
+            if (idx === at) return { node: e.node, offset: i };
+            ++idx;
+        }
+        return { node: e.node, offset: s.length };
+    }
+    var a = locate(pos), b = locate(pos + needle.length - 1);
+    var range = document.createRange();
+    range.setStart(a.node, a.offset);
+    range.setEnd(b.node, Math.min(b.offset + 1, b.node.nodeValue.length));
+    var sel = window.getSelection();
+    sel.removeAllRanges();
+    sel.addRange(range);
+    if (a.node.parentElement) a.node.parentElement.scrollIntoView({ block: 'center' });
+    return true;
+})
+)JS";
+
+// Read Page: splits the page's visible text into sentence-sized chunks, one
+// block element (paragraph, list item, cell...) at a time, and installs
+// window.__htmlbooksReader so the chunks can be fetched a few at a time and the
+// one being read selected and scrolled to. Returns the number of chunks. Chunks
+// are kept as DOM positions, not copies of the text.
+static const char *readAloudJs = R"JS(
+(function() {
+    var skip = { SCRIPT: 1, STYLE: 1, NOSCRIPT: 1, TEMPLATE: 1 };
+    var block = /^(P|DIV|LI|H[1-6]|TD|TH|TR|BLOCKQUOTE|PRE|SECTION|ARTICLE|DD|DT|FIGCAPTION|CAPTION|HEADER|FOOTER|ASIDE|NAV|TABLE|BODY)$/;
+    var sentenceEnd = /[.!?]+["'”’)\]]*(?=\s|$)/g;
+    var maxChunk = 400;     // a sentence longer than this is read on its own
+    var root = document.body || document.documentElement;
+    var walker = document.createTreeWalker(root, NodeFilter.SHOW_TEXT, {
+        acceptNode: function(n) {
+            for (var p = n.parentNode; p; p = p.parentNode)
+                if (skip[p.nodeName]) return NodeFilter.FILTER_REJECT;
+            return NodeFilter.FILTER_ACCEPT;
+        }
+    });
+    function blockOf(n) {
+        for (var p = n.parentNode; p; p = p.parentNode)
+            if (block.test(p.nodeName)) return p;
+        return null;
+    }
+    var chunks = [], cur = null, lastBlock = null;
+    function flush() {
+        if (cur) chunks.push(cur);
+        cur = null;
+    }
+    function append(n, from, to) {
+        if (!cur) {
+            var lead = n.nodeValue.slice(from, to).search(/\S/);
+            if (lead < 0) return;
+            cur = { a: n, ao: from + lead, length: 0 };
+        }
+        cur.b = n;
+        cur.bo = to;
+        cur.length += to - from;
+    }
+    for (var n = walker.nextNode(); n; n = walker.nextNode()) {
+        var b = blockOf(n);
+        if (b !== lastBlock) { flush(); lastBlock = b; }
+        var s = n.nodeValue, from = 0, m;
+        sentenceEnd.lastIndex = 0;
+        while ((m = sentenceEnd.exec(s))) {
+            var to = m.index + m[0].length;
+            append(n, from, to);
+            // short sentences are read together, so the voice doesn't pause after each
+            if (cur && cur.length > maxChunk / 4) flush();
+            from = to;
+        }
+        append(n, from, s.length);
+        if (cur && cur.length > maxChunk) flush();
+    }
+    flush();
+
+    function range(i) {
+        var c = chunks[i], r = document.createRange();
+        r.setStart(c.a, c.ao);
+        r.setEnd(c.b, c.bo);
+        return r;
+    }
+    window.__htmlbooksReader = {
+        texts: function(from, count) {
+            var out = [];
+            for (var i = from; i < chunks.length && i < from + count; ++i) {
+                try { out.push(range(i).toString().replace(/\s+/g, ' ').trim()); }
+                catch (e) { out.push(''); }     // the page changed under us
+            }
+            return out;
+        },
+        mark: function(i) {
+            var sel = window.getSelection();
+            sel.removeAllRanges();
+            if (i < 0 || i >= chunks.length) return;
+            try {
+                var r = range(i);
+                sel.addRange(r);
+                var box = r.getBoundingClientRect();
+                if ((box.top < 0 || box.bottom > window.innerHeight) && chunks[i].a.parentElement)
+                    chunks[i].a.parentElement.scrollIntoView({ block: 'center' });
+            } catch (e) {}
+        }
+    };
+    return chunks.length;
+})();
+)JS";
+
+// Sentence-sized chunks of text for reading aloud, and where each starts in
+// it: the rules of readAloudJs, for text from the page text cache, which has no
+// paragraph breaks to split at.
+static QStringList sentenceChunks(const QString &text, QVector<int> *starts) {
+    const int maxChunk = 400;
+    auto closes = [](QChar c) {
+        return c == '.' || c == '!' || c == '?' || c == '"' || c == '\'' || c == ')' || c == ']'
+               || c == QChar(0x201D) || c == QChar(0x2019);
+    };
+    QStringList chunks;
+    int start = -1;
+    auto flush = [&](int end) {
+        QString chunk = start < 0 ? QString() : text.mid(start, end - start).trimmed();
+        if (!chunk.isEmpty()) {
+            chunks.append(chunk);
+            starts->append(start);
+        }
+        start = -1;
+    };
+    for (int i = 0; i < text.size(); ++i) {
+        const QChar c = text.at(i);
+        if (start < 0) {
+            if (c.isSpace()) continue;
+            start = i;
+        }
+        if (c == '.' || c == '!' || c == '?') {
+            int end = i + 1;
+            while (end < text.size() && closes(text.at(end))) ++end;
+            if (end == text.size() || text.at(end).isSpace()) {
+                if (end - start > maxChunk / 4) flush(end);
+                i = end - 1;
+                continue;
+            }
+        }
+        if (c.isSpace() && i - start > maxChunk) flush(i);
+    }
+    flush(text.size());
+    return chunks;
+}
+
+// Where a page says it continues: its rel="next" targets and all of its links,
+// as absolute URLs.
+static const char *pageLinksJs = R"JS(
+(function() {
+    var next = [], links = [];
+    var rel = document.querySelectorAll('link[rel~="next" i][href], a[rel~="next" i][href]');
+    for (var i = 0; i < rel.length; ++i) next.push(rel[i].href);
+    var a = document.querySelectorAll('a[href]');
+    for (var j = 0; j < a.length && links.length < 1000; ++j) links.push(a[j].href);
+    return { next: next, links: links };
+})();
+)JS";
+
+// A page whose link clicks can be answered without navigating, by showing a
+// page that has been pre-rendered already.
+class BookPage : public QWebEnginePage {
+public:
+    BookPage(QWebEngineProfile *profile, QObject *parent) : QWebEnginePage(profile, parent) {}
+
+    // Called for main-frame link clicks; returning true cancels the navigation.
+    std::function<bool(const QUrl &)> interceptLink;
+    // Makes the page for links that open a new tab or window (middle click,
+    // target="_blank"); background for tabs that shouldn't be shown yet.
+    std::function<QWebEnginePage *(bool background)> openTab;
+
+protected:
+    QWebEnginePage *createWindow(WebWindowType type) override {
+        return openTab ? openTab(type == WebBrowserBackgroundTab) : nullptr;
+    }
+
+    bool acceptNavigationRequest(const QUrl &url, NavigationType type, bool isMainFrame) override {
+        if (isMainFrame && type == NavigationTypeLinkClicked && interceptLink && interceptLink(url)) return false;
+        return QWebEnginePage::acceptNavigationRequest(url, type, isMainFrame);
+    }
+};
+
 class MiniBrowser : public QMainWindow {
     Q_OBJECT
 public:
@@ -71,6 +382,10 @@ public:
         resize(1000, 700);
 
         webview = new QWebEngineView(this);
+        bookScheme = new BookSchemeHandler(this);
+        prefetcher = new Prefetcher(this);
+        session = new ReadingSession(this);
+        session->load();
 
         // Central layout: left pane search/results, right is webview
         splitter = new QSplitter(this);
@@ -80,23 +395,67 @@ public:
         lv->setContentsMargins(4,4,4,4);
 
         searchEdit = new QLineEdit(this);
-        searchEdit->setPlaceholderText("Search (press Enter)");
+        searchEdit->setPlaceholderText("Search (type or press Enter)");
         connect(searchEdit, &QLineEdit::returnPressed, this, &MiniBrowser::onSearch);
 
+        // search as you type, once typing pauses for search/debounceMs
+        searchTimer = new QTimer(this);
+        searchTimer->setSingleShot(true);
+        searchTimer->setInterval(QSettings().value("search/debounceMs", 250).toInt());
+        connect(searchTimer, &QTimer::timeout, this, &MiniBrowser::onSearch);
+        connect(searchEdit, &QLineEdit::textEdited, this, [this](const QString &text) {
+            // a new term makes any folder scan still running obsolete
+            cancelFolderSearch();
+            // a /pattern is only searched as you type once its closing / is there
+            if (text.trimmed().size() >= 2 && !SearchIndex::hasOpenPattern(text)) searchTimer->start();
+            else searchTimer->stop();
+        });
+
+        folderScan = new FolderScan(this);
+        connect(folderScan, &FolderScan::matched, this, &MiniBrowser::addFolderResults);
+        connect(folderScan, &FolderScan::finished, this, &MiniBrowser::onFolderScanFinished);
+        connect(&indexWatcher, &QFutureWatcher<BookSegment>::finished, this, &MiniBrowser::onIndexReady);
+        connect(&libraryWatcher, &QFutureWatcher<BookSegment>::finished, this, &MiniBrowser::onLibrarySegmentReady);
+        connect(&indexSearchWatcher, &QFutureWatcher<QVector<SearchHit> >::finished, this, &MiniBrowser::onIndexSearchFinished);
+        connect(&librarySearchWatcher, &QFutureWatcher<QVector<LibraryHit> >::finished, this, &MiniBrowser::onLibrarySearchFinished);
+
+        // keep the index in sync while pages are edited: changes are coalesced and
+        // only the affected pages are re-indexed
+        siteWatcher = new QFileSystemWatcher(this);
+        siteChangeTimer = new QTimer(this);
+        siteChangeTimer->setSingleShot(true);
+        siteChangeTimer->setInterval(500);
+        connect(siteWatcher, &QFileSystemWatcher::directoryChanged, this, [this]() {
+            manifest = SiteManifest();  // rescanned by the coming refresh
+            siteChangeTimer->start();
+        });
+        connect(siteChangeTimer, &QTimer::timeout, this, [this]() { refreshIndex(searchIndex); });
+
         // scope toggle
         scopeLabel = new QLabel("Scope:", this);
         scopeCombo = new QComboBox(this);
         scopeCombo->addItem("Current page");
         scopeCombo->addItem("All subpages (folder)");
+        scopeCombo->addItem("Library (selected books)");
+        connect(scopeCombo, QOverload<int>::of(&QComboBox::currentIndexChanged), this, [this]() {
+            shownQuery.clear();     // results of another scope can't be narrowed
+            shownComplete = false;
+        });
 
         QHBoxLayout *scopel = new QHBoxLayout();
         scopel->addWidget(scopeLabel);
         scopel->addWidget(scopeCombo);
         scopel->addStretch();
 
-        resultsList = new QListWidget(this);
+        results = new ResultsModel(this);
+        results->setLimit(QSettings().value("memory/maxResults", lowMemoryMode() ? 200 : 0).toInt());
+        resultsList = new QListView(this);
+        resultsList->setModel(results);
+        resultsList->setItemDelegate(new ResultDelegate(resultsList));
+        resultsList->setUniformItemSizes(true);
+        resultsList->setEditTriggers(QAbstractItemView::NoEditTriggers);
         resultsList->setSelectionMode(QAbstractItemView::SingleSelection);
-        connect(resultsList, &QListWidget::itemActivated, this, &MiniBrowser::onResultActivated);
+        connect(resultsList, &QListView::activated, this, &MiniBrowser::onResultActivated);
 
         lv->addWidget(searchEdit);
         lv->addLayout(scopel);
@@ -104,33 +463,103 @@ public:
 
         left->setLayout(lv);
 
+        // tabs share the one view: each has a page of its own, swapped in
+        // when the tab is shown (see showTab())
+        tabBar = new QTabBar(this);
+        tabBar->setTabsClosable(true);
+        tabBar->setDocumentMode(true);
+        tabBar->setExpanding(false);
+        tabBar->setElideMode(Qt::ElideRight);
+        connect(tabBar, &QTabBar::currentChanged, this, &MiniBrowser::showTab);
+        connect(tabBar, &QTabBar::tabCloseRequested, this, &MiniBrowser::closeTab);
+        connect(webview, &QWebEngineView::titleChanged, this, [this]() { updateTabTitle(webview->page()); });
+        lifecycleTimer = new QTimer(this);
+        lifecycleTimer->setInterval(10000);
+        connect(lifecycleTimer, &QTimer::timeout, this, &MiniBrowser::applyTabLifecycle);
+
+        QWidget *right = new QWidget(this);
+        QVBoxLayout *rv = new QVBoxLayout(right);
+        rv->setContentsMargins(0, 0, 0, 0);
+        rv->setSpacing(0);
+        rv->addWidget(tabBar);
+        rv->addWidget(webview);
+
         splitter->addWidget(left);
-        splitter->addWidget(webview);
+        splitter->addWidget(right);
         splitter->setStretchFactor(1, 3);
 
         setCentralWidget(splitter);
 
+        perfDock = new QDockWidget("Performance", this);
+        perfDock->setObjectName("performance");
+        perfDock->setWidget(new PerfPanel(perfDock));
+        addDockWidget(Qt::BottomDockWidgetArea, perfDock);
+        perfDock->hide();
+
+        createLibraryDock();
         createToolbar();
         statusBar()->showMessage("Ready");
+        startMemoryReport();
+        startSearchServer();
 
-#ifdef QT_TEXTTOSPEECH_LIB
-        tts = new QTextToSpeech(this);
-#else
-        tts = nullptr;
-#endif
+        tts = nullptr;  // created on first use
 
         // Default: home file path empty until user opens directory or file
         siteDir = QDir::currentPath()+"/book/";
-        indexPath = QDir(siteDir).filePath("index.html");
-        if (QFile::exists(indexPath)) {
-            loadLocal(indexPath);
-        }
-              indexPath = QDir(siteDir).filePath("index.htm");
-        if (QFile::exists(indexPath)) {
-            loadLocal(indexPath);
+        QString packedBook = QDir::currentPath() + "/book.hbk";
+        if (!QFileInfo(siteDir).isDir() && QFileInfo(packedBook).isFile() && (archive = BookArchive::open(packedBook))) {
+            bookScheme->mount(archive);
+            siteDir = archive->fileName();
         }
+        refreshIndex(QSharedPointer<SearchIndex>());
+        indexPath = QDir(siteDir).filePath("index.html");
+        loadLibrary();
         // connect selection changed to update status
         connect(webview, &QWebEngineView::urlChanged, this, &MiniBrowser::onUrlChanged);
+        connect(webview, &QWebEngineView::loadStarted, this, [this]() {
+            loadStartUs = PerfStats::nowUs();
+#ifdef QT_TEXTTOSPEECH_LIB
+            stopReading();
+#endif
+        });
+        connect(webview, &QWebEngineView::loadFinished, this, [this](bool ok) {
+            if (loadStartUs >= 0) PerfStats::record("page load", loadStartUs, PerfStats::nowUs() - loadStartUs);
+            loadStartUs = -1;
+            if (startingUp) {
+                startingUp = false;
+                startupPhase("home loaded");
+                reportStartup();
+            }
+            if (ok && !pendingHit.needle.isEmpty() && webview->url() == pendingHit.url) showHit();
+            if (ok) restoreTabScroll();
+            if (ok) recordHistory();
+            if (ok) prefetchNext();
+        });
+
+        // Bringing up WebEngine (profile, first page, renderer process) is
+        // most of the launch time: do it once the window is on screen.
+        startupPhase("window");
+        QTimer::singleShot(0, this, &MiniBrowser::startWebEngine);
+    }
+
+    ~MiniBrowser() {
+        if (!webEngineStarted) return;
+        delete pdfExport;
+        // pages have to go before the profile they were made in
+        QWebEnginePage *shown = webview->page();
+        delete prerendered;
+        qDeleteAll(earlierPages);
+        for (Tab &tab : tabs) delete tab.page;
+        delete webview;
+        delete shown;
+    }
+
+protected:
+    void changeEvent(QEvent *event) override {
+        QMainWindow::changeEvent(event);
+        if (event->type() == QEvent::WindowStateChange && isMinimized()
+                && QSettings().value("memory/releaseOnMinimize", lowMemoryMode()).toBool())
+            releaseMemory();
     }
 
 private slots:
@@ -139,7 +568,7 @@ private slots:
 
         QAction *backAct = tb->addAction("Back");
         backAct->setShortcut(QKeySequence::Back);
-        connect(backAct, &QAction::triggered, webview, &QWebEngineView::back);
+        connect(backAct, &QAction::triggered, this, &MiniBrowser::onBack);
 
         QAction *forwardAct = tb->addAction("Forward");
         forwardAct->setShortcut(QKeySequence::Forward);
@@ -163,12 +592,18 @@ private slots:
         QAction *openDirAct = tb->addAction("Open Directory...");
         connect(openDirAct, &QAction::triggered, this, &MiniBrowser::onOpenDirDialog);
 
+        QAction *packAct = tb->addAction("Pack Book...");
+        connect(packAct, &QAction::triggered, this, &MiniBrowser::onPackBook);
+
         tb->addSeparator();
 
         QAction *printAct = tb->addAction("Print");
         printAct->setShortcut(QKeySequence::Print);
         connect(printAct, &QAction::triggered, this, &MiniBrowser::onPrint);
 
+        QAction *exportAct = tb->addAction("Export Book as PDF...");
+        connect(exportAct, &QAction::triggered, this, &MiniBrowser::onExportBook);
+
         QAction *readSelectionAct = tb->addAction("Read Selection");
         connect(readSelectionAct, &QAction::triggered, this, &MiniBrowser::onReadSelection);
 
@@ -177,33 +612,144 @@ private slots:
 
         QAction *stopAct = tb->addAction("Stop");
         connect(stopAct, &QAction::triggered, webview, &QWebEngineView::stop);
+        connect(stopAct, &QAction::triggered, this, &MiniBrowser::cancelFolderSearch);
+#ifdef QT_TEXTTOSPEECH_LIB
+        connect(stopAct, &QAction::triggered, this, &MiniBrowser::stopReading);
+#endif
+
+        QAction *newTabAct = tb->addAction("New Tab");
+        newTabAct->setShortcut(QKeySequence::AddTab);
+        connect(newTabAct, &QAction::triggered, this, &MiniBrowser::onNewTab);
+        QAction *closeTabAct = tb->addAction("Close Tab");
+        closeTabAct->setShortcut(QKeySequence::Close);
+        connect(closeTabAct, &QAction::triggered, this, [this]() { closeTab(currentTab); });
 
         QAction *reloadAct = tb->addAction("Reload");
         reloadAct->setShortcut(QKeySequence::Refresh);
         connect(reloadAct, &QAction::triggered, webview, &QWebEngineView::reload);
+
+        tb->addSeparator();
+        tb->addAction(libraryDock->toggleViewAction());
+        tb->addAction(perfDock->toggleViewAction());
     }
 
-    void onHome() {
-        // Try index.html first
-        QString idx = QDir(siteDir).filePath("index.html");
-        if (!QFile::exists(idx)) {
-            // Try index.htm fallback
-            idx = QDir(siteDir).filePath("index.htm");
-        }
+    // The Library dock: the registered books, checked when the library scope
+    // searches them. Double-clicking a book opens it.
+    void createLibraryDock() {
+        libraryDock = new QDockWidget("Library", this);
+        libraryDock->setObjectName("library");
+        QWidget *panel = new QWidget(libraryDock);
+        QVBoxLayout *layout = new QVBoxLayout(panel);
+        layout->setContentsMargins(4, 4, 4, 4);
+        libraryList = new QListWidget(panel);
+        connect(libraryList, &QListWidget::itemChanged, this, [this](QListWidgetItem *item) {
+            QString dir = item->data(Qt::UserRole).toString();
+            bool selected = item->checkState() == Qt::Checked;
+            int book = library.indexOf(dir);
+            if (book < 0 || library.books().at(book).selected == selected) return;
+            library.setSelected(dir, selected);
+            saveLibrary();
+            refreshLibrary();
+            librarySelectionChanged();
+        });
+        connect(libraryList, &QListWidget::itemDoubleClicked, this, [this](QListWidgetItem *item) {
+            QString dir = item->data(Qt::UserRole).toString();
+            if (setSiteDir(dir)) {
+                pathEdit->setText(dir);
+                if (!resumeReading()) onHome();
+            }
+        });
 
-        if (QFile::exists(idx)) {
-            loadLocal(idx);
+        QHBoxLayout *buttons = new QHBoxLayout();
+        QPushButton *addCurrent = new QPushButton("Add Current", panel);
+        connect(addCurrent, &QPushButton::clicked, this, [this]() { addToLibrary(siteDir); });
+        QPushButton *addFolder = new QPushButton("Add Folder...", panel);
+        connect(addFolder, &QPushButton::clicked, this, [this]() {
+            QString d = QFileDialog::getExistingDirectory(this, "Add Book Folder", siteDir);
+            if (!d.isEmpty()) addToLibrary(d);
+        });
+        QPushButton *addArchive = new QPushButton("Add Archive...", panel);
+        connect(addArchive, &QPushButton::clicked, this, [this]() {
+            QString f = QFileDialog::getOpenFileName(this, "Add Book Archive", siteDir, "Book archives (*.hbk)");
+            if (!f.isEmpty()) addToLibrary(f);
+        });
+        QPushButton *remove = new QPushButton("Remove", panel);
+        connect(remove, &QPushButton::clicked, this, [this]() {
+            QListWidgetItem *item = libraryList->currentItem();
+            if (!item) return;
+            library.remove(item->data(Qt::UserRole).toString());
+            saveLibrary();
+            updateLibraryList();
+            librarySelectionChanged();
+        });
+        buttons->addWidget(addCurrent);
+        buttons->addWidget(addFolder);
+        buttons->addWidget(addArchive);
+        buttons->addWidget(remove);
+
+        layout->addWidget(libraryList);
+        layout->addLayout(buttons);
+        libraryDock->setWidget(panel);
+        addDockWidget(Qt::RightDockWidgetArea, libraryDock);
+        libraryDock->hide();
+    }
+
+    void startWebEngine() {
+        startupPhase("shown");
+        useProfileFor(siteDir);
+        webview->setPage(newPage());     // pages belong to the window so they can be swapped
+        Tab first;
+        first.id = ++lastTabId;
+        first.siteDir = siteDir;
+        tabs.append(first);
+        {
+            QSignalBlocker blocker(tabBar);
+            currentTab = tabBar->addTab("New Tab");
+        }
+        lifecycleTimer->start();
+        webEngineStarted = true;
+        startupPhase("webengine");
+        startingUp = true;
+        if (resumeReading()) return;    // instead of the home page
+        QString home = homePage();
+        if (home.isEmpty()) {
+            startingUp = false;
+            reportStartup();
             return;
         }
+        loadLocal(home);
+    }
+
+    void reportStartup() {
+        qInfo().noquote() << "Startup:" << startupPhases().join(", ");
+        statusBar()->showMessage(QString("Ready in %1 ms").arg(startupClock().elapsed()));
+    }
+
+    // index.html, index.htm or else the first page of the site, or an empty
+    // string if it has no pages at its top level.
+    QString homePage() const {
+        QString idx = QDir(siteDir).filePath("index.html");
+        if (pageExists(idx)) return idx;
+        idx = QDir(siteDir).filePath("index.htm");
+        if (pageExists(idx)) return idx;
 
-        // If no index file, fall back to first HTML/HTM file in folder
         QDir dir(siteDir);
         QStringList filters;
         filters << "*.html" << "*.htm";
-        QStringList files = dir.entryList(filters, QDir::Files, QDir::Name);
+        QStringList files;
+        if (archive) {
+            for (const ArchiveEntry &e : archive->entries()) {
+                if (!e.path.contains('/') && QDir::match(filters, e.path)) files.append(e.path);
+            }
+        } else {
+            files = dir.entryList(filters, QDir::Files, QDir::Name);
+        }
+        return files.isEmpty() ? QString() : dir.filePath(files.first());
+    }
 
-        if (!files.isEmpty()) {
-            idx = dir.filePath(files.first());
+    void onHome() {
+        QString idx = homePage();
+        if (!idx.isEmpty()) {
             loadLocal(idx);
             return;
         }
@@ -213,13 +759,14 @@ private slots:
                                  .arg(siteDir));
     }
 
-
     void onOpenPath() {
         QString p = pathEdit->text().trimmed();
         if (p.isEmpty()) return;
         QFileInfo fi(p);
         if (fi.isDir()) {
             setSiteDir(fi.absoluteFilePath());
+        } else if (fi.isFile() && BookArchive::isArchivePath(p)) {
+            if (setSiteDir(fi.absoluteFilePath())) onHome();
         } else if (fi.isFile()) {
             setSiteDir(fi.absolutePath());
             loadLocal(fi.absoluteFilePath());
@@ -229,8 +776,11 @@ private slots:
     }
 
     void onOpenFileDialog() {
-        QString f = QFileDialog::getOpenFileName(this, "Open HTML file", siteDir, "HTML Files (*.html *.htm);;All Files (*)");
-        if (!f.isEmpty()) {
+        QString f = QFileDialog::getOpenFileName(this, "Open HTML file", siteDir, "HTML Files (*.html *.htm);;Book archives (*.hbk);;All Files (*)");
+        if (!f.isEmpty() && BookArchive::isArchivePath(f)) {
+            if (setSiteDir(f)) onHome();
+            pathEdit->setText(f);
+        } else if (!f.isEmpty()) {
             QFileInfo fi(f);
             setSiteDir(fi.absolutePath());
             loadLocal(f);
@@ -243,6 +793,7 @@ private slots:
         if (!d.isEmpty()) {
             setSiteDir(d);
             pathEdit->setText(d);
+            if (resumeReading()) return;
             // try loading index.html
             QString idx = QDir(d).filePath("index.html");
             if (!QFile::exists(idx)) {
@@ -258,23 +809,121 @@ private slots:
         }
     }
 
-    void setSiteDir(const QString &d) {
-        siteDir = d;
+    void onPackBook() {
+        if (archive) {
+            QMessageBox::information(this, "Already packed", QString("%1 is already a book archive.").arg(siteDir));
+            return;
+        }
+        QString dir = siteDir;
+        // archive/compression: "deflate" (default), "zstd" (when built with it) or "none"
+        QString method = QSettings().value("archive/compression", "deflate").toString();
+        BookArchive::Compression compression = method == "none" ? BookArchive::Compression::None
+                : method == "zstd" ? BookArchive::Compression::Zstd : BookArchive::Compression::Deflate;
+        QString out = QFileDialog::getSaveFileName(this, "Pack Book", QDir::cleanPath(dir) + ".hbk", "Book archives (*.hbk)");
+        if (out.isEmpty()) return;
+        if (!BookArchive::isArchivePath(out)) out += ".hbk";
+
+        statusBar()->showMessage(QString("Packing %1...").arg(dir));
+        QFutureWatcher<QString> *packing = new QFutureWatcher<QString>(this);
+        connect(packing, &QFutureWatcher<QString>::finished, this, [this, packing, out]() {
+            QString error = packing->result();
+            packing->deleteLater();
+            if (error.isEmpty()) statusBar()->showMessage(QString("Packed book: %1").arg(out));
+            else QMessageBox::warning(this, "Pack failed", QString("Could not write %1: %2").arg(out, error));
+        });
+        packing->setFuture(QtConcurrent::run([dir, out, compression]() -> QString {
+            // pack an up-to-date index so the archive opens without re-indexing
+            SearchIndex index(dir);
+            index.load();
+            if (index.update(SiteManifest::scan(dir).pages()) > 0) index.save();
+            QString error;
+            if (BookArchive::pack(dir, out, &error, compression)) return QString();
+            return error.isEmpty() ? QString("unknown error") : error;
+        }));
+    }
+
+    bool setSiteDir(const QString &d) {
+        // a .hbk file is a site too: its pages are served from the archive
+        QSharedPointer<BookArchive> packed;
+        if (BookArchive::isArchivePath(d)) {
+            packed = BookArchive::open(d);
+            if (!packed) {
+                QMessageBox::warning(this, "Invalid book", QString("%1 is not a book archive.").arg(d));
+                return false;
+            }
+            bookScheme->mount(packed);
+        }
+        archive = packed;
+        siteDir = packed ? packed->fileName() : d;
+        useProfileFor(siteDir);
         indexPath = QDir(siteDir).filePath("index.html");
+        cancelFolderSearch();
+        searchIndex.reset();
+        manifest = SiteManifest();
+        pageTexts.reset();
+        // a library book already has its index loaded: search it at once and
+        // only check it for changes
+        int book = library.indexOf(siteDir);
+        if (book >= 0 && library.books().at(book).segment.index) {
+            const BookSegment &segment = library.books().at(book).segment;
+            searchIndex = segment.index;
+            manifest = segment.manifest;
+            pageTexts = segment.texts;
+        }
+        refreshIndex(searchIndex);
         statusBar()->showMessage(QString("Site directory: %1").arg(siteDir));
+        return true;
+    }
+
+    // The URL a page is shown at: book:// for pages inside an archive.
+    QUrl pageUrl(const QString &filePath) const {
+        QUrl url = bookScheme->url(filePath);
+        return url.isValid() ? url : QUrl::fromLocalFile(QFileInfo(filePath).absoluteFilePath());
+    }
+
+    bool pageExists(const QString &filePath) const {
+        return BookArchive::fileExists(filePath);
     }
 
     void loadLocal(const QString &filePath) {
-        QUrl url = QUrl::fromLocalFile(QFileInfo(filePath).absoluteFilePath());
-        webview->load(url);
+        QUrl url = pageUrl(filePath);
+        if (!showPrerendered(url)) webview->load(url);
         statusBar()->showMessage(QString("Loaded: %1").arg(filePath));
     }
 
     void onSearch() {
-        QString term = searchEdit->text().trimmed();
+        ScopedTimer timer("search");
+        searchTimer->stop();
+        QString query = searchEdit->text();     // a trailing space ends the last word
+        QString term = query.trimmed();
         if (term.isEmpty()) return;
-        resultsList->clear();
-        if (scopeCombo->currentText().startsWith("Current")) {
+        cancelFolderSearch();
+        ++searchSerial;     // results still coming for an earlier search are dropped
+
+        const bool inPage = scopeCombo->currentText().startsWith("Current");
+        const QString error = inPage ? QString() : SearchIndex::queryError(query);
+        if (!error.isEmpty()) {
+            statusBar()->showMessage(QString("Invalid pattern %1").arg(error));
+            return;
+        }
+
+        // Appending characters to words and phrases can only narrow complete
+        // results already shown (not so with stemming, nor after words were
+        // matched by spelling, and a fuzzy search needs something to narrow);
+        // a narrowed search that falls back to spelling starts over.
+        const int flags = searchFlags();
+        bool narrow = shownComplete && !shownQuery.isEmpty() && query.startsWith(shownQuery) && query != shownQuery
+                && SearchIndex::isSimpleQuery(query)
+                && !(flags & SearchIndex::Stemmed) && !(shownIndex && shownFiles.isEmpty() && (flags & SearchIndex::Fuzzy));
+        QStringList shownPaths;
+        if (narrow && !shownIndex) shownPaths = results->paths();
+        shownComplete = false;
+        shownQuery = query;
+
+        results->reset(term);
+        results->setPageTexts(QVector<QSharedPointer<PageTextCache> >() << pageTexts);
+        if (inPage) {
+            shownQuery.clear();
             // search within current page via findText
             webview->page()->findText(QString(), QWebEnginePage::FindFlag::FindBackward); // clear previous
             webview->page()->findText(term, QWebEnginePage::FindFlag::FindCaseSensitively, [this,term](bool found){
@@ -284,72 +933,994 @@ private slots:
                     statusBar()->showMessage(QString("No matches for '%1' on current page").arg(term));
                 }
             });
+        } else if (scopeCombo->currentText().startsWith("Library")) {
+            searchLibrary(query, flags);
         } else {
-            // search all HTML files in siteDir
-            QDir dir(siteDir);
-            QStringList filters; filters << "*.html" << "*.htm";
-            QFileInfoList files = dir.entryInfoList(filters, QDir::Files | QDir::NoSymLinks, QDir::Name);
-            // also include subdirectories recursively
-            files = recursiveFindHtml(siteDir);
-            bool any=false;
-            for (const QFileInfo &fi: files) {
-                QFile f(fi.absoluteFilePath());
-                if (!f.open(QIODevice::ReadOnly|QIODevice::Text)) continue;
-                QTextStream in(&f);
-                QString contents = in.readAll();
-                f.close();
-                if (contents.contains(term, Qt::CaseInsensitive)) {
-                    QListWidgetItem *it = new QListWidgetItem(QString("%1 — %2").arg(fi.fileName(), fi.absoluteFilePath()));
-                    it->setData(Qt::UserRole, fi.absoluteFilePath());
-                    resultsList->addItem(it);
-                    any=true;
+            // search all HTML files in siteDir (and subdirectories)
+            if (searchIndex && SearchIndex::isSimpleQuery(query)) {
+                const QVector<quint32> *within = (narrow && shownIndex == searchIndex) ? &shownFiles : nullptr;
+                bool approximate = false;
+                QVector<SearchHit> hits = searchIndex->search(query, within, nullptr, flags, &approximate);
+                // words matched by spelling needn't be on the previous pages: search them all
+                if (approximate && within) hits = searchIndex->search(query, nullptr, nullptr, flags, &approximate);
+                showIndexResults(searchIndex, hits, term, sender() == searchEdit, approximate);
+            } else if (searchIndex) {
+                // patterns read and match pages: off the GUI thread, shown
+                // unless another search has started by the time it is done
+                statusBar()->showMessage(QString("Searching site directory for '%1'...").arg(term));
+                const QSharedPointer<SearchIndex> index = searchIndex;
+                pendingSearch.serial = searchSerial;
+                pendingSearch.index = index;
+                pendingSearch.term = term;
+                pendingSearch.activate = sender() == searchEdit;
+                indexSearchWatcher.setFuture(QtConcurrent::run(&searchPool, [index, query, flags]() {
+                    return index->search(query, nullptr, nullptr, flags);
+                }));
+            } else if (!SearchIndex::isSimpleQuery(query)) {
+                statusBar()->showMessage("Queries with OR, NOT, site: or /patterns/ need the search index, which is still being built");
+            } else {
+                // index not ready yet: scan the pages in the background and stream matches in
+                statusBar()->showMessage(QString("Searching site directory for '%1'...").arg(term));
+                SiteManifest pages = manifest;
+                if (narrow && !shownIndex) {
+                    QVector<SitePage> previous;
+                    for (const QString &p : shownPaths) {
+                        SitePage page;
+                        page.path = p;
+                        previous.append(page);
+                    }
+                    pages = SiteManifest::fromPages(siteDir, previous);
                 }
+                shownIndex.reset();
+                folderScan->start(siteDir, term, pages, pageTexts);
+            }
+        }
+    }
+
+    void onIndexSearchFinished() {
+        if (pendingSearch.serial != searchSerial) return;   // superseded
+        // not a simple query, so never narrowed
+        showIndexResults(pendingSearch.index, indexSearchWatcher.result(), pendingSearch.term, pendingSearch.activate, true);
+        pendingSearch.index.reset();
+    }
+
+    // Lists an index search's hits, a verse reference first; activate opens
+    // the reference at once (Enter rather than typing). Approximate results
+    // (see SearchIndex::search()) are not narrowed by the next search.
+    void showIndexResults(const QSharedPointer<SearchIndex> &index, const QVector<SearchHit> &hits,
+                          const QString &term, bool activate, bool approximate) {
+        QVector<SearchResult> rows;
+        rows.reserve(hits.size());
+        for (const SearchHit &h : hits) {
+            SearchResult r;
+            r.path = index->absolutePath(h.file);
+            r.score = h.score;
+            r.hits = int(h.hits);
+            r.offset = int(h.offset);
+            rows.append(r);
+        }
+        // a verse reference ("John 3:16") is listed first, and opened at once on Enter
+        VerseRef ref;
+        const bool reference = index->findReference(term, &ref);
+        if (reference) rows.prepend(referenceResult(*index, ref, term));
+        results->setResults(rows);
+
+        shownIndex = index;
+        shownFiles.clear();
+        for (const SearchHit &h : hits) shownFiles.append(h.file);
+        std::sort(shownFiles.begin(), shownFiles.end());
+        shownComplete = !approximate;
+        if (reference) statusBar()->showMessage(QString("%1: %2").arg(term, rows.first().path));
+        else if (hits.isEmpty()) statusBar()->showMessage(QString("No matches for '%1' in site directory").arg(term));
+        else statusBar()->showMessage(QString("%1 pages match '%2'").arg(hits.size()).arg(term) + listedNote());
+        if (reference && activate) onResultActivated(results->index(0));
+    }
+
+    // How tolerant index searches are: search/stemming matches every word of
+    // a query word's stem, search/fuzzy the closest words to one no page has.
+    static int searchFlags() {
+        QSettings settings;
+        int flags = SearchIndex::Exact;
+        if (settings.value("search/stemming", false).toBool()) flags |= SearchIndex::Stemmed;
+        if (settings.value("search/fuzzy", true).toBool()) flags |= SearchIndex::Fuzzy;
+        return flags;
+    }
+
+    static SearchResult referenceResult(const SearchIndex &index, const VerseRef &ref, const QString &term) {
+        SearchResult r;
+        r.path = index.absolutePath(ref.file);
+        r.offset = int(ref.offset);
+        r.anchor = QString::fromUtf8(ref.anchor);
+        r.title = QString("%1 (%2)").arg(term, QFileInfo(r.path).fileName());
+        return r;
+    }
+
+    void addFolderResults(const ScanMatches &batch) {
+        QVector<SearchResult> rows;
+        rows.reserve(batch.size());
+        for (int i = 0; i < batch.size(); ++i) {
+            SearchResult r;
+            r.path = batch.paths.at(i);
+            r.hits = batch.hits.at(i);
+            r.offset = batch.offsets.at(batch.offsetStart.at(i));
+            rows.append(r);
+        }
+        results->append(rows);
+    }
+
+    void onFolderScanFinished(int matches) {
+        // a list cut short by memory/maxResults can't be narrowed
+        shownComplete = results->droppedCount() == 0;
+        QString term = searchEdit->text().trimmed();
+        if (matches == 0) statusBar()->showMessage(QString("No matches for '%1' in site directory").arg(term));
+        else statusBar()->showMessage("Search complete" + listedNote());
+    }
+
+    // Said after a result count when the list holds only the first of them.
+    QString listedNote() const {
+        if (!results->droppedCount()) return QString();
+        return QString(" (the first %1 are listed)").arg(results->rowCount());
+    }
+
+    void cancelFolderSearch() {
+        if (!folderScan->isRunning()) return;
+        folderScan->cancel();
+        statusBar()->showMessage("Search cancelled");
+    }
+
+    void refreshIndex(const QSharedPointer<SearchIndex> &base) {
+        // Update a copy of base (or the index saved on disk) off the GUI thread;
+        // the current index keeps answering searches until the copy is swapped in.
+        // Changes made while the book's refresh runs are picked up by one more
+        // refresh from its result (onIndexReady()), never by a second worker
+        // writing the same files.
+        if (indexWatcher.isRunning() && refreshingDir == siteDir) {
+            refreshPending = true;
+            return;
+        }
+        QString dir = siteDir;
+        refreshingDir = dir;
+        refreshPending = false;
+        indexWatcher.setFuture(QtConcurrent::run([dir, base]() { return Library::refresh(dir, base); }));
+    }
+
+    void onIndexReady() {
+        BookSegment r = indexWatcher.result();
+        if (r.index->siteDir() != siteDir) return;
+        searchIndex = r.index;
+        manifest = r.manifest;
+        pageTexts = r.texts;
+        if (!siteWatcher->directories().isEmpty()) siteWatcher->removePaths(siteWatcher->directories());
+        if (!manifest.directories().isEmpty()) siteWatcher->addPaths(manifest.directories());
+        if (library.indexOf(siteDir) >= 0) {
+            library.setSegment(siteDir, r);
+            updateLibraryList();
+            refreshLibrary();
+        }
+        if (refreshPending) refreshIndex(searchIndex);
+    }
+
+    // Library: books registered in library/books in the settings, the ones
+    // not searched in library/unselected. Their indexes are loaded one book
+    // at a time in the background and stay loaded whichever book is open.
+    void loadLibrary() {
+        QSettings settings;
+        QStringList unselected = settings.value("library/unselected").toStringList();
+        for (const QString &dir : settings.value("library/books").toStringList()) {
+            QString error;
+            if (!library.add(dir, &error)) {
+                qDebug() << "Library book not found:" << dir << error;
+                continue;
+            }
+            if (unselected.contains(dir)) library.setSelected(dir, false);
+        }
+        updateLibraryList();
+        refreshLibrary();
+    }
+
+    void saveLibrary() {
+        QStringList books, unselected;
+        for (const Library::Book &book : library.books()) {
+            books.append(book.dir);
+            if (!book.selected) unselected.append(book.dir);
+        }
+        QSettings settings;
+        settings.setValue("library/books", books);
+        settings.setValue("library/unselected", unselected);
+    }
+
+    void addToLibrary(const QString &dir) {
+        QString error;
+        if (!library.add(dir, &error)) {
+            QMessageBox::warning(this, "Add to library", QString("Could not add %1: %2").arg(dir, error));
+            return;
+        }
+        saveLibrary();
+        updateLibraryList();
+        refreshLibrary();
+        librarySelectionChanged();
+    }
+
+    void updateLibraryList() {
+        QSignalBlocker blocker(libraryList);
+        libraryList->clear();
+        for (const Library::Book &book : library.books()) {
+            QListWidgetItem *item = new QListWidgetItem(libraryList);
+            QString name = QFileInfo(book.dir).fileName();
+            if (book.segment.index) item->setText(QString("%1 (%2 pages)").arg(name).arg(book.segment.index->fileCount()));
+            else item->setText(QString("%1 (indexing...)").arg(name));
+            item->setToolTip(book.dir);
+            item->setData(Qt::UserRole, book.dir);
+            item->setFlags(item->flags() | Qt::ItemIsUserCheckable);
+            item->setCheckState(book.selected ? Qt::Checked : Qt::Unchecked);
+        }
+    }
+
+    // Load the next book without an index, selected books first.
+    void refreshLibrary() {
+        while (!libraryWatcher.isRunning()) {
+            QString dir = library.nextToRefresh();
+            if (dir.isEmpty()) return;
+            if (library.indexOf(dir) != library.indexOf(siteDir)) {
+                libraryWatcher.setFuture(QtConcurrent::run([dir]() {
+                    return Library::refresh(dir, QSharedPointer<SearchIndex>());
+                }));
+                return;
+            }
+            // the open book: its own refresh brings the index (onIndexReady())
+            if (!searchIndex) return;
+            BookSegment segment;
+            segment.index = searchIndex;
+            segment.manifest = manifest;
+            segment.texts = pageTexts;
+            library.setSegment(dir, segment);
+            updateLibraryList();
+        }
+    }
+
+    void onLibrarySegmentReady() {
+        BookSegment r = libraryWatcher.result();
+        QString dir = r.index->siteDir();
+        if (library.indexOf(dir) >= 0) {
+            const BookSegment &current = library.books().at(library.indexOf(dir)).segment;
+            if (!current.index) library.setSegment(dir, r);   // unless the open book's refresh got there first
+            updateLibraryList();
+            librarySelectionChanged();
+        }
+        refreshLibrary();
+    }
+
+    // Library results on display are out of date: search again.
+    void librarySelectionChanged() {
+        if (scopeCombo->currentText().startsWith("Library") && !searchEdit->text().trimmed().isEmpty()) onSearch();
+    }
+
+    void searchLibrary(const QString &query, int flags) {
+        QString term = query.trimmed();
+        shownQuery.clear();     // hits of several indexes aren't narrowed
+        shownIndex.reset();
+        if (library.size() == 0) {
+            statusBar()->showMessage("The library is empty: add books in the Library panel");
+            return;
+        }
+        // every book is searched off the GUI thread, in a copy of the library
+        // as it is now (its segments are shared), and the hits shown unless
+        // another search has started by the time they are all in
+        statusBar()->showMessage(QString("Searching the library for '%1'...").arg(term));
+        const Library searched = library;
+        pendingLibrarySearch.serial = searchSerial;
+        pendingLibrarySearch.library = searched;
+        pendingLibrarySearch.term = term;
+        librarySearchWatcher.setFuture(QtConcurrent::run(&searchPool, [searched, query, flags]() {
+            return searched.search(query, flags);
+        }));
+    }
+
+    void onLibrarySearchFinished() {
+        if (pendingLibrarySearch.serial != searchSerial) return;     // superseded
+        const Library searched = pendingLibrarySearch.library;      // the books the hits refer to
+        const QString term = pendingLibrarySearch.term;
+        pendingLibrarySearch.library = Library();
+        const QVector<LibraryHit> hits = librarySearchWatcher.result();
+        QVector<SearchResult> rows;
+        rows.reserve(hits.size());
+        // the place a verse reference names, in every book that has it
+        for (const Library::Book &book : searched.books()) {
+            VerseRef ref;
+            if (book.selected && book.segment.index && book.segment.index->findReference(term, &ref))
+                rows.append(referenceResult(*book.segment.index, ref, term));
+        }
+        QVector<QSharedPointer<PageTextCache> > texts;
+        for (const Library::Book &book : searched.books()) texts.append(book.segment.texts);
+        results->setPageTexts(texts);
+        QSet<int> books;
+        for (const LibraryHit &h : hits) {
+            SearchResult r;
+            r.path = searched.books().at(h.book).segment.index->absolutePath(h.hit.file);
+            r.score = h.hit.score;
+            r.hits = int(h.hit.hits);
+            r.offset = int(h.hit.offset);
+            rows.append(r);
+            books.insert(h.book);
+        }
+        results->setResults(rows);
+        shownComplete = true;
+
+        QString message = hits.isEmpty() ? QString("No matches for '%1' in the library").arg(term)
+                : QString("%1 pages in %2 books match '%3'").arg(hits.size()).arg(books.size()).arg(term);
+        if (int pending = searched.pendingCount()) message += QString(" (%1 books still being indexed)").arg(pending);
+        message += listedNote();
+        statusBar()->showMessage(message);
+    }
+
+    void onResultActivated(const QModelIndex &index) {
+        QString file = index.data(ResultsModel::PathRole).toString();
+        if (file.isEmpty()) return;
+        // a library result from another book opens that book first
+        int book = library.bookOf(file);
+        if (book >= 0 && library.indexOf(siteDir) != book) {
+            QString dir = library.books().at(book).dir;
+            if (!setSiteDir(dir)) return;
+            pathEdit->setText(dir);
+        }
+        QString anchor = index.data(ResultsModel::AnchorRole).toString();
+        if (!anchor.isEmpty()) {
+            // a verse reference: the page scrolls to its anchor by itself
+            pendingHit = PendingHit();
+            QUrl url = pageUrl(file);
+            url.setFragment(anchor);
+            webview->load(url);
+            statusBar()->showMessage(QString("Loaded: %1#%2").arg(file, anchor));
+            return;
+        }
+
+        // Work out which occurrence in the page text the result points at, so
+        // the page can jump straight to it once it is loaded.
+        pendingHit = PendingHit();
+        pendingHit.url = pageUrl(file);
+        QByteArray text;
+        if ((pageTexts && pageTexts->text(file, &text)) || readPageText(file, &text)) {
+            int offset = index.data(ResultsModel::OffsetRole).toInt();
+            QByteArray needle = results->term().toUtf8();
+            if (offset >= 0 && offset < text.size()) {
+                // the indexed word that matched, e.g. "lightning" for "lig"
+                SearchIndex::forEachWord(text.constData() + offset, qMin(text.size() - offset, 256),
+                                         [&](const char *w, int len, int at) {
+                    if (at == 0) needle = QByteArray(w, len);
+                });
+            } else {
+                offset = CaseInsensitiveMatcher(needle).indexIn(text);
+            }
+            if (offset >= 0) {
+                CaseInsensitiveMatcher m(needle);
+                int nth = 0;
+                for (int p = m.indexIn(text); p >= 0 && p < offset; p = m.indexIn(text, p + 1)) ++nth;
+                pendingHit.needle = QString::fromUtf8(needle);
+                pendingHit.occurrence = nth;
             }
-            if (!any) statusBar()->showMessage(QString("No matches for '%1' in site directory").arg(term));
-            else statusBar()->showMessage("Search complete");
+        }
+
+        if (webview->url() == pendingHit.url) showHit();   // already open: no reload
+        else loadLocal(file);
+    }
+
+    void showHit() {
+        QJsonArray args;
+        args.append(pendingHit.needle);
+        args.append(pendingHit.occurrence);
+        QString js = QString::fromUtf8(highlightHitJs) + "(" + QString::fromUtf8(QJsonDocument(args).toJson(QJsonDocument::Compact)) + ");";
+        QString needle = pendingHit.needle;
+        pendingHit = PendingHit();
+        webview->page()->runJavaScript(js, [this, needle](const QVariant &found) {
+            if (!found.toBool()) webview->page()->findText(needle);   // markup differed; fall back
+        });
+    }
+
+    // Switch to the profile of the book at dir (see bookprofile.h).
+    void useProfileFor(const QString &dir) {
+        QString name = profileNameFor(dir);
+        if (profile && profile->storageName() == name) return;
+        QWebEngineProfile *old = profile;
+        profile = createBookProfile(name, this);
+        profile->installUrlSchemeHandler(BookSchemeHandler::scheme(), bookScheme);
+        if (!old) return;
+
+        // pages can't move to another profile: continue in a fresh one, and
+        // discard the background tabs of the old one (they are loaded again
+        // in their own book when shown)
+        QWebEnginePage *shown = webview->page();
+        const bool stashed = isBackgroundPage(shown);     // a tab being left for another book
+        for (Tab &tab : tabs) {
+            if (!tab.page || tab.page->profile() != old) continue;
+            tab.page->deleteLater();
+            tab.page = nullptr;
+            tab.frozen = false;
+        }
+        webview->setPage(newPage());
+        if (!stashed) shown->deleteLater();
+        if (prerendered) prerendered->deleteLater();
+        prerendered = nullptr;
+        for (QWebEnginePage *page : earlierPages) page->deleteLater();
+        earlierPages.clear();
+        old->deleteLater();     // after its pages
+    }
+
+    QWebEnginePage *newPage() {
+        BookPage *page = new BookPage(profile, this);
+        page->interceptLink = [this](const QUrl &url) { return showPrerendered(url); };
+        page->openTab = [this](bool background) { return openTab(QUrl(), background); };
+        connect(page, &QWebEnginePage::titleChanged, this, [this, page]() { updateTabTitle(page); });
+        connect(page, &QWebEnginePage::scrollPositionChanged, this, [this, page]() {
+            if (page == webview->page()) recordPosition();
+        });
+        return page;
+    }
+
+    // The page file a file:// or book:// URL shows, or an empty string.
+    QString pagePath(const QUrl &url) const {
+        if (url.isLocalFile()) return url.toLocalFile();
+        return bookScheme->path(url);
+    }
+
+    void prefetchNext() {
+        if (!QSettings().value("prefetch/enabled", true).toBool()) return;
+        QWebEnginePage *page = webview->page();
+        page->runJavaScript(QString::fromUtf8(pageLinksJs), [this, page](const QVariant &v) {
+            if (page != webview->page()) return;    // swapped out meanwhile
+            QString current = pagePath(page->url());
+            if (current.isEmpty()) return;
+            QVariantMap found = v.toMap();
+            QStringList relNext, links;
+            for (const QVariant &href : found.value("next").toList()) {
+                QString path = pagePath(QUrl(href.toString()).adjusted(QUrl::RemoveFragment | QUrl::RemoveQuery));
+                if (!path.isEmpty() && pageExists(path)) relNext.append(path);
+            }
+            for (const QVariant &href : found.value("links").toList()) {
+                QString path = pagePath(QUrl(href.toString()).adjusted(QUrl::RemoveFragment | QUrl::RemoveQuery));
+                if (!path.isEmpty()) links.append(path);
+            }
+            QStringList next = Prefetcher::likelyNext(current, relNext, links);
+            prefetcher->warm(next);
+            if (!next.isEmpty() && QSettings().value("prefetch/prerender", false).toBool() && !lowMemoryMode()) prerender(next.first());
+        });
+    }
+
+    void prerender(const QString &filePath) {
+        QUrl url = pageUrl(filePath);
+        if (prerendered && (prerendered->url() == url || prerendered->requestedUrl() == url)) return;
+        if (!prerendered) prerendered = newPage();
+        prerendered->load(url);
+    }
+
+    // Show the hidden pre-rendered page instead of loading url, if it holds url.
+    bool showPrerendered(const QUrl &url) {
+        if (!prerendered) return false;
+        const QUrl target = url.adjusted(QUrl::RemoveFragment);
+        if (prerendered->url().adjusted(QUrl::RemoveFragment) != target
+                && prerendered->requestedUrl().adjusted(QUrl::RemoveFragment) != target)
+            return false;
+        // swap later: this may be called from inside the shown page's navigation
+        QTimer::singleShot(0, this, [this, url]() {
+            if (!prerendered) return;
+            QWebEnginePage *next = prerendered;
+            prerendered = nullptr;
+            earlierPages.append(webview->page());
+            while (earlierPages.size() > 2) earlierPages.takeFirst()->deleteLater();   // a renderer each
+            webview->setPage(next);
+            if (url.hasFragment()) next->setUrl(url);
+            onUrlChanged(next->url());
+            updateTabTitle(next);
+            if (!pendingHit.needle.isEmpty() && webview->url() == pendingHit.url) showHit();
+            prefetchNext();
+        });
+        return true;
+    }
+
+    void onBack() {
+        // The page a pre-rendered one replaced is still alive: go back to it
+        // without reloading, and keep the one we leave as the likely next page.
+        if (webview->history()->canGoBack() || earlierPages.isEmpty()) {
+            webview->back();
+            return;
+        }
+        QWebEnginePage *left = webview->page();
+        webview->setPage(earlierPages.takeLast());
+        if (prerendered) prerendered->deleteLater();
+        prerendered = left;
+        onUrlChanged(webview->url());
+        updateTabTitle(webview->page());
+    }
+
+    // Tabs. The shown tab's page is the view's; background tabs keep theirs
+    // until the lifecycle policy freezes or discards it (applyTabLifecycle()).
+    // A discarded tab keeps its URL and scroll position and is loaded again
+    // when it is shown.
+    int tabOf(QWebEnginePage *page) const {
+        for (int i = 0; i < tabs.size(); ++i) {
+            if (tabs.at(i).page == page || (i == currentTab && webview->page() == page)) return i;
+        }
+        return -1;
+    }
+
+    bool isBackgroundPage(QWebEnginePage *page) const {
+        for (const Tab &tab : tabs) {
+            if (tab.page == page) return true;
+        }
+        return false;
+    }
+
+    int tabById(int id) const {
+        for (int i = 0; i < tabs.size(); ++i) {
+            if (tabs.at(i).id == id) return i;
+        }
+        return -1;
+    }
+
+    void updateTabTitle(QWebEnginePage *page) {
+        int i = tabOf(page);
+        if (i < 0) return;
+        QString title = page->title();
+        if (title.isEmpty()) title = QFileInfo(page->url().path()).fileName();
+        tabs[i].title = title;
+        tabBar->setTabText(i, title.isEmpty() ? QString("New Tab") : title);
+        tabBar->setTabToolTip(i, page->url().toString());
+    }
+
+    // A new tab in the current book showing url (when valid); returns its page.
+    QWebEnginePage *openTab(const QUrl &url, bool background) {
+        if (currentTab < 0) return nullptr;     // before WebEngine is up
+        Tab tab;
+        tab.id = ++lastTabId;
+        tab.siteDir = siteDir;
+        tab.url = url;
+        QWebEnginePage *page = newPage();
+        int index;
+        {
+            QSignalBlocker blocker(tabBar);
+            index = tabBar->insertTab(currentTab + 1, "New Tab");
+        }
+        tabs.insert(index, tab);
+        if (index <= currentTab) ++currentTab;
+        if (background) {
+            tabs[index].page = page;
+            tabs[index].hiddenMs = QDateTime::currentMSecsSinceEpoch();
+        } else {
+            sendToBackground(currentTab);
+            currentTab = index;
+            webview->setPage(page);
+            QSignalBlocker blocker(tabBar);
+            tabBar->setCurrentIndex(index);
+        }
+        if (url.isValid()) page->load(url);
+        applyTabLifecycle();
+        return page;
+    }
+
+    void onNewTab() {
+        openTab(webview->url(), false);
+    }
+
+    // The shown tab goes to the background with its page (and its place in the page).
+    void sendToBackground(int index) {
+        if (index < 0 || index >= tabs.size()) return;
+#ifdef QT_TEXTTOSPEECH_LIB
+        stopReading();
+#endif
+        pendingHit = PendingHit();
+        QWebEnginePage *page = webview->page();
+        Tab &tab = tabs[index];
+        tab.page = page;
+        tab.siteDir = siteDir;
+        tab.url = page->url();
+        tab.hiddenMs = QDateTime::currentMSecsSinceEpoch();
+        const int id = tab.id;
+        page->runJavaScript("[window.scrollX, window.scrollY]", [this, id](const QVariant &v) {
+            int i = tabById(id);
+            QVariantList xy = v.toList();
+            if (i >= 0 && xy.size() == 2) tabs[i].scroll = QPointF(xy.at(0).toDouble(), xy.at(1).toDouble());
+        });
+        // the pre-rendered and earlier pages belong to what this tab was showing
+        if (prerendered) prerendered->deleteLater();
+        prerendered = nullptr;
+        for (QWebEnginePage *p : earlierPages) p->deleteLater();
+        earlierPages.clear();
+    }
+
+    void showTab(int index) {
+        if (index < 0 || index >= tabs.size() || index == currentTab) return;
+        sendToBackground(currentTab);
+        currentTab = index;
+        // the tab's book may not be the open one; switching books leaves a
+        // fresh page in the view
+        QWebEnginePage *spare = nullptr;
+        if (tabs.at(index).siteDir != siteDir && setSiteDir(tabs.at(index).siteDir)) {
+            pathEdit->setText(siteDir);
+            if (!isBackgroundPage(webview->page())) spare = webview->page();
+        }
+        Tab &tab = tabs[index];
+        QWebEnginePage *page = tab.page;
+        tab.page = nullptr;
+        if (!page) {
+            // discarded: load it again and put it back where it was
+            page = spare ? spare : newPage();
+            spare = nullptr;
+            tab.restoreScroll = true;
+            PerfStats::count("tabs restored");
+            if (tab.url.isValid()) page->load(tab.url);
+        }
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+        if (page->lifecycleState() == QWebEnginePage::LifecycleState::Discarded) {
+            tab.restoreScroll = true;
+            PerfStats::count("tabs restored");
+        }
+        page->setLifecycleState(QWebEnginePage::LifecycleState::Active);
+#endif
+        tab.frozen = false;
+        webview->setPage(page);
+        if (spare) spare->deleteLater();
+        onUrlChanged(page->url());
+        updateTabTitle(page);
+    }
+
+    void restoreTabScroll() {
+        if (currentTab < 0 || !tabs.at(currentTab).restoreScroll) return;
+        Tab &tab = tabs[currentTab];
+        tab.restoreScroll = false;
+        webview->page()->runJavaScript(QString("window.scrollTo(%1, %2);").arg(tab.scroll.x()).arg(tab.scroll.y()));
+    }
+
+    void closeTab(int index) {
+        if (tabs.size() <= 1 || index < 0 || index >= tabs.size()) return;
+        if (index == currentTab) tabBar->setCurrentIndex(index + 1 < tabs.size() ? index + 1 : index - 1);
+        Tab tab = tabs.takeAt(index);
+        if (tab.page) tab.page->deleteLater();
+        if (currentTab > index) --currentTab;
+        QSignalBlocker blocker(tabBar);
+        tabBar->removeTab(index);
+    }
+
+    // Background tabs are frozen after tabs/freezeAfterSec (default 60) and
+    // discarded after tabs/discardAfterSec (default 600), oldest first as
+    // soon as more than tabs/maxLivePages (default 3) are alive, since every
+    // live page may hold a renderer process. Low-memory mode defaults to 10,
+    // 60 and 1. A frozen page keeps its memory
+    // but runs no script or timers; a discarded one gives it all back.
+    void applyTabLifecycle() {
+        QSettings settings;
+        const qint64 now = QDateTime::currentMSecsSinceEpoch();
+        const bool low = lowMemoryMode();
+        const qint64 freezeMs = qint64(settings.value("tabs/freezeAfterSec", low ? 10 : 60).toInt()) * 1000;
+        const qint64 discardMs = qint64(settings.value("tabs/discardAfterSec", low ? 60 : 600).toInt()) * 1000;
+        const int maxLive = qMax(0, settings.value("tabs/maxLivePages", low ? 1 : 3).toInt());
+
+        QVector<int> live;      // background tabs with a page, most recently hidden first
+        for (int i = 0; i < tabs.size(); ++i) {
+            if (i != currentTab && tabs.at(i).page && !isDiscarded(tabs.at(i).page)) live.append(i);
+        }
+        std::sort(live.begin(), live.end(), [this](int a, int b) { return tabs.at(a).hiddenMs > tabs.at(b).hiddenMs; });
+        for (int n = 0; n < live.size(); ++n) {
+            const Tab &tab = tabs.at(live.at(n));
+            const qint64 idle = now - tab.hiddenMs;
+            if (n >= maxLive || idle >= discardMs) discardTab(live.at(n));
+            else if (idle >= freezeMs && !tab.frozen) freezeTab(live.at(n));
         }
     }
 
-    QFileInfoList recursiveFindHtml(const QString &dirPath) {
-        QFileInfoList results;
-        QDir dir(dirPath);
-        for (const QFileInfo &fi : dir.entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot)) {
-            results += recursiveFindHtml(fi.absoluteFilePath());
+    static bool isDiscarded(QWebEnginePage *page) {
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+        return page->lifecycleState() == QWebEnginePage::LifecycleState::Discarded;
+#else
+        Q_UNUSED(page);
+        return false;
+#endif
+    }
+
+    void freezeTab(int index) {
+        Tab &tab = tabs[index];
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+        tab.page->setLifecycleState(QWebEnginePage::LifecycleState::Frozen);
+        PerfStats::count("tabs frozen");
+#endif
+        tab.frozen = true;     // before Qt 5.14 pages can't be frozen: left running
+    }
+
+    void discardTab(int index) {
+        Tab &tab = tabs[index];
+        PerfStats::count("tabs discarded");
+        tab.frozen = false;
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+        // the page (and its history) stays, without a renderer
+        tab.page->setLifecycleState(QWebEnginePage::LifecycleState::Discarded);
+#else
+        tab.page->deleteLater();
+        tab.page = nullptr;
+#endif
+    }
+
+    // Gives back what can be made again: the background tabs' renderers, the
+    // pre-rendered page, cached snippets, inflated archive pages and images,
+    // and the free heap the allocator holds on to. Done when the window is
+    // minimized (memory/releaseOnMinimize, on in low-memory mode) and when
+    // memory use goes over the budget.
+    void releaseMemory() {
+        ScopedTimer timer("release memory");
+        for (int i = 0; i < tabs.size(); ++i) {
+            if (i != currentTab && tabs.at(i).page && !isDiscarded(tabs.at(i).page)) discardTab(i);
         }
-        QStringList filters; filters << "*.html" << "*.htm";
-        results += dir.entryInfoList(filters, QDir::Files | QDir::NoSymLinks, QDir::Name);
-        return results;
+        if (prerendered) prerendered->deleteLater();
+        prerendered = nullptr;
+        results->releaseCaches();
+        BookArchive::releaseCaches();
+        QPixmapCache::clear();
+#ifdef __GLIBC__
+        // once the pages deleted above are gone
+        QTimer::singleShot(1000, this, []() { malloc_trim(0); });
+#endif
+    }
+
+    // With a budget (memory/budgetMB, default 768 in low-memory mode, none
+    // otherwise) the status bar shows what this process and the WebEngine
+    // processes it started use, measured every memory/reportSec (default 5)
+    // off the GUI thread. Going over the budget is logged and releases memory.
+    void startMemoryReport() {
+        QSettings settings;
+        budgetBytes = qint64(qMax(0, settings.value("memory/budgetMB", lowMemoryMode() ? 768 : 0).toInt())) << 20;
+        if (!budgetBytes) return;
+        memoryLabel = new QLabel(this);
+        statusBar()->addPermanentWidget(memoryLabel);
+        connect(&memoryWatcher, &QFutureWatcher<MemoryUse>::finished, this, &MiniBrowser::onMemoryMeasured);
+        QTimer *timer = new QTimer(this);
+        timer->setInterval(qMax(1, settings.value("memory/reportSec", 5).toInt()) * 1000);
+        connect(timer, &QTimer::timeout, this, [this]() {
+            if (!memoryWatcher.isRunning()) memoryWatcher.setFuture(QtConcurrent::run(currentMemoryUse));
+        });
+        timer->start();
+    }
+
+    // Other programs on the machine search the open book and the library
+    // through a JSON endpoint (searchserver.h) when server/port is set.
+    void startSearchServer() {
+        QSettings settings;
+        const int port = settings.value("server/port", 0).toInt();
+        if (port <= 0 || port > 65535) return;
+        searchServer = new SearchServer(this);
+        searchServer->sources = [this]() -> SearchSources {
+            SearchSources current;
+            current.siteDir = siteDir;
+            current.index = searchIndex;
+            current.library = library;
+            current.flags = searchFlags();
+            return current;
+        };
+        const QHostAddress address(settings.value("server/address", "127.0.0.1").toString());
+        if (searchServer->listen(address, quint16(port)))
+            qInfo().noquote() << "Search server listening on" << searchServer->address();
+        else
+            qWarning().noquote() << QString("Search server could not listen on port %1: %2").arg(port).arg(searchServer->errorString());
     }
 
-    void onResultActivated(QListWidgetItem *item) {
-        QString file = item->data(Qt::UserRole).toString();
-        if (!file.isEmpty()) loadLocal(file);
+    void onMemoryMeasured() {
+        const MemoryUse use = memoryWatcher.result();
+        if (use.processBytes < 0) return;       // not measurable here
+        const qint64 total = use.totalBytes();
+        memoryLabel->setText(QString("Memory %1 / %2 MB").arg(total >> 20).arg(budgetBytes >> 20));
+        memoryLabel->setToolTip(use.childBytes < 0 ? QString("Peak size of this process")
+                : QString("This process %1 MB, %2 WebEngine processes %3 MB")
+                  .arg(use.processBytes >> 20).arg(use.childProcesses).arg(use.childBytes >> 20));
+        const bool over = total > budgetBytes;
+        if (over && !overBudget) {
+            qWarning().noquote() << QString("Memory use %1 MB is over the budget of %2 MB").arg(total >> 20).arg(budgetBytes >> 20);
+            PerfStats::count("memory over budget");
+            releaseMemory();
+        }
+        overBudget = over;
     }
 
     void onPrint() {
-        // print to PDF then open
+        // print to PDF then open; the page renders it in the background
         QString tmp = QStandardPaths::writableLocation(QStandardPaths::TempLocation);
         QString pdfPath = QDir(tmp).filePath("mini_browser_print.pdf");
-//        webview->page()->printToPdf(pdfPath, [this,pdfPath](bool ok){
-//            if (ok) {
-//                statusBar()->showMessage(QString("Saved PDF: %1").arg(pdfPath));
-//                QDesktopServices::openUrl(QUrl::fromLocalFile(pdfPath));
-//            } else {
-//                QMessageBox::warning(this, "Print failed", "Failed to create PDF for printing.");
-//            }
-      //  });
+        statusBar()->showMessage("Printing...");
+        webview->page()->printToPdf([this, pdfPath](const QByteArray &pdf) {
+            QFile f(pdfPath);
+            if (!pdf.isEmpty() && f.open(QIODevice::WriteOnly) && f.write(pdf) == pdf.size()) {
+                f.close();
+                statusBar()->showMessage(QString("Saved PDF: %1").arg(pdfPath));
+                QDesktopServices::openUrl(QUrl::fromLocalFile(pdfPath));
+            } else {
+                QMessageBox::warning(this, "Print failed", "Failed to create PDF for printing.");
+            }
+        }, pdfPageLayout());
+    }
+
+    // Every page of the book into one PDF, home page first, then the others in
+    // manifest order; rendered offscreen while reading goes on (pdfexport.h).
+    void onExportBook() {
+        if (pdfExport) {
+            QMessageBox::information(this, "Export running", QString("Still exporting %1.").arg(pdfExport->fileName()));
+            return;
+        }
+        SiteManifest pages = manifest.isValid() ? manifest : SiteManifest::scan(siteDir);
+        QString home = homePage();
+        QList<QUrl> urls;
+        if (!home.isEmpty()) urls.append(pageUrl(home));
+        for (const SitePage &page : pages.pages()) {
+            if (QDir::cleanPath(page.path) != QDir::cleanPath(home)) urls.append(pageUrl(page.path));
+        }
+        if (urls.isEmpty()) {
+            QMessageBox::information(this, "Nothing to export", "The book has no pages.");
+            return;
+        }
+        QString suggested = QDir::cleanPath(siteDir);
+        if (BookArchive::isArchivePath(suggested)) suggested.chop(4);
+        QString out = QFileDialog::getSaveFileName(this, "Export Book as PDF", suggested + ".pdf", "PDF files (*.pdf)");
+        if (out.isEmpty()) return;
+
+        if (!exportProgress) {
+            exportProgress = new QProgressBar(this);
+            exportProgress->setMaximumWidth(200);
+            exportCancel = new QPushButton("Cancel Export", this);
+            statusBar()->addPermanentWidget(exportProgress);
+            statusBar()->addPermanentWidget(exportCancel);
+            connect(exportCancel, &QPushButton::clicked, this, [this]() {
+                if (!pdfExport) return;
+                pdfExport->cancel();
+                finishExport(QString("PDF export cancelled"));
+            });
+        }
+        exportProgress->setRange(0, urls.size());
+        exportProgress->setValue(0);
+        exportProgress->show();
+        exportCancel->show();
+
+        pdfExport = new PdfExporter(urls, out, bookScheme, this);
+        connect(pdfExport, &PdfExporter::progress, exportProgress, &QProgressBar::setValue);
+        connect(pdfExport, &PdfExporter::finished, this, [this, out](bool ok, int sheets, int skipped, const QString &error) {
+            if (!ok) {
+                QMessageBox::warning(this, "Export failed", QString("Could not export %1: %2").arg(out, error));
+                finishExport(QString("PDF export failed"));
+                return;
+            }
+            QString message = QString("Exported %1 PDF pages to %2").arg(sheets).arg(out);
+            if (skipped) message += QString(" (%1 book pages could not be rendered)").arg(skipped);
+            finishExport(message);
+        });
+        statusBar()->showMessage(QString("Exporting %1 pages to %2...").arg(urls.size()).arg(out));
+        pdfExport->start();
+    }
+
+    void finishExport(const QString &message) {
+        pdfExport->deleteLater();
+        pdfExport = nullptr;
+        exportProgress->hide();
+        exportCancel->hide();
+        statusBar()->showMessage(message);
+    }
+
+#ifdef QT_TEXTTOSPEECH_LIB
+    // Created on first use: loading a speech backend can take a while.
+    QTextToSpeech *speech() {
+        if (!tts) {
+            tts = new QTextToSpeech(this);
+            connect(tts, &QTextToSpeech::stateChanged, this, [this](QTextToSpeech::State state) {
+                if (state == QTextToSpeech::BackendError) stopReading();
+                if (state == QTextToSpeech::Speaking && reading.speaking) reading.started = true;
+                if (state != QTextToSpeech::Ready) return;
+                if (speakStartUs >= 0) {
+                    PerfStats::record("tts speaking", speakStartUs, PerfStats::nowUs() - speakStartUs);
+                    speakStartUs = -1;
+                }
+                // a Ready left over from stopping earlier speech doesn't count
+                if (reading.speaking && reading.started) {
+                    reading.speaking = reading.started = false;
+                    speakNextChunk();
+                }
+            });
+        }
+        return tts;
+    }
+
+    // Speak text, timing the utterance.
+    void speak(const QString &text) {
+        speakStartUs = PerfStats::nowUs();
+        speech()->say(text);
     }
 
+    bool speechAvailable() {
+        return speech()->state() != QTextToSpeech::BackendError;
+    }
+
+    // Fetch the next few chunks of the page being read, unless a fetch is
+    // already on its way or there are no more.
+    void fetchChunks() {
+        if (reading.fetching || reading.fetched >= reading.count) return;
+        reading.fetching = true;
+        int session = reading.session;
+        QString js = QString("window.__htmlbooksReader ? window.__htmlbooksReader.texts(%1, %2) : []")
+                .arg(reading.fetched).arg(ReadAloud::FetchChunks);
+        reading.page->runJavaScript(js, [this, session](const QVariant &v) {
+            if (session != reading.session) return;
+            reading.fetching = false;
+            QStringList texts = v.toStringList();
+            if (texts.isEmpty()) reading.count = reading.fetched;   // the page went away
+            reading.fetched += texts.size();
+            reading.queue += texts;
+            if (!reading.speaking) speakNextChunk();
+        });
+    }
+
+    // Speak the next queued chunk and select it in the page; called when the
+    // previous chunk has been spoken.
+    void speakNextChunk() {
+        if (!reading.page) return;
+        if (reading.page != webview->page()) {     // a pre-rendered page was swapped in
+            stopReading();
+            return;
+        }
+        while (!reading.queue.isEmpty() && reading.queue.first().isEmpty()) {
+            reading.queue.removeFirst();
+            ++reading.current;
+        }
+        if (reading.queue.isEmpty()) {
+            if (reading.fetched >= reading.count) stopReading();
+            else fetchChunks();
+            return;
+        }
+        if (reading.current < 0)
+            PerfStats::record("tts first chunk", reading.startUs, PerfStats::nowUs() - reading.startUs);
+        ++reading.current;
+        reading.speaking = true;
+        QString chunk = reading.queue.takeFirst();
+        speak(chunk);
+        if (reading.text.isEmpty())
+            reading.page->runJavaScript(QString("window.__htmlbooksReader && window.__htmlbooksReader.mark(%1);").arg(reading.current));
+        else
+            markCachedChunk(chunk);
+        if (reading.queue.size() < ReadAloud::FetchChunks / 2) fetchChunks();
+    }
+
+    // Select the start of chunk of reading.text in the page: as a folder search
+    // hit, the right occurrence of its first few words.
+    void markCachedChunk(const QString &chunk) {
+        QString needle = chunk.left(80);
+        if (needle.size() < chunk.size() && needle.lastIndexOf(' ') > 0) needle.truncate(needle.lastIndexOf(' '));
+        const int at = reading.starts.at(reading.current);
+        int nth = 0;
+        for (int p = reading.text.indexOf(needle, 0, Qt::CaseInsensitive); p >= 0 && p < at;
+             p = reading.text.indexOf(needle, p + 1, Qt::CaseInsensitive))
+            ++nth;
+        QJsonArray args;
+        args.append(needle);
+        args.append(nth);
+        QString js = QString::fromUtf8(highlightHitJs) + "(" + QString::fromUtf8(QJsonDocument(args).toJson(QJsonDocument::Compact)) + ");";
+        QWebEnginePage *page = reading.page;
+        page->runJavaScript(js, [this, page, needle](const QVariant &found) {
+            if (!found.toBool() && page == webview->page()) page->findText(needle);
+        });
+    }
+
+    void stopReading() {
+        QWebEnginePage *page = reading.page;
+        int session = reading.session;
+        reading = ReadAloud();
+        reading.session = session + 1;
+        if (!page) return;
+        if (tts && tts->state() == QTextToSpeech::Speaking) tts->stop();
+        if (page == webview->page()) page->runJavaScript("window.__htmlbooksReader && window.__htmlbooksReader.mark(-1);");
+    }
+#endif
+
     void onReadSelection() {
 #ifdef QT_TEXTTOSPEECH_LIB
-        if (!tts) { QMessageBox::information(this, "TTS not available", "Text-to-speech not available in this build."); return; }
+        if (!speechAvailable()) { QMessageBox::information(this, "TTS not available", "Text-to-speech not available in this build."); return; }
+        stopReading();
         webview->page()->runJavaScript("window.getSelection().toString();", [this](const QVariant &v){
             QString text = v.toString();
             if (text.isEmpty()) {
                 QMessageBox::information(this, "No selection", "Please select text in the page to read.");
                 return;
             }
-            tts->say(text);
+            speak(text);
         });
 #else
         QMessageBox::information(this, "TTS not available", "Text-to-speech support was not compiled in. Rebuild with Qt TextToSpeech module.");
@@ -358,12 +1929,43 @@ private slots:
 
     void onReadPage() {
 #ifdef QT_TEXTTOSPEECH_LIB
-        if (!tts) { QMessageBox::information(this, "TTS not available", "Text-to-speech not available in this build."); return; }
-        // grab innerText of body
-        webview->page()->runJavaScript("(function(){return document.body ? document.body.innerText : document.documentElement.innerText; })();", [this](const QVariant &v){
-            QString text = v.toString();
-            if (text.isEmpty()) { QMessageBox::information(this, "Nothing to read", "Page contains no readable text."); return; }
-            tts->say(text);
+        if (!speechAvailable()) { QMessageBox::information(this, "TTS not available", "Text-to-speech not available in this build."); return; }
+        // split the page into chunks in the page itself and start on the first
+        // one as soon as it arrives, instead of pulling the whole text over
+        stopReading();
+        if (tts->state() == QTextToSpeech::Speaking) tts->stop();
+        qint64 start = PerfStats::nowUs();
+        QWebEnginePage *page = webview->page();
+
+        // pages in the text cache are read from it without asking the renderer
+        QByteArray cached;
+        QString file = pagePath(page->url());
+        if (!file.isEmpty() && pageTexts && pageTexts->text(file, &cached)) {
+            reading.text = QString::fromUtf8(cached);
+            reading.queue = sentenceChunks(reading.text, &reading.starts);
+            if (reading.queue.isEmpty()) {
+                reading.text.clear();
+                reading.starts.clear();
+                QMessageBox::information(this, "Nothing to read", "Page contains no readable text.");
+                return;
+            }
+            reading.page = page;
+            reading.count = reading.fetched = reading.queue.size();
+            reading.startUs = start;
+            speakNextChunk();
+            return;
+        }
+
+        int session = reading.session;
+        page->runJavaScript(readAloudJs, [this, start, page, session](const QVariant &v){
+            PerfStats::record("tts page text", start, PerfStats::nowUs() - start);
+            if (session != reading.session || page != webview->page()) return;
+            int count = v.toInt();
+            if (count <= 0) { QMessageBox::information(this, "Nothing to read", "Page contains no readable text."); return; }
+            reading.page = page;
+            reading.count = count;
+            reading.startUs = start;
+            fetchChunks();
         });
 #else
         QMessageBox::information(this, "TTS not available", "Text-to-speech support was not compiled in. Rebuild with Qt TextToSpeech module.");
@@ -372,35 +1974,216 @@ private slots:
 
     void onUrlChanged(const QUrl &url) {
         statusBar()->showMessage(QString("URL: %1").arg(url.toString()));
+        recordPosition();
+    }
+
+    // Reading session (readingsession.h): where the shown page is, kept per
+    // book and saved in the background.
+    void recordPosition() {
+        if (!webEngineStarted || (currentTab >= 0 && tabs.at(currentTab).restoreScroll)) return;
+        const QUrl url = webview->url();
+        if (pagePath(url).isEmpty()) return;    // only the book's own pages
+        session->setPosition(siteDir, url, webview->page()->scrollPosition());
+    }
+
+    void recordHistory() {
+        if (pagePath(webview->url()).isEmpty()) return;
+        QByteArray history;
+        QDataStream out(&history, QIODevice::WriteOnly);
+        out << *webview->page()->history();
+        session->setHistory(siteDir, history);
+    }
+
+    // Open the book where it was left: its last page, with its back/forward
+    // history, scrolled to where it was. Nothing else is loaded first.
+    bool resumeReading() {
+        if (!QSettings().value("session/resume", true).toBool()) return false;
+        const ReadingSession::Entry e = session->entry(siteDir);
+        const QString path = pagePath(e.url);
+        if (path.isEmpty() || !pageExists(path)) return false;
+        if (currentTab >= 0) {
+            tabs[currentTab].scroll = e.scroll;
+            tabs[currentTab].restoreScroll = !e.scroll.isNull();
+        }
+        QWebEnginePage *page = webview->page();
+        if (!e.history.isEmpty()) {
+            QDataStream in(e.history);
+            in >> *page->history();     // navigates to the current entry, as Back would
+        }
+        if (e.history.isEmpty() || page->history()->currentItem().url() != e.url) page->load(e.url);
+        statusBar()->showMessage(QString("Resumed: %1").arg(path));
+        return true;
     }
 
 private:
     QSplitter *splitter;
     QWebEngineView *webview;
     QLineEdit *searchEdit;
-    QListWidget *resultsList;
+    QListView *resultsList;
+    ResultsModel *results;
     QComboBox *scopeCombo;
     QLabel *scopeLabel;
     QLineEdit *pathEdit;
     QString siteDir;
     QString indexPath;
+    QSharedPointer<BookArchive> archive;    // when siteDir is a .hbk file
+    BookSchemeHandler *bookScheme;
+    QWebEngineProfile *profile = nullptr;  // of the current book
+
+    // folder search hit to scroll to once its page has loaded
+    struct PendingHit {
+        QUrl url;
+        QString needle;
+        int occurrence = 0;
+    };
+    PendingHit pendingHit;
+    SiteManifest manifest;                     // invalid until scanned, or after a change
+    QSharedPointer<SearchIndex> searchIndex;   // null while (re)building
+    QSharedPointer<PageTextCache> pageTexts;   // extracted page texts, null if none
+    QFutureWatcher<BookSegment> indexWatcher;
+    QString refreshingDir;                     // the book indexWatcher's refresh is for
+    bool refreshPending = false;               // it changed again since that started
+
+    struct Tab {
+        int id = 0;
+        QWebEnginePage *page = nullptr;     // background tabs; null once discarded
+        QString siteDir;                    // the book it shows
+        QUrl url;
+        QString title;
+        QPointF scroll;                     // where it was left
+        bool restoreScroll = false;         // scroll there once loaded again
+        bool frozen = false;
+        qint64 hiddenMs = 0;                // when it went to the background
+    };
+    QVector<Tab> tabs;                         // in tab bar order
+    int currentTab = -1;
+    int lastTabId = 0;
+    QTabBar *tabBar;
+    QTimer *lifecycleTimer;
+    Library library;                           // books searched together
+    QFutureWatcher<BookSegment> libraryWatcher;
+    QDockWidget *libraryDock;
+    QListWidget *libraryList;
+    QFileSystemWatcher *siteWatcher;
+    QTimer *searchTimer;
+
+    // What the results on display answer, so that a query which only appends
+    // characters narrows them instead of searching all pages again.
+    QString shownQuery;
+    bool shownComplete = false;                 // finished, uncut and exact: narrowable
+    QSharedPointer<SearchIndex> shownIndex;     // null for scan results
+    QVector<quint32> shownFiles;                // sorted page ids in shownIndex
+    int searchSerial = 0;                       // bumped by every search
+    QThreadPool searchPool;                     // searches that read pages
+    QFutureWatcher<QVector<SearchHit> > indexSearchWatcher;
+    struct PendingSearch {
+        int serial = 0;                         // searchSerial when it started
+        QSharedPointer<SearchIndex> index;
+        QString term;
+        bool activate = false;
+    };
+    PendingSearch pendingSearch;
+    QFutureWatcher<QVector<LibraryHit> > librarySearchWatcher;
+    struct PendingLibrarySearch {
+        int serial = 0;
+        Library library;                        // as searched
+        QString term;
+    };
+    PendingLibrarySearch pendingLibrarySearch;
+    QTimer *siteChangeTimer;
+    FolderScan *folderScan;
+    Prefetcher *prefetcher;
+    ReadingSession *session;
+    QDockWidget *perfDock;
+    PdfExporter *pdfExport = nullptr;          // while a book export runs
+    QProgressBar *exportProgress = nullptr;
+    QPushButton *exportCancel = nullptr;
+    qint64 loadStartUs = -1;                   // PerfStats clock, while a page loads
+    qint64 speakStartUs = -1;
+    bool webEngineStarted = false;
+    bool startingUp = false;                   // until the home page has loaded
+    QWebEnginePage *prerendered = nullptr;     // hidden, holding the likely next page
+    QList<QWebEnginePage *> earlierPages;       // replaced by pre-rendered pages, for Back
+    SearchServer *searchServer = nullptr;       // with server/port set
+    QLabel *memoryLabel = nullptr;              // with a memory budget
+    QFutureWatcher<MemoryUse> memoryWatcher;
+    qint64 budgetBytes = 0;
+    bool overBudget = false;
 
 #ifdef QT_TEXTTOSPEECH_LIB
     QTextToSpeech *tts;
+
+    // Read Page progress: chunks of the page are fetched a few at a time and
+    // spoken one after the other (fetchChunks(), speakNextChunk()).
+    struct ReadAloud {
+        static const int FetchChunks = 8;
+        QWebEnginePage *page = nullptr;     // being read, null when idle
+        int session = 0;        // bumped by stopReading(), to drop stale callbacks
+        int count = 0;          // chunks in the page
+        int fetched = 0;
+        int current = -1;       // chunk being spoken
+        bool fetching = false;
+        bool speaking = false;  // a chunk has been handed to the voice
+        bool started = false;   // ...and the voice has started on it
+        qint64 startUs = 0;
+        QStringList queue;      // fetched, not yet spoken
+        QString text;           // the page's text when read from the text cache
+        QVector<int> starts;    // ...and where each chunk starts in it
+    };
+    ReadAloud reading;
 #else
     QObject *tts; // placeholder
 #endif
 };
 
+// Low-memory mode, from --low-memory or memory/lowMemory: besides what the
+// engine and the window do (memorybudget.h), Chromium is asked for at most
+// memory/rendererProcesses (default 1) renderer processes and its low-end
+// device mode. Chromium reads its flags when WebEngine starts, so this runs
+// before the QApplication.
+static void configureMemory(int argc, char *argv[]) {
+    QSettings settings;
+    bool low = settings.value("memory/lowMemory", false).toBool();
+    for (int i = 1; i < argc; ++i) {
+        if (!std::strcmp(argv[i], "--low-memory")) low = true;
+    }
+    setLowMemoryMode(low);
+    if (!low) return;
+    QByteArray flags = qgetenv("QTWEBENGINE_CHROMIUM_FLAGS");
+    flags += " --renderer-process-limit=" + QByteArray::number(qMax(1, settings.value("memory/rendererProcesses", 1).toInt()));
+    flags += " --enable-low-end-device-mode";
+    qputenv("QTWEBENGINE_CHROMIUM_FLAGS", flags.trimmed());
+}
+
 int main(int argc, char *argv[]) {
+    if (isBatchCommand(argc, argv)) {
+        QCoreApplication app(argc, argv);
+        app.setOrganizationName("HTMLBooks");
+        app.setApplicationName("HTMLBooks");
+        return runBatchCommand(app.arguments());
+    }
+
+    startupClock().start();
+    BookSchemeHandler::registerScheme();    // must precede the QApplication
+    QCoreApplication::setOrganizationName("HTMLBooks");     // for the settings read before it
+    QCoreApplication::setApplicationName("HTMLBooks");
+    configureMemory(argc, argv);
     QApplication app(argc, argv);
+    app.setOrganizationName("HTMLBooks");
+    app.setApplicationName("HTMLBooks");
+    startupPhase("qapplication");
+    QString traceFile = QSettings().value("perf/traceFile").toString();
+    if (!traceFile.isEmpty() && !PerfStats::startTrace(traceFile))
+        qDebug() << "Could not write trace" << traceFile;
 
     // Required for Qt WebEngine
    // QtWebEngine::initialize();
 
     MiniBrowser w;
     w.show();
-    return app.exec();
+    int status = app.exec();
+    PerfStats::stopTrace();
+    return status;
 }
 
 #include "main.moc"
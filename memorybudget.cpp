@@ -0,0 +1,89 @@
+#include "memorybudget.h"
+#include "perfstats.h"
+
+#include <QAtomicInt>
+#include <QDir>
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <QVector>
+
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+static QAtomicInt lowMemory(0);
+
+bool lowMemoryMode() {
+    return lowMemory.load() != 0;
+}
+
+void setLowMemoryMode(bool on) {
+    lowMemory.store(on ? 1 : 0);
+}
+
+#ifdef Q_OS_LINUX
+// What a process uses: its PSS if the kernel reports it (4.14 or later), else its RSS.
+static qint64 processMemory(const QString &pid) {
+    QFile rollup(QString("/proc/%1/smaps_rollup").arg(pid));
+    if (rollup.open(QIODevice::ReadOnly)) {
+        for (QByteArray line = rollup.readLine(); !line.isEmpty(); line = rollup.readLine()) {
+            if (line.startsWith("Pss:")) return line.mid(4).simplified().split(' ').first().toLongLong() * 1024;
+        }
+    }
+    QFile statm(QString("/proc/%1/statm").arg(pid));
+    if (!statm.open(QIODevice::ReadOnly)) return -1;
+    const QList<QByteArray> fields = statm.readAll().split(' ');
+    if (fields.size() < 2) return -1;
+    return fields.at(1).toLongLong() * sysconf(_SC_PAGESIZE);
+}
+
+// The parent of a process, from /proc/<pid>/stat, whose second field (the
+// command name in parentheses) may hold spaces of its own.
+static qint64 parentOf(const QString &pid) {
+    QFile stat(QString("/proc/%1/stat").arg(pid));
+    if (!stat.open(QIODevice::ReadOnly)) return -1;
+    const QByteArray line = stat.readAll();
+    const int name = line.lastIndexOf(')');
+    if (name < 0) return -1;
+    const QList<QByteArray> fields = line.mid(name + 2).split(' ');     // state, ppid, ...
+    return fields.size() > 1 ? fields.at(1).toLongLong() : -1;
+}
+#endif
+
+MemoryUse currentMemoryUse() {
+    ScopedTimer timer("memory use");
+    MemoryUse use;
+#if defined(Q_OS_LINUX)
+    use.processBytes = processMemory("self");
+    // every process below this one: WebEngine's zygote forks the renderers
+    QHash<qint64, QVector<qint64> > children;
+    for (const QString &entry : QDir("/proc").entryList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+        bool ok = false;
+        const qint64 pid = entry.toLongLong(&ok);
+        if (ok) children[parentOf(entry)].append(pid);
+    }
+    QVector<qint64> pending = children.value(qint64(getpid()));
+    use.childBytes = 0;
+    while (!pending.isEmpty()) {
+        const qint64 pid = pending.takeLast();
+        const qint64 bytes = processMemory(QString::number(pid));
+        if (bytes > 0) {
+            use.childBytes += bytes;
+            ++use.childProcesses;
+        }
+        pending += children.value(pid);
+    }
+#elif defined(Q_OS_UNIX)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef Q_OS_MACOS
+        use.processBytes = qint64(usage.ru_maxrss);            // bytes
+#else
+        use.processBytes = qint64(usage.ru_maxrss) * 1024;     // kilobytes
+#endif
+    }
+#endif
+    return use;
+}
@@ -0,0 +1,37 @@
+#ifndef MEMORYBUDGET_H
+#define MEMORYBUDGET_H
+
+/*
+Low-memory mode, for reading terminals with 1-2 GB of RAM, and the memory
+the application is actually using, to check it against a budget.
+
+The mode is one switch for the whole process, set by the viewer at start-up
+(memory/lowMemory in the settings, or --low-memory). The viewer then limits
+the WebEngine renderer processes, live pages and caches, and releases what
+it can when the window is minimized. The engine reads and searches pages on
+a single thread, so one page's text is in memory at a time, and packed
+books keep a smaller cache of decompressed pages.
+
+currentMemoryUse() measures this process and every process it started, which
+includes the WebEngine renderers and GPU process. On Linux it uses the
+proportional set size (PSS) from /proc/<pid>/smaps_rollup, which splits shared
+pages between the processes that map them, and falls back to the resident
+set size. Elsewhere only this process's peak resident size is known.
+*/
+
+#include <QtGlobal>
+
+bool lowMemoryMode();
+void setLowMemoryMode(bool on);
+
+struct MemoryUse {
+    qint64 processBytes = -1;   // this process, -1 if unknown
+    qint64 childBytes = -1;     // its child processes, -1 if unknown
+    int childProcesses = 0;
+
+    qint64 totalBytes() const { return qMax(qint64(0), processBytes) + qMax(qint64(0), childBytes); }
+};
+
+MemoryUse currentMemoryUse();
+
+#endif // MEMORYBUDGET_H
@@ -0,0 +1,177 @@
+#include "pagetextcache.h"
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QtEndian>
+#include <algorithm>
+#include <climits>
+
+static const quint32 CacheMagic = 0x48425458;   // "HBTX"
+static const quint32 CacheVersion = 1;
+static const int HeaderSize = 16;   // magic, version, directory offset
+
+QString PageTextCache::cacheFilePath(const QString &siteDir) {
+    return QDir(siteDir).filePath(".htmlbooks/text");
+}
+
+// The generation numbers of siteDir's cache files, newest first.
+static QVector<quint64> generations(const QString &siteDir) {
+    const QFileInfo base(PageTextCache::cacheFilePath(siteDir));
+    const QString prefix = base.fileName() + '.';
+    QVector<quint64> found;
+    for (const QString &name : base.dir().entryList(QStringList(prefix + '*'), QDir::Files)) {
+        bool ok = false;
+        quint64 generation = name.mid(prefix.size()).toULongLong(&ok);
+        if (ok) found.append(generation);
+    }
+    std::sort(found.begin(), found.end(), [](quint64 x, quint64 y) { return x > y; });
+    return found;
+}
+
+static QString generationPath(const QString &siteDir, quint64 generation) {
+    return PageTextCache::cacheFilePath(siteDir) + '.' + QString::number(generation);
+}
+
+PageTextCache::~PageTextCache() {
+    if (base) file.unmap(const_cast<uchar *>(base));
+}
+
+QSharedPointer<PageTextCache> PageTextCache::open(const QString &siteDir) {
+    // the newest generation that can be read
+    for (quint64 generation : generations(siteDir)) {
+        QSharedPointer<PageTextCache> cache(new PageTextCache);
+        cache->dir = siteDir;
+        if (cache->map(generationPath(siteDir, generation))) return cache;
+    }
+    return QSharedPointer<PageTextCache>();
+}
+
+bool PageTextCache::map(const QString &fileName) {
+    file.setFileName(fileName);
+    if (!file.open(QIODevice::ReadOnly) || file.size() < HeaderSize) return false;
+    base = file.map(0, file.size());
+    if (!base) return false;
+    const qint64 size = file.size();
+    if (qFromBigEndian<quint32>(base) != CacheMagic || qFromBigEndian<quint32>(base + 4) != CacheVersion)
+        return false;
+
+    const quint64 directory = qFromBigEndian<quint64>(base + 8);
+    if (directory < quint64(HeaderSize) || directory > quint64(size) || quint64(size) - directory > quint64(INT_MAX))
+        return false;
+    QByteArray bytes = QByteArray::fromRawData(reinterpret_cast<const char *>(base + directory),
+                                               int(quint64(size) - directory));
+    QDataStream in(bytes);
+    in.setVersion(QDataStream::Qt_5_6);
+    quint32 count = 0;
+    in >> count;
+    entries.reserve(int(qMin(count, quint32(1 << 20))));
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        QString path;
+        Entry e;
+        in >> path >> e.size >> e.mtime >> e.offset >> e.length;
+        // texts must lie between the header and the directory
+        if (e.offset < quint64(HeaderSize) || e.offset > directory || e.length > directory - e.offset)
+            return false;
+        entries.insert(path, e);
+    }
+    return in.status() == QDataStream::Ok;
+}
+
+const PageTextCache::Entry *PageTextCache::find(const QString &path) const {
+    QString rel = QDir(dir).relativeFilePath(path);
+    auto it = entries.constFind(rel);
+    return it == entries.constEnd() ? nullptr : &it.value();
+}
+
+bool PageTextCache::text(const SitePage &page, QByteArray *text) const {
+    const Entry *e = find(page.path);
+    if (!e || e->size != page.size || e->mtime != page.mtime) return false;
+    *text = QByteArray::fromRawData(reinterpret_cast<const char *>(base + e->offset), int(e->length));
+    return true;
+}
+
+bool PageTextCache::text(const QString &path, QByteArray *text) const {
+    if (!find(path)) return false;      // don't stat pages that aren't cached
+    QFileInfo fi(path);
+    SitePage page;
+    page.path = path;
+    page.size = fi.size();
+    page.mtime = fi.lastModified().toMSecsSinceEpoch();
+    return this->text(page, text);
+}
+
+PageTextCache::Builder::Builder(const QString &siteDir)
+    : dir(siteDir), previous(PageTextCache::open(siteDir)) {}
+
+PageTextCache::Builder::~Builder() {}     // an unsaved file is discarded
+
+bool PageTextCache::Builder::keep(const QString &path, const SitePage &page) {
+    if (!previous) return false;
+    auto it = previous->entries.constFind(path);
+    if (it == previous->entries.constEnd()) return false;
+    const Entry &e = it.value();
+    if (e.size != page.size || e.mtime != page.mtime) return false;
+    Page p = { path, e.size, e.mtime, e.offset, e.length };
+    kept.append(p);
+    return true;
+}
+
+bool PageTextCache::Builder::openFile() {
+    if (!QDir().mkpath(QFileInfo(cacheFilePath(dir)).absolutePath())) return false;
+    const QVector<quint64> existing = generations(dir);
+    generation = existing.isEmpty() ? 1 : existing.first() + 1;
+    file.reset(new QSaveFile(generationPath(dir, generation)));
+    if (!file->open(QIODevice::WriteOnly)) return false;
+    return file->write(QByteArray(HeaderSize, '\0')) == HeaderSize;  // filled in by save()
+}
+
+void PageTextCache::Builder::add(const QString &path, const SitePage &page, const QByteArray &text) {
+    if (failed) return;
+    if (!file && !openFile()) {
+        failed = true;
+        return;
+    }
+    Page p = { path, page.size, page.mtime, quint64(file->pos()), quint32(text.size()) };
+    if (file->write(text) != text.size()) {
+        failed = true;
+        return;
+    }
+    added.append(p);
+}
+
+bool PageTextCache::Builder::save() {
+    if (failed || (!file && !openFile())) return false;
+    for (Page &p : kept) {
+        const char *bytes = reinterpret_cast<const char *>(previous->base + p.offset);
+        p.offset = quint64(file->pos());
+        if (file->write(bytes, p.length) != qint64(p.length)) return false;
+    }
+    previous.reset();   // nothing more is read from it
+
+    const quint64 directory = quint64(file->pos());
+    QDataStream out(file.data());
+    out.setVersion(QDataStream::Qt_5_6);
+    out << quint32(added.size() + kept.size());
+    for (const QVector<Page> *list : {&added, &kept}) {
+        for (const Page &p : *list) out << p.path << p.size << p.mtime << p.offset << p.length;
+    }
+
+    uchar header[HeaderSize];
+    qToBigEndian(CacheMagic, header);
+    qToBigEndian(CacheVersion, header + 4);
+    qToBigEndian(directory, header + 8);
+    if (out.status() != QDataStream::Ok || !file->seek(0)
+            || file->write(reinterpret_cast<const char *>(header), HeaderSize) != HeaderSize)
+        return false;
+    if (!file->commit()) return false;
+
+    // Readers that still map an older generation keep using it until they
+    // open the new one; on Windows those files can't be removed until then,
+    // and the next save tries again.
+    for (quint64 older : generations(dir)) {
+        if (older < generation) QFile::remove(generationPath(dir, older));
+    }
+    return true;
+}
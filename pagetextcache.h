@@ -0,0 +1,113 @@
+#ifndef PAGETEXTCACHE_H
+#define PAGETEXTCACHE_H
+
+/*
+The extracted text of every page of a site folder, kept beside the search
+index in <siteDir>/.htmlbooks/text.N so the page HTML is decoded only once.
+
+The indexer writes the cache as a by-product (SearchIndex::update() with a
+Builder): a 16-byte header, the pages' UTF-8 text (as htmltext.h produces it)
+back to back, and a directory of relative path, size + mtime fingerprint,
+offset and length at the end, the same layout as a book archive. Opening it
+maps the file once; a page's text is then a slice of the mapping, handed out
+only while the page's size and mtime still match, so an edited page is simply
+read from its HTML again until the next index update. The folder scan
+searches the cached text and Read Page speaks it without asking the renderer
+for innerText.
+
+Every save writes a new generation (text.1, text.2, ...) instead of
+replacing the file: the window, the library and running searches keep the
+old one mapped until they pick up the new index, and Windows can't rename
+over a mapped file. open() maps the newest; save() removes the older ones it
+can.
+
+Packed books (bookarchive.h) have no text cache: their pages are slices of a
+mapping already and carry trigram signatures for the scan.
+*/
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QSaveFile>
+#include <QScopedPointer>
+#include <QSharedPointer>
+#include <QString>
+#include <QVector>
+
+#include "sitemanifest.h"
+
+class PageTextCache {
+public:
+    ~PageTextCache();
+
+    // The name the cache's generations are numbered after.
+    static QString cacheFilePath(const QString &siteDir);
+
+    // The cache of siteDir, or null if there is none or it can't be read.
+    static QSharedPointer<PageTextCache> open(const QString &siteDir);
+
+    QString siteDir() const { return dir; }
+    int pageCount() const { return entries.size(); }
+
+    // Point *text at the cached text of page (an absolute path below siteDir)
+    // if its size and mtime are the ones cached. The bytes belong to the
+    // mapping: keep this cache alive while using them.
+    bool text(const SitePage &page, QByteArray *text) const;
+    // The same for a page known only by path; costs one stat().
+    bool text(const QString &path, QByteArray *text) const;
+
+    // Writes a new cache for siteDir: pages whose text the previous cache holds
+    // are kept with keep(), newly extracted ones added with add(); save()
+    // copies the kept texts and writes them as the next generation. Used
+    // from a single thread.
+    class Builder {
+    public:
+        explicit Builder(const QString &siteDir);
+        ~Builder();
+
+        // Carry page (path relative to siteDir) over from the previous cache;
+        // false if that has no text for it at this size and mtime.
+        bool keep(const QString &path, const SitePage &page);
+        void add(const QString &path, const SitePage &page, const QByteArray &text);
+        bool save();
+
+    private:
+        Q_DISABLE_COPY(Builder)
+        struct Page {
+            QString path;
+            qint64 size;
+            qint64 mtime;
+            quint64 offset;     // in the new file, or in previous for kept pages
+            quint32 length;
+        };
+        bool openFile();
+
+        QString dir;
+        QSharedPointer<PageTextCache> previous;
+        QScopedPointer<QSaveFile> file;     // opened on the first add()
+        quint64 generation = 0;             // the file's
+        QVector<Page> added;
+        QVector<Page> kept;     // copied from previous by save()
+        bool failed = false;
+    };
+
+private:
+    struct Entry {
+        qint64 size = 0;
+        qint64 mtime = 0;
+        quint64 offset = 0;
+        quint32 length = 0;
+    };
+
+    PageTextCache() {}
+    Q_DISABLE_COPY(PageTextCache)
+    bool map(const QString &fileName);
+    const Entry *find(const QString &path) const;
+
+    QString dir;
+    QFile file;
+    const uchar *base = nullptr;
+    QHash<QString, Entry> entries;   // by path relative to dir
+};
+
+#endif // PAGETEXTCACHE_H
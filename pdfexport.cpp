@@ -0,0 +1,119 @@
+#include "pdfexport.h"
+#include "perfstats.h"
+
+#include <QSettings>
+#include <QtWebEngineWidgets/QWebEnginePage>
+#include <QtWebEngineWidgets/QWebEngineProfile>
+#include <QWebEngineUrlSchemeHandler>
+
+QPageLayout pdfPageLayout() {
+    QSettings settings;
+    QPageSize size(settings.value("pdf/pageSize", "A4").toString().compare("Letter", Qt::CaseInsensitive) == 0
+                   ? QPageSize::Letter : QPageSize::A4);
+    qreal margin = qBound(0.0, settings.value("pdf/marginMM", 15).toReal(), 50.0);
+    return QPageLayout(size, QPageLayout::Portrait, QMarginsF(margin, margin, margin, margin), QPageLayout::Millimeter);
+}
+
+PdfExporter::PdfExporter(const QList<QUrl> &pages, const QString &fileName,
+                         QWebEngineUrlSchemeHandler *scheme, QObject *parent)
+    : QObject(parent), urls(pages), file(fileName), scheme(scheme), layout(pdfPageLayout()) {}
+
+PdfExporter::~PdfExporter() {
+    release(true);
+}
+
+void PdfExporter::start() {
+    QString error;
+    if (urls.isEmpty()) error = "The book has no pages.";
+    else if (!merger.open(file, &error)) error = QString("Could not write %1: %2").arg(file, error);
+    if (!error.isEmpty()) {
+        emit finished(false, 0, 0, error);
+        return;
+    }
+    running = true;
+    PerfStats::count("pdf exports");
+
+    profile = new QWebEngineProfile(this);      // off the record
+    profile->setHttpCacheType(QWebEngineProfile::MemoryHttpCache);
+    if (scheme) profile->installUrlSchemeHandler("book", scheme);
+    const int size = qBound(1, QSettings().value("pdf/parallelPages", 3).toInt(), 8);
+    for (int i = 0; i < qMin(size, urls.size()); ++i) {
+        Worker *worker = new Worker;
+        worker->page = new QWebEnginePage(profile, this);
+        connect(worker->page, &QWebEnginePage::loadFinished, this, [this, worker](bool ok) { loaded(worker, ok); });
+        workers.append(worker);
+    }
+    for (Worker *worker : workers) assign(worker);
+}
+
+void PdfExporter::cancel() {
+    running = false;
+    release(false);
+}
+
+// Pages have to go before their profile. They are deleted later unless now,
+// since this may run in one of their own callbacks.
+void PdfExporter::release(bool now) {
+    for (Worker *worker : workers) {
+        if (now) delete worker->page;
+        else worker->page->deleteLater();
+        delete worker;
+    }
+    workers.clear();
+    if (profile) {
+        if (now) delete profile;
+        else profile->deleteLater();
+    }
+    profile = nullptr;
+    ready.clear();
+}
+
+void PdfExporter::assign(Worker *worker) {
+    // stay a few pages ahead of the writer, no more, so an early slow page
+    // doesn't let rendered pages pile up in memory
+    if (!running || nextIndex >= urls.size() || nextIndex >= written + 2 * workers.size()) return;
+    worker->index = nextIndex++;
+    worker->loading = true;
+    worker->page->load(urls.at(worker->index));
+}
+
+void PdfExporter::loaded(Worker *worker, bool ok) {
+    if (!running || !worker->loading) return;
+    worker->loading = false;
+    const int index = worker->index;
+    if (!ok) {
+        worker->index = -1;
+        rendered(index, QByteArray());
+        return;
+    }
+    qint64 start = PerfStats::nowUs();
+    worker->page->printToPdf([this, worker, index, start](const QByteArray &pdf) {
+        if (!running || worker->index != index) return;
+        PerfStats::record("pdf page", start, PerfStats::nowUs() - start);
+        worker->index = -1;
+        rendered(index, pdf);
+    }, layout);
+}
+
+void PdfExporter::rendered(int index, const QByteArray &pdf) {
+    ready.insert(index, pdf);
+    while (ready.contains(written)) {
+        QByteArray page = ready.take(written);
+        if (page.isEmpty() || !merger.append(page)) ++skipped;
+        ++written;
+    }
+    emit progress(written, urls.size());
+
+    if (written < urls.size()) {
+        for (Worker *worker : workers) {
+            if (worker->index < 0) assign(worker);
+        }
+        return;
+    }
+    running = false;
+    release(false);
+    QString error;
+    bool ok = merger.pageCount() > 0 && merger.finish(&error);
+    if (merger.pageCount() == 0) error = "No page could be rendered.";
+    emit finished(ok, merger.pageCount(), skipped, error);
+}
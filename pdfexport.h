@@ -0,0 +1,81 @@
+#ifndef PDFEXPORT_H
+#define PDFEXPORT_H
+
+/*
+Whole-book PDF export in the background.
+
+PdfExporter renders a list of pages through a small pool of offscreen
+QWebEnginePages (pdf/parallelPages in the settings, default 3) with
+printToPdf(), and appends each page's PDF to the output file in book order
+as soon as it and the pages before it are done (pdfmerge.h). At most a few
+pages ahead of the next one to be written are loaded at any time, so memory
+stays flat however long the book is, and the reading window is never blocked.
+The pool has an off-the-record profile of its own, so exports survive
+switching books; book:// pages are served by the viewer's scheme handler.
+
+Pages that fail to load or print are skipped and counted. The file is only
+replaced when the export completes; cancelling leaves it untouched.
+*/
+
+#include <QList>
+#include <QMap>
+#include <QObject>
+#include <QPageLayout>
+#include <QUrl>
+#include <QVector>
+
+#include "pdfmerge.h"
+
+class QWebEnginePage;
+class QWebEngineProfile;
+class QWebEngineUrlSchemeHandler;
+
+// Page size and margins for printed pages: pdf/pageSize ("A4" or "Letter")
+// and pdf/marginMM in the settings.
+QPageLayout pdfPageLayout();
+
+class PdfExporter : public QObject {
+    Q_OBJECT
+public:
+    // pages in the order they are to appear; scheme (optional) serves book:// URLs
+    PdfExporter(const QList<QUrl> &pages, const QString &fileName,
+                QWebEngineUrlSchemeHandler *scheme, QObject *parent = nullptr);
+    ~PdfExporter();
+
+    void start();
+    void cancel();
+    bool isRunning() const { return running; }
+    QString fileName() const { return file; }
+
+signals:
+    void progress(int done, int total);
+    // pageCount pages were written, skipped pages failed; not emitted once cancelled
+    void finished(bool ok, int pageCount, int skipped, const QString &error);
+
+private:
+    struct Worker {
+        QWebEnginePage *page = nullptr;
+        int index = -1;         // the book page it is rendering, -1 when idle
+        bool loading = false;
+    };
+
+    void assign(Worker *worker);
+    void loaded(Worker *worker, bool ok);
+    void rendered(int index, const QByteArray &pdf);
+    void release(bool now);
+
+    QList<QUrl> urls;
+    QString file;
+    QWebEngineUrlSchemeHandler *scheme;
+    QWebEngineProfile *profile = nullptr;
+    QVector<Worker *> workers;
+    QPageLayout layout;
+    PdfMerger merger;
+    QMap<int, QByteArray> ready;    // rendered, waiting for the pages before them
+    int nextIndex = 0;              // next page to render
+    int written = 0;                // pages appended (or skipped) so far
+    int skipped = 0;
+    bool running = false;
+};
+
+#endif // PDFEXPORT_H
@@ -0,0 +1,341 @@
+#include "pdfmerge.h"
+
+#include <QHash>
+#include <cstring>
+
+static const int CatalogObject = 1;
+static const int PagesObject = 2;
+
+static bool fail(QString *error, const QString &message) {
+    if (error) *error = message;
+    return false;
+}
+
+namespace {
+
+// Just enough of the PDF syntax to step over values and look keys up in
+// dictionaries. Positions are byte offsets; -1 means malformed.
+struct PdfSyntax {
+    const char *d;
+    int n;
+
+    static bool isSpace(char c) {
+        return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\f' || c == '\0';
+    }
+    static bool isDelimiter(char c) {
+        return c && std::strchr("()<>[]{}/%", c);
+    }
+    static bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+    int skipSpace(int i) const {
+        while (i < n) {
+            if (isSpace(d[i])) {
+                ++i;
+            } else if (d[i] == '%') {
+                while (i < n && d[i] != '\n' && d[i] != '\r') ++i;
+            } else {
+                break;
+            }
+        }
+        return i;
+    }
+
+    int tokenEnd(int i) const {
+        while (i < n && !isSpace(d[i]) && !isDelimiter(d[i])) ++i;
+        return i;
+    }
+
+    // Whether the token at i is word.
+    bool isKeyword(int i, const char *word) const {
+        int len = int(std::strlen(word));
+        return i >= 0 && i + len <= n && !std::memcmp(d + i, word, size_t(len)) && tokenEnd(i) == i + len;
+    }
+
+    bool readInt(int i, qint64 *value) const {
+        if (i < 0 || i >= n || !isDigit(d[i])) return false;
+        qint64 v = 0;
+        int end = tokenEnd(i);
+        for (int k = i; k < end; ++k) {
+            if (!isDigit(d[k]) || v > (qint64(1) << 40)) return false;
+            v = v * 10 + (d[k] - '0');
+        }
+        *value = v;
+        return true;
+    }
+
+    // The end of "N G R" at i, or -1 if there's no reference there.
+    int referenceEnd(int i) const {
+        if (i >= n || !isDigit(d[i])) return -1;
+        int a = tokenEnd(i);
+        int j = skipSpace(a);
+        if (j >= n || !isDigit(d[j])) return -1;
+        int b = tokenEnd(j);
+        int k = skipSpace(b);
+        return isKeyword(k, "R") ? k + 1 : -1;
+    }
+
+    // The end of the value at i (after any whitespace), or -1.
+    int skipValue(int i, int depth = 0) const {
+        i = skipSpace(i);
+        if (i >= n || depth > 64) return -1;
+        const char c = d[i];
+        if (c == '<' && i + 1 < n && d[i + 1] == '<') {
+            for (i += 2; ; ) {
+                i = skipSpace(i);
+                if (i + 1 < n && d[i] == '>' && d[i + 1] == '>') return i + 2;
+                i = skipValue(i, depth + 1);
+                if (i < 0) return -1;
+            }
+        }
+        if (c == '[') {
+            for (++i; ; ) {
+                i = skipSpace(i);
+                if (i < n && d[i] == ']') return i + 1;
+                i = skipValue(i, depth + 1);
+                if (i < 0) return -1;
+            }
+        }
+        if (c == '<') {
+            const char *end = static_cast<const char *>(std::memchr(d + i, '>', size_t(n - i)));
+            return end ? int(end - d) + 1 : -1;
+        }
+        if (c == '(') {
+            int nesting = 0;
+            for (; i < n; ++i) {
+                if (d[i] == '\\') ++i;
+                else if (d[i] == '(') ++nesting;
+                else if (d[i] == ')' && --nesting == 0) return i + 1;
+            }
+            return -1;
+        }
+        if (c == '/') return tokenEnd(i + 1);
+        if (c == ')' || c == '>' || c == ']' || c == '{' || c == '}') return -1;
+        int ref = referenceEnd(i);
+        return ref >= 0 ? ref : tokenEnd(i);
+    }
+
+    // Where the value of key (e.g. "/Pages") starts in the dictionary at i, or -1.
+    int lookup(int i, const char *key) const {
+        i = skipSpace(i);
+        if (i + 1 >= n || d[i] != '<' || d[i + 1] != '<') return -1;
+        const int keyLength = int(std::strlen(key));
+        for (i += 2; ; ) {
+            i = skipSpace(i);
+            if (i >= n || d[i] != '/') return -1;     // ">>" or malformed
+            int keyEnd = tokenEnd(i + 1);
+            int value = skipSpace(keyEnd);
+            if (keyEnd - i == keyLength && !std::memcmp(d + i, key, size_t(keyLength))) return value;
+            i = skipValue(value);
+            if (i < 0) return -1;
+        }
+    }
+
+    int referenceAt(int i) const {
+        qint64 number;
+        return referenceEnd(i) >= 0 && readInt(i, &number) ? int(number) : -1;
+    }
+
+    // Copy d[from, to) with every reference "N G R" renumbered to N + base.
+    // Strings are copied as they are.
+    QByteArray renumbered(int from, int to, int base) const {
+        QByteArray out;
+        out.reserve(to - from + 16);
+        int i = from;
+        while (i < to) {
+            const char c = d[i];
+            if (c == '(' || (c == '<' && !(i + 1 < to && d[i + 1] == '<'))) {
+                int end = qMin(skipValue(i), to);
+                if (end <= i) end = i + 1;
+                out.append(d + i, end - i);
+                i = end;
+            } else if (isDigit(c) && (i == from || isSpace(d[i - 1]) || (isDelimiter(d[i - 1]) && d[i - 1] != '/'))) {
+                int end = tokenEnd(i);
+                int ref = referenceEnd(i);
+                qint64 number;
+                if (ref >= 0 && ref <= to && readInt(i, &number)) {
+                    out += QByteArray::number(number + base) + " 0 R";
+                    i = ref;
+                } else {
+                    out.append(d + i, end - i);
+                    i = end;
+                }
+            } else {
+                out += c;
+                ++i;
+            }
+        }
+        return out;
+    }
+};
+
+struct SourceObject {
+    int number;
+    int head;       // after "N G obj"
+    int headEnd;    // the dictionary or value (before "stream")
+    int data = -1;  // stream bytes, if any
+    int dataLength = 0;
+};
+
+} // namespace
+
+bool PdfMerger::open(const QString &fileName, QString *error) {
+    out.setFileName(fileName);
+    if (!out.open(QIODevice::WriteOnly)) return fail(error, out.errorString());
+    offsets.fill(-1, PagesObject + 1);
+    roots.clear();
+    pages = 0;
+    failed = false;
+    // the binary comment marks the file as binary for transfer programs
+    if (out.write("%PDF-1.4\n%\xE2\xE3\xCF\xD3\n") < 0) return fail(error, out.errorString());
+    return true;
+}
+
+bool PdfMerger::writeObject(int number, const QByteArray &bytes) {
+    while (offsets.size() <= number) offsets.append(-1);
+    offsets[number] = out.pos();
+    QByteArray object = QByteArray::number(number) + " 0 obj\n" + bytes + "\nendobj\n";
+    if (out.write(object) != object.size()) failed = true;
+    return !failed;
+}
+
+bool PdfMerger::append(const QByteArray &pdf, QString *error) {
+    if (failed || !out.isOpen()) return fail(error, "not open");
+    const PdfSyntax s = { pdf.constData(), pdf.size() };
+
+    // cross-reference table and trailer
+    int startxref = pdf.lastIndexOf("startxref");
+    qint64 xref = 0;
+    if (startxref < 0 || !s.readInt(s.skipSpace(startxref + 9), &xref) || xref >= pdf.size())
+        return fail(error, "no cross-reference table");
+    int i = s.skipSpace(int(xref));
+    if (!s.isKeyword(i, "xref")) return fail(error, "cross-reference streams are not supported");
+    QHash<int, qint64> objectOffsets;
+    i = s.skipSpace(i + 4);
+    while (i < s.n && PdfSyntax::isDigit(s.d[i])) {
+        qint64 first, count;
+        if (!s.readInt(i, &first)) return fail(error, "bad cross-reference table");
+        i = s.skipSpace(s.tokenEnd(i));
+        if (!s.readInt(i, &count) || count > (1 << 24)) return fail(error, "bad cross-reference table");
+        i = s.skipSpace(s.tokenEnd(i));
+        for (qint64 k = 0; k < count; ++k) {
+            qint64 offset, generation;
+            if (!s.readInt(i, &offset)) return fail(error, "bad cross-reference entry");
+            i = s.skipSpace(s.tokenEnd(i));
+            if (!s.readInt(i, &generation)) return fail(error, "bad cross-reference entry");
+            i = s.skipSpace(s.tokenEnd(i));
+            if (i >= s.n) return fail(error, "bad cross-reference entry");
+            if (s.d[i] == 'n' && offset > 0 && offset < pdf.size()) objectOffsets.insert(int(first + k), offset);
+            i = s.skipSpace(i + 1);
+        }
+    }
+    if (!s.isKeyword(i, "trailer")) return fail(error, "no trailer");
+    const int trailer = s.skipSpace(i + 7);
+    if (s.lookup(trailer, "/Prev") >= 0) return fail(error, "incrementally updated PDFs are not supported");
+    const int catalog = s.referenceAt(s.lookup(trailer, "/Root"));
+    qint64 size = 0;
+    if (catalog < 0 || !s.readInt(s.lookup(trailer, "/Size"), &size) || size <= 0 || size > (1 << 24))
+        return fail(error, "bad trailer");
+
+    // every object, with its stream data if it has any
+    QVector<SourceObject> objects;
+    objects.reserve(objectOffsets.size());
+    for (auto it = objectOffsets.constBegin(); it != objectOffsets.constEnd(); ++it) {
+        if (it.key() <= 0 || it.key() >= size) return fail(error, "object number out of range");
+        SourceObject o;
+        o.number = it.key();
+        int p = s.skipSpace(int(it.value()));
+        qint64 number;
+        if (!s.readInt(p, &number) || number != o.number) return fail(error, "cross-reference table doesn't match");
+        p = s.skipSpace(s.tokenEnd(s.skipSpace(s.tokenEnd(p))));    // the generation
+        if (!s.isKeyword(p, "obj")) return fail(error, "bad object");
+        o.head = p + 3;
+        o.headEnd = s.skipValue(o.head);
+        if (o.headEnd < 0) return fail(error, "bad object");
+        p = s.skipSpace(o.headEnd);
+        if (s.isKeyword(p, "stream")) {
+            qint64 length = -1;
+            int value = s.lookup(o.head, "/Length");
+            int lengthObject = s.referenceAt(value);
+            if (lengthObject >= 0) {
+                // an indirect length: the object holding it is a plain integer
+                qint64 at = objectOffsets.value(lengthObject, -1);
+                if (at > 0) {
+                    int q = s.skipSpace(s.tokenEnd(s.skipSpace(s.tokenEnd(s.skipSpace(int(at))))));
+                    if (s.isKeyword(q, "obj")) s.readInt(s.skipSpace(q + 3), &length);
+                }
+            } else {
+                s.readInt(value, &length);
+            }
+            p += 6;
+            if (p < s.n && s.d[p] == '\r') ++p;
+            if (p < s.n && s.d[p] == '\n') ++p;
+            if (length < 0 || length > s.n - p) return fail(error, "bad stream length");
+            o.data = p;
+            o.dataLength = int(length);
+        }
+        objects.append(o);
+    }
+
+    // the document's page tree becomes a kid of the merged one
+    const int base = offsets.size() - 1;
+    int root = -1;
+    qint64 count = 0;
+    for (const SourceObject &o : objects) {
+        if (o.number == catalog) root = s.referenceAt(s.lookup(o.head, "/Pages"));
+    }
+    for (const SourceObject &o : objects) {
+        if (o.number == root && !s.readInt(s.lookup(o.head, "/Count"), &count)) root = -1;
+    }
+    if (root < 0) return fail(error, "no page tree");
+    while (offsets.size() < base + int(size)) offsets.append(-1);
+
+    for (const SourceObject &o : objects) {
+        if (o.number == catalog) continue;
+        int headStart = s.skipSpace(o.head);
+        QByteArray bytes;
+        if (o.number == root) {
+            // "<<" then the parent link, then the rest of the dictionary
+            bytes = "<< /Parent " + QByteArray::number(PagesObject) + " 0 R "
+                    + s.renumbered(headStart + 2, o.headEnd, base);
+        } else {
+            bytes = s.renumbered(headStart, o.headEnd, base);
+        }
+        if (o.data >= 0) {
+            bytes += "\nstream\n";
+            bytes.append(s.d + o.data, o.dataLength);
+            bytes += "\nendstream";
+        }
+        if (!writeObject(base + o.number, bytes)) return fail(error, out.errorString());
+    }
+    roots.append(base + root);
+    pages += int(count);
+    return true;
+}
+
+bool PdfMerger::finish(QString *error) {
+    if (failed || !out.isOpen()) return fail(error, "not open");
+    if (roots.isEmpty()) return fail(error, "no pages");
+
+    QByteArray kids;
+    for (int root : roots) kids += QByteArray::number(root) + " 0 R ";
+    writeObject(PagesObject, "<< /Type /Pages /Kids [ " + kids + "] /Count " + QByteArray::number(pages) + " >>");
+    writeObject(CatalogObject, "<< /Type /Catalog /Pages " + QByteArray::number(PagesObject) + " 0 R >>");
+
+    const qint64 xref = out.pos();
+    QByteArray table = "xref\n0 " + QByteArray::number(offsets.size()) + "\n";
+    table.reserve(table.size() + 20 * offsets.size());
+    table += "0000000000 65535 f \n";
+    char entry[32];
+    for (int k = 1; k < offsets.size(); ++k) {
+        if (offsets.at(k) < 0) table += "0000000000 65535 f \n";
+        else {
+            qsnprintf(entry, sizeof entry, "%010lld 00000 n \n", static_cast<long long>(offsets.at(k)));
+            table += entry;
+        }
+    }
+    table += "trailer\n<< /Size " + QByteArray::number(offsets.size()) + " /Root "
+             + QByteArray::number(CatalogObject) + " 0 R >>\nstartxref\n" + QByteArray::number(xref) + "\n%%EOF\n";
+    if (failed || out.write(table) != table.size()) return fail(error, out.errorString());
+    if (!out.commit()) return fail(error, out.errorString());
+    return true;
+}
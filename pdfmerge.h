@@ -0,0 +1,53 @@
+#ifndef PDFMERGE_H
+#define PDFMERGE_H
+
+/*
+Concatenates PDF documents into one file as they arrive, for exporting a
+whole book page by page (pdfexport.h).
+
+Each appended document is parsed just far enough to find its objects (through
+its cross-reference table), renumbered past the objects already written and
+copied to the output at once; stream data is copied untouched. Its page tree
+is hung under a new root, so page attributes it inherits from its own tree
+stay as they were. Only the byte offsets of the objects stay in memory, and
+the cross-reference table, page tree root and catalog are written by
+finish().
+
+This reads the classic-xref, single-revision PDFs that Chromium's
+printToPdf() produces. Documents with cross-reference streams or
+incremental updates are refused rather than guessed at.
+*/
+
+#include <QByteArray>
+#include <QSaveFile>
+#include <QString>
+#include <QVector>
+
+class PdfMerger {
+public:
+    PdfMerger() {}
+
+    bool open(const QString &fileName, QString *error = nullptr);
+
+    // Append every page of pdf, a complete document. Returns false, writing
+    // nothing, if pdf can't be read.
+    bool append(const QByteArray &pdf, QString *error = nullptr);
+
+    int pageCount() const { return pages; }
+
+    // Write the page tree and cross-reference table and replace the file.
+    // Without finish() (e.g. when an export is cancelled) the file is left as it was.
+    bool finish(QString *error = nullptr);
+
+private:
+    Q_DISABLE_COPY(PdfMerger)
+    bool writeObject(int number, const QByteArray &bytes);
+
+    QSaveFile out;
+    QVector<qint64> offsets;    // by object number, -1 for unused numbers
+    QVector<int> roots;         // the page tree of each appended document
+    int pages = 0;
+    bool failed = false;
+};
+
+#endif // PDFMERGE_H
@@ -0,0 +1,95 @@
+#include "perfpanel.h"
+#include "perfstats.h"
+
+#include <QDir>
+#include <QFileDialog>
+#include <QHBoxLayout>
+#include <QHeaderView>
+#include <QMessageBox>
+#include <QPushButton>
+#include <QStandardPaths>
+#include <QTableWidget>
+#include <QTimer>
+#include <QVBoxLayout>
+
+static QString milliseconds(qint64 us) {
+    return QString::number(us / 1000.0, 'f', us < 10000 ? 2 : 0);
+}
+
+PerfPanel::PerfPanel(QWidget *parent) : QWidget(parent) {
+    table = new QTableWidget(0, 5, this);
+    table->setHorizontalHeaderLabels(QStringList() << "Name" << "Count" << "Total ms" << "Avg ms" << "Max ms");
+    table->horizontalHeader()->setSectionResizeMode(0, QHeaderView::Stretch);
+    table->verticalHeader()->hide();
+    table->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    table->setSelectionMode(QAbstractItemView::NoSelection);
+
+    QPushButton *resetButton = new QPushButton("Reset", this);
+    connect(resetButton, &QPushButton::clicked, this, [this]() {
+        PerfStats::reset();
+        refresh();
+    });
+    traceButton = new QPushButton(this);
+    connect(traceButton, &QPushButton::clicked, this, &PerfPanel::toggleTrace);
+
+    QHBoxLayout *buttons = new QHBoxLayout();
+    buttons->addWidget(resetButton);
+    buttons->addWidget(traceButton);
+    buttons->addStretch();
+
+    QVBoxLayout *layout = new QVBoxLayout(this);
+    layout->setContentsMargins(4, 4, 4, 4);
+    layout->addWidget(table);
+    layout->addLayout(buttons);
+
+    timer = new QTimer(this);
+    timer->setInterval(1000);
+    connect(timer, &QTimer::timeout, this, &PerfPanel::refresh);
+    refresh();
+}
+
+void PerfPanel::showEvent(QShowEvent *event) {
+    QWidget::showEvent(event);
+    refresh();
+    timer->start();
+}
+
+void PerfPanel::hideEvent(QHideEvent *event) {
+    QWidget::hideEvent(event);
+    timer->stop();
+}
+
+void PerfPanel::refresh() {
+    traceButton->setText(PerfStats::isTracing() ? "Stop Trace" : "Start Trace...");
+    const QVector<PerfStats::Stat> stats = PerfStats::snapshot();
+    table->setRowCount(stats.size());
+    for (int row = 0; row < stats.size(); ++row) {
+        const PerfStats::Stat &s = stats.at(row);
+        QStringList cells;
+        cells << QString::fromUtf8(s.name) << QString::number(s.count);
+        if (s.timed) cells << milliseconds(s.totalUs) << milliseconds(s.count ? s.totalUs / s.count : 0) << milliseconds(s.maxUs);
+        else cells << QString() << QString() << QString();
+        for (int column = 0; column < cells.size(); ++column) {
+            QTableWidgetItem *item = table->item(row, column);
+            if (!item) {
+                item = new QTableWidgetItem;
+                if (column > 0) item->setTextAlignment(Qt::AlignRight | Qt::AlignVCenter);
+                table->setItem(row, column, item);
+            }
+            item->setText(cells.at(column));
+        }
+    }
+}
+
+void PerfPanel::toggleTrace() {
+    if (PerfStats::isTracing()) {
+        PerfStats::stopTrace();
+    } else {
+        QString suggested = QDir(QStandardPaths::writableLocation(QStandardPaths::DocumentsLocation)).filePath("htmlbooks-trace.json");
+        QString file = QFileDialog::getSaveFileName(this, "Trace File", suggested, "Chrome trace (*.json)");
+        if (file.isEmpty()) return;
+        if (!PerfStats::startTrace(file))
+            QMessageBox::warning(this, "Trace failed", QString("Could not write %1").arg(file));
+    }
+    refresh();
+}
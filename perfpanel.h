@@ -0,0 +1,36 @@
+#ifndef PERFPANEL_H
+#define PERFPANEL_H
+
+/*
+The "Performance" dock: a table of everything PerfStats has timed or
+counted (count, total, average and worst time), refreshed once a second
+while it is visible, with buttons to reset the numbers and to start or stop
+a Chrome trace file.
+*/
+
+#include <QWidget>
+
+class QPushButton;
+class QTableWidget;
+class QTimer;
+
+class PerfPanel : public QWidget {
+    Q_OBJECT
+public:
+    explicit PerfPanel(QWidget *parent = nullptr);
+
+protected:
+    void showEvent(QShowEvent *event) override;
+    void hideEvent(QHideEvent *event) override;
+
+private slots:
+    void refresh();
+    void toggleTrace();
+
+private:
+    QTableWidget *table;
+    QPushButton *traceButton;
+    QTimer *timer;
+};
+
+#endif // PERFPANEL_H
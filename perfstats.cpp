@@ -0,0 +1,125 @@
+#include "perfstats.h"
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QThread>
+#include <algorithm>
+
+struct PerfState {
+    PerfState() { clock.start(); }
+
+    QElapsedTimer clock;
+    QMutex lock;    // guards everything below
+    QHash<QByteArray, PerfStats::Stat> stats;
+    QHash<Qt::HANDLE, int> threads;     // small ids for the trace
+    QFile trace;
+    bool tracing = false;
+    bool firstEvent = true;
+};
+
+static PerfState &state() {
+    static PerfState s;
+    return s;
+}
+
+static QByteArray jsonString(const char *text) {
+    QByteArray out = "\"";
+    for (const char *p = text; *p; ++p) {
+        if (*p == '"' || *p == '\\') out += '\\';
+        if (uchar(*p) >= 0x20) out += *p;
+    }
+    return out + '"';
+}
+
+static PerfStats::Stat &statFor(PerfState &s, const char *name, bool timed) {
+    auto it = s.stats.find(QByteArray::fromRawData(name, int(qstrlen(name))));
+    if (it == s.stats.end()) {
+        PerfStats::Stat stat;
+        stat.name = QByteArray(name);
+        stat.timed = timed;
+        it = s.stats.insert(stat.name, stat);
+    }
+    return it.value();
+}
+
+// One trace event; args is the rest of the object, e.g. "\"dur\":12".
+static void writeEvent(PerfState &s, const char *name, char phase, qint64 ts, const QByteArray &args) {
+    int &tid = s.threads[QThread::currentThreadId()];
+    if (!tid) tid = s.threads.size();
+    QByteArray line = s.firstEvent ? "" : ",\n";
+    s.firstEvent = false;
+    line += "{\"name\":" + jsonString(name) + ",\"cat\":\"htmlbooks\",\"ph\":\"" + phase
+            + "\",\"ts\":" + QByteArray::number(ts) + ",\"pid\":1,\"tid\":" + QByteArray::number(tid);
+    if (!args.isEmpty()) line += "," + args;
+    line += "}";
+    s.trace.write(line);
+}
+
+qint64 PerfStats::nowUs() {
+    return state().clock.nsecsElapsed() / 1000;
+}
+
+void PerfStats::record(const char *name, qint64 startUs, qint64 durationUs) {
+    PerfState &s = state();
+    QMutexLocker lock(&s.lock);
+    Stat &stat = statFor(s, name, true);
+    ++stat.count;
+    stat.totalUs += durationUs;
+    stat.maxUs = qMax(stat.maxUs, durationUs);
+    if (s.tracing) writeEvent(s, name, 'X', startUs, "\"dur\":" + QByteArray::number(durationUs));
+}
+
+void PerfStats::count(const char *name, qint64 n) {
+    PerfState &s = state();
+    QMutexLocker lock(&s.lock);
+    Stat &stat = statFor(s, name, false);
+    stat.count += n;
+    if (s.tracing) writeEvent(s, name, 'C', nowUs(), "\"args\":{\"value\":" + QByteArray::number(stat.count) + "}");
+}
+
+QVector<PerfStats::Stat> PerfStats::snapshot() {
+    PerfState &s = state();
+    QVector<Stat> list;
+    {
+        QMutexLocker lock(&s.lock);
+        list.reserve(s.stats.size());
+        for (const Stat &stat : s.stats) list.append(stat);
+    }
+    std::sort(list.begin(), list.end(), [](const Stat &x, const Stat &y) { return x.name < y.name; });
+    return list;
+}
+
+void PerfStats::reset() {
+    PerfState &s = state();
+    QMutexLocker lock(&s.lock);
+    s.stats.clear();
+}
+
+bool PerfStats::startTrace(const QString &fileName) {
+    stopTrace();
+    PerfState &s = state();
+    QMutexLocker lock(&s.lock);
+    s.trace.setFileName(fileName);
+    if (!s.trace.open(QIODevice::WriteOnly | QIODevice::Truncate)) return false;
+    s.trace.write("[\n");
+    s.tracing = true;
+    s.firstEvent = true;
+    return true;
+}
+
+void PerfStats::stopTrace() {
+    PerfState &s = state();
+    QMutexLocker lock(&s.lock);
+    if (!s.tracing) return;
+    s.trace.write("\n]\n");
+    s.trace.close();
+    s.tracing = false;
+}
+
+bool PerfStats::isTracing() {
+    PerfState &s = state();
+    QMutexLocker lock(&s.lock);
+    return s.tracing;
+}
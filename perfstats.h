@@ -0,0 +1,60 @@
+#ifndef PERFSTATS_H
+#define PERFSTATS_H
+
+/*
+Lightweight timing and counting for profiling real sessions.
+
+Code marks the work it does with a ScopedTimer (or PerfStats::record() for
+spans that start and end in different places, such as a page load), and bumps
+counters with PerfStats::count(). Both are cheap enough to stay on in
+production: a timer is two clock reads and a short locked hash update.
+PerfStats keeps count, total and maximum per name for the stats panel
+(perfpanel.h), and while a trace is running also appends every span as a
+Chrome trace event, so a session can be opened in chrome://tracing or
+Perfetto. Timers live around whole operations (a search, a directory walk, a
+page load), not around single pages.
+*/
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+class PerfStats {
+public:
+    struct Stat {
+        QByteArray name;
+        bool timed = false;     // a timer, else a counter
+        qint64 count = 0;       // spans, or the counter's total
+        qint64 totalUs = 0;
+        qint64 maxUs = 0;
+    };
+
+    // Microseconds on a monotonic clock shared by all threads.
+    static qint64 nowUs();
+
+    // A span of work named name (a string literal) that began at startUs.
+    static void record(const char *name, qint64 startUs, qint64 durationUs);
+    static void count(const char *name, qint64 n = 1);
+
+    static QVector<Stat> snapshot();     // sorted by name
+    static void reset();
+
+    // Chrome trace-event JSON ("JSON array format") of every span from now
+    // until stopTrace(); an unfinished file still loads.
+    static bool startTrace(const QString &fileName);
+    static void stopTrace();
+    static bool isTracing();
+};
+
+class ScopedTimer {
+public:
+    explicit ScopedTimer(const char *name) : name(name), start(PerfStats::nowUs()) {}
+    ~ScopedTimer() { PerfStats::record(name, start, PerfStats::nowUs() - start); }
+
+private:
+    Q_DISABLE_COPY(ScopedTimer)
+    const char *name;
+    qint64 start;
+};
+
+#endif // PERFSTATS_H
@@ -0,0 +1,75 @@
+#include "prefetcher.h"
+#include "bookarchive.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QThread>
+#include <QtConcurrent/QtConcurrentRun>
+
+static const int RecentPages = 16;
+
+static void warmPage(const QString &path) {
+    QString inner;
+    if (QSharedPointer<BookArchive> archive = BookArchive::containing(path, &inner)) {
+        int entry = archive->indexOf(inner);
+        if (entry >= 0) archive->cachedData(entry);
+        return;
+    }
+    QFile f(path);
+    if (!f.open(QIODevice::ReadOnly)) return;
+    char buffer[64 * 1024];
+    while (f.read(buffer, sizeof(buffer)) > 0) {}
+}
+
+Prefetcher::Prefetcher(QObject *parent) : QObject(parent) {
+    pool.setMaxThreadCount(1);
+}
+
+Prefetcher::~Prefetcher() {
+    pool.clear();
+    pool.waitForDone();
+}
+
+QString Prefetcher::successorName(const QString &fileName) {
+    int dot = fileName.lastIndexOf(QLatin1Char('.'));
+    if (dot < 0) dot = fileName.size();
+    int end = dot;
+    while (end > 0 && !fileName.at(end - 1).isDigit()) --end;
+    int start = end;
+    while (start > 0 && fileName.at(start - 1).isDigit()) --start;
+    if (start == end) return QString();
+
+    const QString digits = fileName.mid(start, end - start);
+    bool ok = false;
+    qulonglong n = digits.toULongLong(&ok);
+    if (!ok) return QString();
+    QString next = QString::number(n + 1);
+    if (next.size() < digits.size()) next = QString(digits.size() - next.size(), QLatin1Char('0')) + next;
+    return fileName.left(start) + next + fileName.mid(end);
+}
+
+QStringList Prefetcher::likelyNext(const QString &current, const QStringList &relNext, const QStringList &links) {
+    QStringList next;
+    for (const QString &p : relNext) {
+        if (p != current && !next.contains(p)) next.append(p);
+    }
+    QFileInfo fi(current);
+    QString successor = successorName(fi.fileName());
+    if (!successor.isEmpty()) {
+        QString path = fi.path() + QLatin1Char('/') + successor;
+        if (!next.contains(path) && (links.contains(path) || BookArchive::fileExists(path))) next.append(path);
+    }
+    return next;
+}
+
+void Prefetcher::warm(const QStringList &paths) {
+    for (const QString &path : paths) {
+        if (recent.contains(path)) continue;
+        recent.append(path);
+        if (recent.size() > RecentPages) recent.removeFirst();
+        QtConcurrent::run(&pool, [path]() {
+            QThread::currentThread()->setPriority(QThread::LowPriority);
+            warmPage(path);
+        });
+    }
+}
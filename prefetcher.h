@@ -0,0 +1,44 @@
+#ifndef PREFETCHER_H
+#define PREFETCHER_H
+
+/*
+Warms the pages a reader is likely to open next.
+
+Books are read front to back, so after a page has loaded its likely
+successors are the targets of rel="next" links and the next file in a
+numbered sequence in the same directory (chapter09.html -> chapter10.html,
+john3.htm -> john4.htm). warm() reads them on a single low-priority thread:
+pages on disk end up in the OS page cache, archived pages in their archive's
+cache of inflated entries (see bookarchive.h), so the following load doesn't
+wait for the disk or for zlib. MiniBrowser can additionally pre-render the
+first candidate in a hidden page.
+*/
+
+#include <QObject>
+#include <QStringList>
+#include <QThreadPool>
+
+class Prefetcher : public QObject {
+    Q_OBJECT
+public:
+    explicit Prefetcher(QObject *parent = nullptr);
+    ~Prefetcher();
+
+    // The next name in a numbered sequence, keeping zero padding
+    // ("ch09.html" -> "ch10.html"), or an empty string if there is no number.
+    static QString successorName(const QString &fileName);
+
+    // The likely next pages of the page at current, most likely first: its
+    // rel="next" targets, then its sequential successor when that is linked
+    // or exists. Paths are absolute, as in SitePage.
+    static QStringList likelyNext(const QString &current, const QStringList &relNext, const QStringList &links);
+
+    // Read the pages in the background; pages warmed recently are skipped.
+    void warm(const QStringList &paths);
+
+private:
+    QThreadPool pool;
+    QStringList recent;     // last few warmed pages
+};
+
+#endif // PREFETCHER_H
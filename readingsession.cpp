@@ -0,0 +1,118 @@
+#include "readingsession.h"
+#include "perfstats.h"
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QSettings>
+#include <QStandardPaths>
+#include <QtConcurrent/QtConcurrentRun>
+#include <algorithm>
+
+static const quint32 SessionMagic = 0x48425353;     // "HBSS"
+static const quint32 SessionVersion = 1;
+
+ReadingSession::ReadingSession(QObject *parent) : QObject(parent) {
+    saveTimer.setSingleShot(true);
+    saveTimer.setInterval(qMax(0, QSettings().value("session/saveDelayMs", 2000).toInt()));
+    connect(&saveTimer, &QTimer::timeout, this, &ReadingSession::save);
+}
+
+ReadingSession::~ReadingSession() {
+    flush();
+}
+
+QString ReadingSession::fileName() {
+    return QDir(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation)).filePath("sessions.dat");
+}
+
+QString ReadingSession::key(const QString &book) {
+    return QDir::cleanPath(book);
+}
+
+static bool writeSessions(const QHash<QString, ReadingSession::Entry> &books, const QString &path) {
+    ScopedTimer timer("session save");
+    if (!QDir().mkpath(QFileInfo(path).absolutePath())) return false;
+    QSaveFile f(path);
+    if (!f.open(QIODevice::WriteOnly)) return false;
+    QDataStream out(&f);
+    out.setVersion(QDataStream::Qt_5_6);
+    out << SessionMagic << SessionVersion << quint32(books.size());
+    for (auto it = books.constBegin(); it != books.constEnd(); ++it)
+        out << it.key() << it->url << it->scroll << it->history << it->updated;
+    return out.status() == QDataStream::Ok && f.commit();
+}
+
+bool ReadingSession::load() {
+    QFile f(fileName());
+    if (!f.open(QIODevice::ReadOnly)) return false;
+    QDataStream in(&f);
+    in.setVersion(QDataStream::Qt_5_6);
+    quint32 magic = 0, version = 0, count = 0;
+    in >> magic >> version >> count;
+    if (magic != SessionMagic || version != SessionVersion) return false;
+    QHash<QString, Entry> read;
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        QString book;
+        Entry e;
+        in >> book >> e.url >> e.scroll >> e.history >> e.updated;
+        read.insert(book, e);
+    }
+    if (in.status() != QDataStream::Ok) return false;
+    books = read;
+    return true;
+}
+
+void ReadingSession::setPosition(const QString &book, const QUrl &url, const QPointF &scroll) {
+    Entry &e = books[key(book)];
+    if (e.url == url && e.scroll == scroll) return;
+    e.url = url;
+    e.scroll = scroll;
+    e.updated = QDateTime::currentMSecsSinceEpoch();
+    changed();
+}
+
+void ReadingSession::setHistory(const QString &book, const QByteArray &history) {
+    Entry &e = books[key(book)];
+    if (e.history == history) return;
+    e.history = history;
+    e.updated = QDateTime::currentMSecsSinceEpoch();
+    changed();
+}
+
+void ReadingSession::changed() {
+    dirty = true;
+    if (!saveTimer.isActive()) saveTimer.start();   // batches everything until it fires
+}
+
+void ReadingSession::save() {
+    if (!dirty) return;
+    // one write at a time: a change while writing is saved by the next one
+    if (writing.isRunning()) {
+        saveTimer.start();
+        return;
+    }
+    while (books.size() > MaxBooks) {
+        auto oldest = books.begin();
+        for (auto it = books.begin(); it != books.end(); ++it) {
+            if (it->updated < oldest->updated) oldest = it;
+        }
+        books.erase(oldest);
+    }
+    dirty = false;
+    QHash<QString, Entry> snapshot = books;
+    QString path = fileName();
+    writing = QtConcurrent::run([snapshot, path]() { return writeSessions(snapshot, path); });
+}
+
+void ReadingSession::flush() {
+    saveTimer.stop();
+    writing.waitForFinished();
+    if (!dirty) return;
+    dirty = false;
+    if (!writeSessions(books, fileName())) qDebug() << "Could not write reading sessions" << fileName();
+}
@@ -0,0 +1,65 @@
+#ifndef READINGSESSION_H
+#define READINGSESSION_H
+
+/*
+Where reading stopped in each book, so the viewer reopens there.
+
+ReadingSession keeps, per book (its site folder or archive), the page last
+shown, its scroll position and the view's back/forward history (as
+QWebEngineHistory streams it). Updates only change the state in memory and
+start a timer, and session/saveDelayMs (default 2000) later one snapshot of
+every book is written on a worker thread to sessions.dat in the application's
+data directory, through QSaveFile; scrolling and page changes never wait for
+the disk, and a burst of them costs one write. flush() writes what is
+pending before the window closes.
+*/
+
+#include <QByteArray>
+#include <QFuture>
+#include <QHash>
+#include <QObject>
+#include <QPointF>
+#include <QString>
+#include <QTimer>
+#include <QUrl>
+
+class ReadingSession : public QObject {
+    Q_OBJECT
+public:
+    struct Entry {
+        QUrl url;           // invalid if the book has no session
+        QPointF scroll;
+        QByteArray history;
+        qint64 updated = 0; // msecs since epoch
+    };
+
+    explicit ReadingSession(QObject *parent = nullptr);
+    ~ReadingSession();
+
+    static QString fileName();
+
+    // Read the sessions saved by an earlier run; false if there are none.
+    bool load();
+
+    Entry entry(const QString &book) const { return books.value(key(book)); }
+    void setPosition(const QString &book, const QUrl &url, const QPointF &scroll);
+    void setHistory(const QString &book, const QByteArray &history);
+
+    // Write pending changes now, waiting for a write in progress.
+    void flush();
+
+    // Books beyond this many, least recently read first, are forgotten.
+    static const int MaxBooks = 100;
+
+private:
+    static QString key(const QString &book);
+    void changed();
+    void save();
+
+    QHash<QString, Entry> books;
+    QTimer saveTimer;
+    QFuture<bool> writing;
+    bool dirty = false;
+};
+
+#endif // READINGSESSION_H
@@ -0,0 +1,214 @@
+#include "resultsmodel.h"
+#include "htmltext.h"
+#include "memorybudget.h"
+#include "searchindex.h"
+#include "searchkernel.h"
+
+#include <QAbstractTextDocumentLayout>
+#include <QApplication>
+#include <QFileInfo>
+#include <QPainter>
+#include <QPair>
+#include <QTextDocument>
+#include <algorithm>
+
+static const int ContextBefore = 60;     // bytes of page text around the match
+static const int ContextAfter = 140;
+
+static int utf8Boundary(const QByteArray &text, int pos) {
+    while (pos > 0 && pos < text.size() && (uchar(text.at(pos)) & 0xC0) == 0x80) --pos;
+    return pos;
+}
+
+static QString decode(const QByteArray &text, int from, int to) {
+    return QString::fromUtf8(text.constData() + from, to - from).toHtmlEscaped();
+}
+
+// Rich-text excerpt of text around offset with every query word in bold.
+static QString snippetHtml(const QByteArray &text, int offset, const QList<QByteArray> &words, const QString &term) {
+    if (text.isEmpty()) return QString();
+    const bool matched = offset >= 0 && offset < text.size();
+    if (!matched) {
+        offset = CaseInsensitiveMatcher(term.toUtf8()).indexIn(text);
+        if (offset < 0 && !words.isEmpty()) offset = CaseInsensitiveMatcher(words.first()).indexIn(text);
+        if (offset < 0) offset = 0;
+    }
+
+    int start = utf8Boundary(text, qMax(0, offset - ContextBefore));
+    int end = utf8Boundary(text, qMin(text.size(), offset + ContextAfter));
+    // don't start or stop in the middle of a word
+    if (start > 0) {
+        int space = text.indexOf(' ', start);
+        if (space >= 0 && space < offset) start = space + 1;
+    }
+    if (end < text.size()) {
+        int space = text.lastIndexOf(' ', end);
+        if (space > offset) end = space;
+    }
+
+    QVector<QPair<int, int> > marks;
+    for (const QByteArray &w : words) {
+        CaseInsensitiveMatcher m(w);
+        int pos = start;
+        while ((pos = m.indexIn(text.constData(), end, pos)) >= 0) {
+            marks.append(qMakePair(pos, pos + w.size()));
+            pos += w.size();
+        }
+    }
+    // the word the index matched, which a stemmed or fuzzy search may spell
+    // unlike the query
+    if (matched) {
+        int length = 0;
+        SearchIndex::forEachWord(text.constData() + offset, end - offset, [&](const char *, int len, int at) {
+            if (at == 0 && length == 0) length = len;
+        });
+        if (length > 0) marks.append(qMakePair(offset, offset + length));
+    }
+    std::sort(marks.begin(), marks.end());
+
+    QString html;
+    if (start > 0) html += QString::fromUtf8("… ");
+    int cursor = start;
+    for (const QPair<int, int> &m : marks) {
+        if (m.first < cursor) continue;     // overlaps the previous mark
+        html += decode(text, cursor, m.first);
+        html += "<b>" + decode(text, m.first, m.second) + "</b>";
+        cursor = m.second;
+    }
+    html += decode(text, cursor, end);
+    if (end < text.size()) html += QString::fromUtf8(" …");
+    return html;
+}
+
+ResultsModel::ResultsModel(QObject *parent) : QAbstractListModel(parent) {
+    snippets.setMaxCost(lowMemoryMode() ? 50 : 300);
+}
+
+int ResultsModel::room(int count) const {
+    return maxRows > 0 ? qBound(0, maxRows - rows.size(), count) : count;
+}
+
+void ResultsModel::reset(const QString &term) {
+    beginResetModel();
+    query = term;
+    words = SearchIndex::queryWords(term);
+    rows.clear();
+    dropped = 0;
+    snippets.clear();
+    endResetModel();
+}
+
+void ResultsModel::setResults(const QVector<SearchResult> &results) {
+    beginResetModel();
+    rows.clear();
+    const int n = room(results.size());
+    rows = n == results.size() ? results : results.mid(0, n);
+    dropped = results.size() - n;
+    snippets.clear();
+    endResetModel();
+}
+
+void ResultsModel::append(const SearchResult &result) {
+    if (room(1) == 0) {
+        ++dropped;
+        return;
+    }
+    beginInsertRows(QModelIndex(), rows.size(), rows.size());
+    rows.append(result);
+    endInsertRows();
+}
+
+void ResultsModel::append(const QVector<SearchResult> &more) {
+    const int n = room(more.size());
+    dropped += more.size() - n;
+    if (n == 0) return;
+    beginInsertRows(QModelIndex(), rows.size(), rows.size() + n - 1);
+    rows += n == more.size() ? more : more.mid(0, n);
+    endInsertRows();
+}
+
+void ResultsModel::setPageTexts(const QVector<QSharedPointer<PageTextCache> > &caches) {
+    pageTexts.clear();
+    for (const QSharedPointer<PageTextCache> &cache : caches) {
+        if (cache) pageTexts.append(cache);
+    }
+    snippets.clear();
+}
+
+QStringList ResultsModel::paths() const {
+    QStringList list;
+    list.reserve(rows.size());
+    for (const SearchResult &r : rows) list.append(r.path);
+    return list;
+}
+
+int ResultsModel::rowCount(const QModelIndex &parent) const {
+    return parent.isValid() ? 0 : rows.size();
+}
+
+QVariant ResultsModel::data(const QModelIndex &index, int role) const {
+    if (!index.isValid() || index.row() >= rows.size()) return QVariant();
+    const SearchResult &r = rows.at(index.row());
+    switch (role) {
+    case Qt::DisplayRole: return r.title.isEmpty() ? QFileInfo(r.path).fileName() : r.title;
+    case Qt::ToolTipRole:
+    case PathRole: return r.path;
+    case SnippetRole: return snippet(index.row());
+    case HitsRole: return r.hits;
+    case OffsetRole: return r.offset;
+    case AnchorRole: return r.anchor;
+    default: return QVariant();
+    }
+}
+
+QString ResultsModel::snippet(int row) const {
+    if (QString *cached = snippets.object(row)) return *cached;
+    const SearchResult &r = rows.at(row);
+    QByteArray text;
+    bool found = false;
+    for (const QSharedPointer<PageTextCache> &cache : pageTexts) {
+        if ((found = cache->text(r.path, &text))) break;
+    }
+    QString html;
+    if (found || readPageText(r.path, &text)) html = snippetHtml(text, r.offset, words, query);
+    snippets.insert(row, new QString(html));
+    return html;
+}
+
+void ResultDelegate::paint(QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index) const {
+    QStyleOptionViewItem opt = option;
+    initStyleOption(&opt, index);
+    const QString title = opt.text;
+    opt.text.clear();
+    QStyle *style = opt.widget ? opt.widget->style() : QApplication::style();
+    style->drawControl(QStyle::CE_ItemViewItem, &opt, painter, opt.widget);   // background, selection
+
+    QString html = QString("<b>%1</b>").arg(title.toHtmlEscaped());
+    int hits = index.data(ResultsModel::HitsRole).toInt();
+    if (hits > 0) html += QString(" <small>(%1 %2)</small>").arg(hits).arg(hits == 1 ? "hit" : "hits");
+    html += "<br>" + index.data(ResultsModel::SnippetRole).toString();
+
+    QRect r = opt.rect.adjusted(4, 2, -4, -2);
+    QTextDocument doc;
+    doc.setDefaultFont(opt.font);
+    doc.setDocumentMargin(0);
+    doc.setTextWidth(r.width());
+    doc.setHtml(html);
+
+    QAbstractTextDocumentLayout::PaintContext ctx;
+    ctx.palette = opt.palette;
+    if (opt.state & QStyle::State_Selected)
+        ctx.palette.setColor(QPalette::Text, opt.palette.color(QPalette::HighlightedText));
+    ctx.clip = QRectF(0, 0, r.width(), r.height());
+    painter->save();
+    painter->translate(r.topLeft());
+    painter->setClipRect(ctx.clip);
+    doc.documentLayout()->draw(painter, ctx);
+    painter->restore();
+}
+
+QSize ResultDelegate::sizeHint(const QStyleOptionViewItem &option, const QModelIndex &) const {
+    // title line plus two lines of snippet; rows are uniform so the view can
+    // lay out 100k results without asking for each one
+    return QSize(200, option.fontMetrics.height() * 3 + 6);
+}
@@ -0,0 +1,93 @@
+#ifndef RESULTSMODEL_H
+#define RESULTSMODEL_H
+
+/*
+Folder search results for the left-hand QListView.
+
+Rows are kept as plain structs and everything shown for a row is made on
+demand in data(): the context snippet is only cut out of the page (and only
+that part decoded from UTF-8) when the view asks for a visible row, taken
+from the page text cache when it has the page (pagetextcache.h), and the
+last few hundred snippets are cached (fifty in low-memory mode, where the
+list can also be capped with setLimit()). ResultDelegate draws the file name, hit
+count and the snippet with the query words in bold.
+*/
+
+#include <QAbstractListModel>
+#include <QByteArray>
+#include <QCache>
+#include <QList>
+#include <QSharedPointer>
+#include <QStringList>
+#include <QStyledItemDelegate>
+#include <QVector>
+
+#include "pagetextcache.h"
+
+struct SearchResult {
+    QString path;
+    float score = 0;
+    int hits = 0;       // occurrences in the page, 0 if unknown
+    int offset = -1;    // byte offset of a match in the page text, -1 if unknown
+    QString anchor;     // element to scroll to, for verse references
+    QString title;      // shown instead of the file name when set
+};
+
+class ResultsModel : public QAbstractListModel {
+    Q_OBJECT
+public:
+    enum Roles {
+        PathRole = Qt::UserRole,
+        SnippetRole,    // rich text
+        HitsRole,
+        OffsetRole,
+        AnchorRole
+    };
+
+    explicit ResultsModel(QObject *parent = nullptr);
+
+    // Clear the list and remember the query used for snippets and highlighting.
+    void reset(const QString &term);
+    void setResults(const QVector<SearchResult> &results);
+    void append(const SearchResult &result);
+    void append(const QVector<SearchResult> &more);     // one insertion for the lot
+    // Keep at most the first limit rows (0, the default, keeps every one);
+    // droppedCount() is how many the last results went over it by.
+    void setLimit(int limit) { maxRows = qMax(0, limit); }
+    int droppedCount() const { return dropped; }
+    // The page text caches of the books the results are in (null ones are
+    // skipped); a page none of them has is read from its HTML.
+    void setPageTexts(const QVector<QSharedPointer<PageTextCache> > &caches);
+    // Forget the cached snippets, to give their memory back.
+    void releaseCaches() { snippets.clear(); }
+    const SearchResult &result(int row) const { return rows.at(row); }
+    QStringList paths() const;
+    QString term() const { return query; }
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+
+private:
+    QString snippet(int row) const;
+    // How many of count more rows fit under the limit.
+    int room(int count) const;
+
+    QString query;
+    QList<QByteArray> words;    // query words to highlight
+    QVector<SearchResult> rows;
+    int maxRows = 0;
+    int dropped = 0;
+    QVector<QSharedPointer<PageTextCache> > pageTexts;
+    mutable QCache<int, QString> snippets;
+};
+
+class ResultDelegate : public QStyledItemDelegate {
+    Q_OBJECT
+public:
+    explicit ResultDelegate(QObject *parent = nullptr) : QStyledItemDelegate(parent) {}
+
+    void paint(QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index) const override;
+    QSize sizeHint(const QStyleOptionViewItem &option, const QModelIndex &index) const override;
+};
+
+#endif // RESULTSMODEL_H
@@ -0,0 +1,1094 @@
+#include "searchindex.h"
+#include "bookarchive.h"
+#include "htmltext.h"
+#include "memorybudget.h"
+#include "perfstats.h"
+
+#include <QAtomicInt>
+#include <QBuffer>
+#include <QChar>
+#include <QDataStream>
+#include <QDir>
+#include <QRegularExpression>
+#include <QFile>
+#include <QSaveFile>
+#include <QSet>
+#include <QThread>
+#include <QThreadPool>
+#include <QtConcurrent/QtConcurrentRun>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iterator>
+
+static const quint32 IndexMagic = 0x48424958;   // "HBIX"
+static const quint32 IndexVersion = 3;
+
+QDataStream &operator<<(QDataStream &out, const IndexedFile &f) {
+    return out << f.path << f.size << f.mtime << f.words;
+}
+
+QDataStream &operator>>(QDataStream &in, IndexedFile &f) {
+    return in >> f.path >> f.size >> f.mtime >> f.words;
+}
+
+QString SearchIndex::indexFilePath(const QString &siteDir) {
+    return QDir(siteDir).filePath(".htmlbooks/index");
+}
+
+QString SearchIndex::absolutePath(quint32 id) const {
+    return QDir(dir).filePath(files.at(int(id)).path);
+}
+
+int SearchIndex::utf8CharAt(const char *p, int size, bool *word) {
+    uchar c = uchar(p[0]);
+    int n = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+    uint cp = n == 4 ? (c & 0x07) : n == 3 ? (c & 0x0F) : (c & 0x1F);
+    if (n == 1 || n > size) {
+        *word = false;
+        return 1;
+    }
+    for (int i = 1; i < n; ++i) {
+        uchar cc = uchar(p[i]);
+        if ((cc & 0xC0) != 0x80) {
+            *word = false;
+            return 1;
+        }
+        cp = (cp << 6) | (cc & 0x3F);
+    }
+    QChar::Category cat = QChar::category(cp);
+    *word = QChar::isLetterOrNumber(cp) || cat == QChar::Mark_NonSpacing || cat == QChar::Mark_SpacingCombining;
+    return n;
+}
+
+QByteArray SearchIndex::normalizeWord(const char *word, int length) {
+    QByteArray w(word, length);
+    for (int i = 0; i < length; ++i) {
+        if (uchar(w[i]) >= 0x80) {
+            // non-ASCII: let Qt do proper Unicode case folding
+            return QString::fromUtf8(w).toCaseFolded().toUtf8();
+        }
+    }
+    return w.toLower();
+}
+
+void SearchIndex::addPage(quint32 id, const QByteArray &text) {
+    quint32 words = 0;
+    forEachWord(text.constData(), text.size(), [&](const char *w, int len, int offset) {
+        Posting p = { id, quint32(offset), words };
+        postings[normalizeWord(w, len)].append(p);
+        ++words;
+    });
+    files[int(id)].words = words;
+}
+
+// "1 John" -> "1john": case-folded letters and digits only.
+static QByteArray bookKey(const QString &name) {
+    QString key;
+    for (QChar c : name.toCaseFolded()) {
+        if (c.isLetterOrNumber()) key.append(c);
+    }
+    return key.toUtf8();
+}
+
+static QByteArray referenceKey(const QByteArray &book, int chapter, int verse) {
+    QByteArray key = book + ' ' + QByteArray::number(chapter);
+    if (verse > 0) key += ':' + QByteArray::number(verse);
+    return key;
+}
+
+// The book and chapter a page title or heading names: "John 3", "1 John 3",
+// "Genesis Chapter 1", "King James Bible - Psalm 23". Of titles separated by
+// dashes, bars and the like, the last that fits is taken; with bookOnly, a
+// title of letters alone is a book with *chapter 0.
+static bool parseChapterTitle(const QByteArray &title, bool bookOnly, QByteArray *book, int *chapter) {
+    static const QRegularExpression separators(QStringLiteral("[-|:,()\\[\\]\\x{2013}\\x{2014}]"));
+    static const QRegularExpression chapterTitle(QStringLiteral("^((?:[1-3]\\s*)?\\p{L}[\\p{L}\\s.']*?)\\s+(?:chapter\\s+)?(\\d{1,3})$"),
+                                                 QRegularExpression::CaseInsensitiveOption);
+    static const QRegularExpression bookTitle(QStringLiteral("^(?:[1-3]\\s*)?\\p{L}[\\p{L}\\s.']*$"));
+    const QStringList parts = QString::fromUtf8(title).split(separators, QString::SkipEmptyParts);
+    for (int i = parts.size() - 1; i >= 0; --i) {
+        const QString part = parts.at(i).simplified();
+        if (part.size() > 40) continue;
+        QRegularExpressionMatch m = chapterTitle.match(part);
+        if (m.hasMatch()) {
+            *book = bookKey(m.captured(1));
+            *chapter = m.captured(2).toInt();
+            if (!book->isEmpty() && *book != "chapter" && *chapter > 0) return true;
+        } else if (bookOnly && bookTitle.match(part).hasMatch()) {
+            *book = bookKey(part);
+            *chapter = 0;
+            if (!book->isEmpty()) return true;
+        }
+    }
+    return false;
+}
+
+// The verse (and chapter, if it says) an anchor name stands for: "16", "v16",
+// "V16", "verse16"; "3:16", "3_16", "c3v16", "John3.16". Other names
+// ("top", "fn1", "chap01") are not verses.
+static bool parseVerseAnchor(const QByteArray &name, int *chapter, int *verse) {
+    int i = 0;
+    while (i < name.size() && ((name[i] >= 'a' && name[i] <= 'z') || (name[i] >= 'A' && name[i] <= 'Z'))) ++i;
+    const QByteArray prefix = name.left(i).toLower();
+    auto number = [&](int *value) -> bool {
+        const int start = i;
+        *value = 0;
+        while (i < name.size() && name[i] >= '0' && name[i] <= '9' && i - start < 3) *value = *value * 10 + (name[i++] - '0');
+        return i > start && *value > 0;
+    };
+    int first = 0, second = 0;
+    if (!number(&first)) return false;
+    if (i == name.size()) {
+        if (!prefix.isEmpty() && prefix != "v" && prefix != "verse") return false;
+        *chapter = 0;
+        *verse = first;
+        return true;
+    }
+    const char sep = name[i++];
+    if (!strchr(":._-vV", sep) || !number(&second) || i != name.size()) return false;
+    *chapter = first;
+    *verse = second;
+    return true;
+}
+
+void SearchIndex::addReferences(quint32 id, const PageStructure &structure) {
+    QByteArray book;
+    int chapter = 0;
+    if (!parseChapterTitle(structure.title, false, &book, &chapter)
+            && !parseChapterTitle(structure.heading, false, &book, &chapter)
+            && !parseChapterTitle(structure.heading, true, &book, &chapter)
+            && !parseChapterTitle(structure.title, true, &book, &chapter))
+        return;
+    // the first page (or verse anchor) to claim a reference keeps it
+    if (chapter > 0 && !references.contains(referenceKey(book, chapter, 0))) {
+        VerseRef ref = { id, 0, QByteArray() };
+        references.insert(referenceKey(book, chapter, 0), ref);
+    }
+    for (const PageStructure::Anchor &a : structure.anchors) {
+        int c = 0, v = 0;
+        if (!parseVerseAnchor(a.name, &c, &v)) continue;
+        if (c == 0) c = chapter;
+        if (c == 0) continue;
+        VerseRef ref = { id, quint32(a.offset), a.name };
+        const QByteArray chapterKey = referenceKey(book, c, 0);
+        if (!references.contains(chapterKey)) references.insert(chapterKey, ref);
+        const QByteArray verseKey = referenceKey(book, c, v);
+        if (!references.contains(verseKey)) references.insert(verseKey, ref);
+    }
+}
+
+void SearchIndex::sortBooks() {
+    QSet<QByteArray> names;
+    for (auto it = references.constBegin(); it != references.constEnd(); ++it)
+        names.insert(it.key().left(it.key().indexOf(' ')));
+    books = names.toList().toVector();
+    std::sort(books.begin(), books.end());
+}
+
+bool SearchIndex::findReference(const QString &query, VerseRef *ref) const {
+    if (references.isEmpty()) return false;
+    static const QRegularExpression reference(QStringLiteral("^\\s*((?:[1-3]\\s*)?\\p{L}[\\p{L}\\s.']*?)\\.?\\s*(\\d{1,3})(?:\\s*[:.,v]\\s*(\\d{1,3}))?\\s*$"),
+                                              QRegularExpression::CaseInsensitiveOption);
+    QRegularExpressionMatch m = reference.match(query);
+    if (!m.hasMatch()) return false;
+    const QByteArray name = bookKey(m.captured(1));
+    if (name.isEmpty()) return false;
+
+    // an exact book name, else the only one it abbreviates
+    auto it = std::lower_bound(books.constBegin(), books.constEnd(), name);
+    if (it == books.constEnd() || !it->startsWith(name)) return false;
+    if (*it != name && it + 1 != books.constEnd() && (it + 1)->startsWith(name)) return false;
+
+    auto found = references.constFind(referenceKey(*it, m.captured(2).toInt(), m.captured(3).toInt()));
+    if (found == references.constEnd()) return false;
+    *ref = found.value();
+    return true;
+}
+
+void SearchIndex::build(const QVector<SitePage> &pages, PageTextCache::Builder *texts) {
+    files.clear();
+    postings.clear();
+    references.clear();
+    unreadable.clear();     // tried again
+    // update() leaves the term and book lists alone when it has nothing to add
+    dictionary = TermDictionary();
+    books.clear();
+    update(pages, texts);
+}
+
+void SearchIndex::dropFiles(const QVector<bool> &drop) {
+    // compact file ids in one pass over all postings, keeping them sorted
+    QVector<quint32> remap(files.size());
+    QVector<IndexedFile> kept;
+    for (int i = 0; i < files.size(); ++i) {
+        if (drop.at(i)) continue;
+        remap[i] = quint32(kept.size());
+        kept.append(files.at(i));
+    }
+    for (auto it = postings.begin(); it != postings.end(); ) {
+        QVector<Posting> &list = it.value();
+        int out = 0;
+        for (int i = 0; i < list.size(); ++i) {
+            const Posting &p = list.at(i);
+            if (drop.at(int(p.file))) continue;
+            list[out].file = remap.at(int(p.file));
+            list[out].offset = p.offset;
+            list[out].position = p.position;
+            ++out;
+        }
+        if (out == 0) {
+            it = postings.erase(it);
+        } else {
+            list.resize(out);
+            ++it;
+        }
+    }
+    for (auto it = references.begin(); it != references.end(); ) {
+        if (drop.at(int(it->file))) {
+            it = references.erase(it);
+        } else {
+            it->file = remap.at(int(it->file));
+            ++it;
+        }
+    }
+    files = kept;
+}
+
+int SearchIndex::update(const QVector<SitePage> &pages, PageTextCache::Builder *texts) {
+    QHash<QString, int> byPath;
+    byPath.reserve(files.size());
+    for (int i = 0; i < files.size(); ++i) byPath.insert(files.at(i).path, i);
+
+    QDir root(dir);
+    QVector<bool> drop(files.size(), true);
+    QVector<SitePage> changed;
+    QVector<bool> wasIndexed;       // of changed: replaces an indexed page
+    QHash<QString, IndexedFile> stillUnreadable;
+    for (const SitePage &page : pages) {
+        const QString rel = root.relativeFilePath(page.path);
+        auto it = byPath.constFind(rel);
+        if (it != byPath.constEnd()) {
+            // an unchanged page missing from the text cache is indexed again
+            // to fill it in
+            const IndexedFile &f = files.at(it.value());
+            if (f.size == page.size && f.mtime == page.mtime && (!texts || texts->keep(rel, page))) {
+                drop[it.value()] = false;
+                continue;
+            }
+        } else {
+            // a page that couldn't be read is only tried again once it changes
+            auto failed = unreadable.constFind(rel);
+            if (failed != unreadable.constEnd() && failed->size == page.size && failed->mtime == page.mtime) {
+                stillUnreadable.insert(rel, *failed);
+                continue;
+            }
+        }
+        changed.append(page);
+        wasIndexed.append(it != byPath.constEnd());
+    }
+    unreadable = stillUnreadable;
+
+    const int dropped = drop.count(true);
+    if (dropped == 0 && changed.isEmpty()) return 0;
+    if (dropped > 0) dropFiles(drop);
+
+    // Pages are read and stripped to text on all cores, a batch at a time so
+    // only a few hundred pages' text is held at once; postings are then added
+    // in page order on this thread. New ids are larger than every kept id, so
+    // posting lists stay sorted. In low-memory mode one thread reads eight
+    // pages at a time.
+    const int workers = lowMemoryMode() ? 1 : qBound(1, threads > 0 ? threads : QThread::idealThreadCount(), qMax(1, changed.size()));
+    const int batch = lowMemoryMode() ? 8 : workers * 32;
+    QThreadPool pool;
+    pool.setMaxThreadCount(workers);
+    QVector<QByteArray> extracted;
+    QVector<PageStructure> structures;
+    QVector<char> read;
+    int indexed = 0;
+    int replaced = 0;       // of indexed, pages that were in the index before
+    for (int first = 0; first < changed.size(); first += batch) {
+        const int n = qMin(batch, changed.size() - first);
+        extracted.fill(QByteArray(), n);
+        structures.fill(PageStructure(), n);
+        read.fill(0, n);
+        const SitePage *pagesIn = changed.constData() + first;
+        QByteArray *textsOut = extracted.data();
+        PageStructure *structuresOut = structures.data();
+        char *readOut = read.data();
+        if (workers == 1) {
+            for (int i = 0; i < n; ++i) readOut[i] = readPageText(pagesIn[i].path, &textsOut[i], &structuresOut[i]);
+        } else {
+            QAtomicInt next(0);
+            for (int w = 0; w < workers; ++w) {
+                QtConcurrent::run(&pool, [&next, n, pagesIn, textsOut, structuresOut, readOut]() {
+                    for (int i = next.fetchAndAddRelaxed(1); i < n; i = next.fetchAndAddRelaxed(1))
+                        readOut[i] = readPageText(pagesIn[i].path, &textsOut[i], &structuresOut[i]);
+                });
+            }
+            pool.waitForDone();
+        }
+        for (int i = 0; i < n; ++i) {
+            IndexedFile entry;
+            entry.path = root.relativeFilePath(pagesIn[i].path);
+            entry.size = pagesIn[i].size;
+            entry.mtime = pagesIn[i].mtime;
+            if (!read.at(i)) {
+                unreadable.insert(entry.path, entry);
+                continue;
+            }
+            ++indexed;
+            if (wasIndexed.at(first + i)) ++replaced;
+            files.append(entry);
+            addPage(quint32(files.size() - 1), extracted.at(i));
+            addReferences(quint32(files.size() - 1), structures.at(i));
+            if (texts) texts->add(entry.path, pagesIn[i], extracted.at(i));
+        }
+    }
+    for (QVector<Posting> &list : postings) list.squeeze();
+    sortDictionary();
+    sortBooks();
+    PerfStats::count("pages indexed", indexed);
+    // a re-indexed page counts once, a page dropped and not read again as removed
+    return indexed + dropped - replaced;
+}
+
+bool SearchIndex::load() {
+    files.clear();
+    postings.clear();
+    references.clear();
+    const QString path = indexFilePath(dir);
+    QFile f(path);
+    QBuffer packed;
+    QIODevice *device = &f;
+    QString inner;
+    QSharedPointer<BookArchive> archive = BookArchive::containing(path, &inner);
+    if (archive) {
+        int entry = archive->indexOf(inner);
+        if (entry < 0) return false;
+        packed.setData(archive->data(entry));
+        device = &packed;
+    }
+    if (!device->open(QIODevice::ReadOnly)) return false;
+    QDataStream in(device);
+    in.setVersion(QDataStream::Qt_5_6);
+
+    quint32 magic = 0, version = 0;
+    in >> magic >> version;
+    if (magic != IndexMagic || version != IndexVersion) return false;
+
+    in >> files;
+    quint32 terms = 0;
+    in >> terms;
+    postings.reserve(int(terms));
+    for (quint32 t = 0; t < terms && in.status() == QDataStream::Ok; ++t) {
+        QByteArray term;
+        quint32 n = 0;
+        in >> term >> n;
+        QVector<Posting> list(int(n));
+        for (quint32 i = 0; i < n; ++i) in >> list[int(i)].file >> list[int(i)].offset >> list[int(i)].position;
+        postings.insert(term, list);
+    }
+    quint32 refs = 0;
+    in >> refs;
+    references.reserve(int(refs));
+    for (quint32 r = 0; r < refs && in.status() == QDataStream::Ok; ++r) {
+        QByteArray key;
+        VerseRef ref;
+        in >> key >> ref.file >> ref.offset >> ref.anchor;
+        if (ref.file < quint32(files.size())) references.insert(key, ref);
+    }
+    if (in.status() != QDataStream::Ok) {
+        files.clear();
+        postings.clear();
+        references.clear();
+        return false;
+    }
+    sortDictionary();
+    sortBooks();
+    return true;
+}
+
+bool SearchIndex::save() const {
+    if (BookArchive::isArchivePath(dir)) return false;     // archives are read-only
+    QString path = indexFilePath(dir);
+    if (!QDir().mkpath(QFileInfo(path).absolutePath())) return false;
+    QSaveFile f(path);
+    if (!f.open(QIODevice::WriteOnly)) return false;
+    QDataStream out(&f);
+    out.setVersion(QDataStream::Qt_5_6);
+
+    out << IndexMagic << IndexVersion;
+    out << files;
+    out << quint32(postings.size());
+    for (auto it = postings.constBegin(); it != postings.constEnd(); ++it) {
+        out << it.key() << quint32(it.value().size());
+        for (const Posting &p : it.value()) out << p.file << p.offset << p.position;
+    }
+    out << quint32(references.size());
+    for (auto it = references.constBegin(); it != references.constEnd(); ++it)
+        out << it.key() << it->file << it->offset << it->anchor;
+    return out.status() == QDataStream::Ok && f.commit();
+}
+
+void SearchIndex::sortDictionary() {
+    QVector<QByteArray> terms = postings.keys().toVector();
+    std::sort(terms.begin(), terms.end());
+    dictionary = TermDictionary(terms);
+}
+
+// Per-page statistics of one query word.
+struct TermInPage {
+    quint32 file;
+    quint32 tf;
+    quint32 first;
+};
+
+static QVector<TermInPage> groupByPage(const QVector<Posting> &list) {
+    QVector<TermInPage> pages;
+    for (const Posting &p : list) {
+        if (pages.isEmpty() || pages.last().file != p.file) {
+            TermInPage t = { p.file, 0, p.offset };
+            pages.append(t);
+        }
+        ++pages.last().tf;
+    }
+    return pages;
+}
+
+// Pages of several terms (sharing a prefix, a stem, or close in spelling),
+// combined as if they were one word.
+static QVector<TermInPage> mergePages(const QList<QVector<TermInPage> > &lists) {
+    QVector<TermInPage> all;
+    for (const QVector<TermInPage> &l : lists) all += l;
+    std::sort(all.begin(), all.end(), [](const TermInPage &x, const TermInPage &y) {
+        return x.file < y.file;
+    });
+    QVector<TermInPage> merged;
+    for (const TermInPage &t : all) {
+        if (!merged.isEmpty() && merged.last().file == t.file) {
+            merged.last().tf += t.tf;
+            merged.last().first = qMin(merged.last().first, t.first);
+        } else {
+            merged.append(t);
+        }
+    }
+    return merged;
+}
+
+static bool isQuote(QChar c) {
+    return c == '"' || c == QChar(0x201C) || c == QChar(0x201D);
+}
+
+// One term of a query: a word, the words of a quoted phrase, or a /regular
+// expression/.
+struct QueryTerm {
+    QList<QByteArray> words;
+    bool prefix = false;    // a word still being typed
+    int edits = 0;          // word~: indexed words this many edits away match
+    QString pattern;        // matched against the page text, case-insensitively
+};
+
+// Pages match a query if they match a term of every clause (terms joined by
+// OR), lie in one of the site: folders (if there are any) and in none of the
+// excluded ones, and match none of the excluded terms.
+struct Query {
+    QVector<QVector<QueryTerm> > all;
+    QVector<QueryTerm> none;
+    QStringList sites;          // "nt/john/": how the pages' relative paths start
+    QStringList excludedSites;
+    bool simple = true;         // words and phrases only
+    bool openPattern = false;   // a /pattern whose closing slash is still to come
+};
+
+// How many edits a misspelt word of length bytes may be from the words it finds.
+static int fuzzyEdits(int length) {
+    return length < 4 ? 0 : length < 8 ? 1 : 2;
+}
+
+// The case-folded words of text, and for each the edits a word~ (or ~N) allows.
+static void splitWords(const QString &text, QList<QByteArray> *words, QVector<int> *edits) {
+    const QByteArray q = text.toUtf8();
+    int count = -1;     // offset of the edit count after a ~, which isn't a word
+    SearchIndex::forEachWord(q.constData(), q.size(), [&](const char *w, int len, int offset) {
+        if (offset == count) return;
+        words->append(SearchIndex::normalizeWord(w, len));
+        edits->append(0);
+        const int end = offset + len;
+        if (end >= q.size() || q.at(end) != '~') return;
+        edits->last() = qMax(1, fuzzyEdits(len));
+        if (end + 1 < q.size() && q.at(end + 1) >= '1' && q.at(end + 1) <= '9') {
+            count = end + 1;
+            edits->last() = qMin(q.at(end + 1) - '0', int(SearchIndex::MaxEdits));
+        }
+    });
+}
+
+static QString siteFolder(const QString &value) {
+    QString folder = QDir::cleanPath(QDir::fromNativeSeparators(value));
+    while (folder.startsWith('/')) folder.remove(0, 1);
+    if (folder.isEmpty() || folder == ".") return QString();
+    return folder + '/';
+}
+
+// Words are ANDed; OR (or |) joins the terms either side of it, NOT (or a
+// leading -) excludes the next term, AND is ignored. Text in double quotes is
+// a phrase, in slashes a regular expression, and site:folder limits the pages.
+static Query parseQuery(const QString &text) {
+    Query query;
+    QList<QByteArray> seen;     // words already making a clause of their own
+    bool orNext = false;        // the next term joins the last clause
+    bool notNext = false;
+    bool prefixable = false;    // the last term read is a word that may be a prefix
+    auto add = [&](const QueryTerm &term, bool negated) {
+        if (negated) {
+            query.none.append(term);
+            query.simple = false;
+        } else if (orNext) {
+            query.all.last().append(term);
+            query.simple = false;
+        } else {
+            query.all.append(QVector<QueryTerm>() << term);
+        }
+        orNext = false;
+    };
+
+    const int n = text.size();
+    int i = 0;
+    while (i < n) {
+        if (text.at(i).isSpace()) {
+            ++i;
+            continue;
+        }
+        bool negated = notNext;
+        notNext = false;
+        prefixable = false;
+        if (text.at(i) == '-' && i + 1 < n && !text.at(i + 1).isSpace()) {
+            negated = true;
+            ++i;
+        }
+
+        if (isQuote(text.at(i))) {
+            // an unclosed quote still makes a phrase
+            int end = i + 1;
+            while (end < n && !isQuote(text.at(end))) ++end;
+            QueryTerm t;
+            QVector<int> edits;
+            splitWords(text.mid(i + 1, end - i - 1), &t.words, &edits);
+            if (!t.words.isEmpty()) add(t, negated);
+            i = end + 1;
+            continue;
+        }
+        if (text.at(i) == '/') {
+            int end = i + 1;
+            QueryTerm t;
+            while (end < n && text.at(end) != '/') {
+                if (text.at(end) == '\\' && end + 1 < n) t.pattern += text.at(end++);    // \/ stays escaped
+                t.pattern += text.at(end++);
+            }
+            if (!t.pattern.isEmpty()) {
+                add(t, negated);
+                query.simple = false;
+            }
+            if (end >= n) query.openPattern = true;
+            i = end + 1;
+            continue;
+        }
+
+        int end = i;
+        while (end < n && !text.at(end).isSpace() && !isQuote(text.at(end))) ++end;
+        const QString token = text.mid(i, end - i);
+        i = end;
+        if (!negated && (token == "OR" || token == "|")) {
+            orNext = !query.all.isEmpty();
+            continue;
+        }
+        if (!negated && token == "AND") continue;
+        if (!negated && token == "NOT") {
+            notNext = true;
+            continue;
+        }
+        if (token.startsWith("site:", Qt::CaseInsensitive)) {
+            const QString folder = siteFolder(token.mid(5));
+            if (!folder.isEmpty()) (negated ? query.excludedSites : query.sites).append(folder);
+            query.simple = false;
+            orNext = false;
+            continue;
+        }
+        QList<QByteArray> words;
+        QVector<int> edits;
+        splitWords(token, &words, &edits);
+        for (int w = 0; w < words.size(); ++w) {
+            const bool own = !negated && !orNext;
+            if (own && seen.contains(words.at(w))) continue;
+            if (own) seen.append(words.at(w));
+            QueryTerm t;
+            t.words.append(words.at(w));
+            t.edits = edits.at(w);
+            add(t, negated);
+            prefixable = !negated && t.edits == 0 && w == words.size() - 1;
+        }
+    }
+    // the last word is a prefix ("lig" finds "light") until it is followed by a space
+    if (prefixable && !text.at(n - 1).isSpace()) query.all.last().last().prefix = true;
+    return query;
+}
+
+bool SearchIndex::isSimpleQuery(const QString &query) {
+    return parseQuery(query).simple;
+}
+
+bool SearchIndex::hasOpenPattern(const QString &query) {
+    return parseQuery(query).openPattern;
+}
+
+QString SearchIndex::queryError(const QString &query) {
+    const Query q = parseQuery(query);
+    QVector<QueryTerm> terms = q.none;
+    for (const QVector<QueryTerm> &clause : q.all) terms += clause;
+    for (const QueryTerm &term : terms) {
+        if (term.pattern.isEmpty()) continue;
+        const QRegularExpression re(term.pattern);
+        if (!re.isValid()) return QString("/%1/: %2").arg(term.pattern, re.errorString());
+    }
+    return QString();
+}
+
+QList<QByteArray> SearchIndex::queryWords(const QString &query) {
+    QList<QByteArray> words;
+    for (const QVector<QueryTerm> &clause : parseQuery(query).all) {
+        for (const QueryTerm &term : clause) {
+            for (const QByteArray &word : term.words) {
+                if (!words.contains(word)) words.append(word);
+            }
+        }
+    }
+    return words;
+}
+
+// Where the group, class or {...} opened at pattern[open] is closed, or the
+// pattern's size.
+static int closingAt(const QString &pattern, int open) {
+    const QChar opening = pattern.at(open);
+    const QChar close = opening == '(' ? ')' : opening == '[' ? ']' : '}';
+    int depth = 0;
+    for (int i = open; i < pattern.size(); ++i) {
+        const QChar c = pattern.at(i);
+        if (c == '\\') {
+            ++i;
+        } else if (opening == '[') {
+            // nothing nests in a class, and a ] right after [ or [^ is literal
+            if (c == ']' && i > open + 1 && !(i == open + 2 && pattern.at(open + 1) == '^')) return i;
+        } else if (c == '[') {
+            i = closingAt(pattern, i);
+        } else if (c == opening) {
+            ++depth;
+        } else if (c == close && --depth == 0) {
+            return i;
+        }
+    }
+    return pattern.size();
+}
+
+// The runs of three or more word characters a pattern can't match without,
+// case-folded: "lord" and "god" of /lord\s+god/. Whatever is optional,
+// repeated zero times, in a group or in a class is left out, and a pattern
+// with alternatives outside groups requires nothing.
+static QList<QByteArray> requiredLiterals(const QString &pattern) {
+    QList<QByteArray> literals;
+    QString run;
+    auto endRun = [&]() {
+        if (run.size() >= 3) literals.append(run.toCaseFolded().toUtf8());
+        run.clear();
+    };
+    const int n = pattern.size();
+    for (int i = 0; i < n; ++i) {
+        const QChar c = pattern.at(i);
+        if (c == '|') return QList<QByteArray>();
+        if (c == '\\') {
+            // an escape: a class (\w), an assertion (\b), a character (\., \x41)
+            endRun();
+            if (++i >= n) break;
+            const QChar e = pattern.at(i);
+            if ((e == 'p' || e == 'P' || e == 'x') && i + 1 < n && pattern.at(i + 1) == '{') {
+                i = closingAt(pattern, i + 1);
+            } else if (e == 'x') {
+                i += 2;
+            } else if (e == 'Q') {
+                const int quoted = pattern.indexOf("\\E", i);
+                i = quoted < 0 ? n : quoted + 1;
+            }
+            continue;
+        }
+        if (c == '(' || c == '[') {
+            endRun();
+            i = closingAt(pattern, i);
+        } else if (c == '*' || c == '?') {
+            run.chop(1);
+            endRun();
+        } else if (c == '{') {
+            run.chop(1);
+            endRun();
+            i = closingAt(pattern, i);
+        } else if (c.isLetterOrNumber()) {
+            run += c;
+        } else {
+            endRun();   // +, ., anchors and other characters, which words don't have
+        }
+    }
+    endRun();
+    return literals;
+}
+
+// Pages where the words of a phrase appear one after the other, from the
+// word positions in the postings: tf counts the occurrences.
+static QVector<TermInPage> phrasePages(const SearchIndex &index, const QList<QByteArray> &words) {
+    QVector<QVector<Posting> > lists;
+    for (const QByteArray &word : words) {
+        lists.append(index.lookup(word));
+        if (lists.last().isEmpty()) return QVector<TermInPage>();
+    }
+    QVector<TermInPage> pages;
+    QVector<int> at(lists.size(), 0);       // each list's first posting in the current page
+    const QVector<Posting> &head = lists.at(0);
+    for (int i = 0; i < head.size(); ) {
+        const quint32 file = head.at(i).file;
+        int end = i;
+        while (end < head.size() && head.at(end).file == file) ++end;
+        bool inPage = true;
+        for (int k = 1; k < lists.size() && inPage; ++k) {
+            const QVector<Posting> &l = lists.at(k);
+            while (at[k] < l.size() && l.at(at[k]).file < file) ++at[k];
+            inPage = at[k] < l.size() && l.at(at[k]).file == file;
+        }
+        if (inPage) {
+            // positions grow through a page's postings, so one cursor per word will do
+            TermInPage t = { file, 0, 0 };
+            QVector<int> cursor = at;
+            for (int j = i; j < end; ++j) {
+                const quint32 position = head.at(j).position;
+                bool match = true;
+                for (int k = 1; k < lists.size() && match; ++k) {
+                    const QVector<Posting> &l = lists.at(k);
+                    int &c = cursor[k];
+                    while (c < l.size() && l.at(c).file == file && l.at(c).position < position + quint32(k)) ++c;
+                    match = c < l.size() && l.at(c).file == file && l.at(c).position == position + quint32(k);
+                }
+                if (!match) continue;
+                if (t.tf == 0) t.first = head.at(j).offset;
+                ++t.tf;
+            }
+            if (t.tf > 0) pages.append(t);
+        }
+        i = end;
+    }
+    return pages;
+}
+
+static QVector<TermInPage> pagesWithAny(const SearchIndex &index, const QList<QByteArray> &words) {
+    QList<QVector<TermInPage> > lists;
+    for (const QByteArray &word : words) lists.append(groupByPage(index.lookup(word)));
+    return mergePages(lists);
+}
+
+// Pages containing a term: a word (or, with flags, the words of its stem),
+// any indexed word starting with a prefix, the words close to a word~, or a
+// phrase. *approximate is set when words were matched by their spelling.
+static QVector<TermInPage> pagesWith(const SearchIndex &index, const QueryTerm &term, int flags,
+                                     bool *approximate = nullptr) {
+    if (term.words.size() > 1) return phrasePages(index, term.words);
+    const QByteArray &word = term.words.first();
+    if (term.edits > 0) {
+        if (approximate) *approximate = true;
+        return pagesWithAny(index, index.similarTerms(word, term.edits));
+    }
+    QVector<TermInPage> pages;
+    if (term.prefix) pages = pagesWithAny(index, index.termsWithPrefix(word));
+    else if (flags & SearchIndex::Stemmed) pages = pagesWithAny(index, index.termsWithStem(word));
+    else pages = groupByPage(index.lookup(word));
+    // a word (or a word typed out) the index doesn't have: the closest it has
+    if (pages.isEmpty() && (flags & SearchIndex::Fuzzy) && fuzzyEdits(word.size()) > 0) {
+        if (approximate) *approximate = true;
+        pages = pagesWithAny(index, index.similarTerms(word, fuzzyEdits(word.size())));
+    }
+    return pages;
+}
+
+void SearchIndex::Statistics::add(const Statistics &other) {
+    pages += other.pages;
+    words += other.words;
+    if (df.size() < other.df.size()) df.resize(other.df.size());
+    for (int i = 0; i < other.df.size(); ++i) df[i] += other.df.at(i);
+}
+
+static QVector<quint32> intersection(const QVector<quint32> &x, const QVector<quint32> &y) {
+    QVector<quint32> both;
+    std::set_intersection(x.constBegin(), x.constEnd(), y.constBegin(), y.constEnd(), std::back_inserter(both));
+    return both;
+}
+
+static QVector<quint32> filesOf(const QVector<SearchHit> &hits) {
+    QVector<quint32> ids;
+    ids.reserve(hits.size());
+    for (const SearchHit &h : hits) ids.append(h.file);
+    return ids;
+}
+
+bool SearchIndex::pageText(quint32 id, QByteArray *text) const {
+    const IndexedFile &f = files.at(int(id));
+    SitePage page;
+    page.path = absolutePath(id);
+    page.size = f.size;
+    page.mtime = f.mtime;
+    if (pageTexts && pageTexts->text(page, text)) return true;
+    return readPageText(page.path, text);
+}
+
+QVector<quint32> SearchIndex::patternCandidates(const QString &pattern) const {
+    QVector<quint32> candidates;
+    bool pruned = false;
+    for (const QByteArray &literal : requiredLiterals(pattern)) {
+        const QList<QByteArray> terms = dictionary.containing(literal, MaxPatternTerms + 1);
+        if (terms.size() > MaxPatternTerms) continue;      // too common to rule much out
+        QVector<quint32> pages;
+        for (const QByteArray &term : terms) {
+            for (const TermInPage &t : groupByPage(lookup(term))) pages.append(t.file);
+        }
+        std::sort(pages.begin(), pages.end());
+        pages.erase(std::unique(pages.begin(), pages.end()), pages.end());
+        candidates = pruned ? intersection(candidates, pages) : pages;
+        pruned = true;
+        if (candidates.isEmpty()) break;
+    }
+    if (!pruned) {
+        candidates.resize(files.size());
+        for (int i = 0; i < files.size(); ++i) candidates[i] = quint32(i);
+    }
+    return candidates;
+}
+
+QVector<SearchHit> SearchIndex::matchPattern(const QString &pattern, const QVector<quint32> &pages) const {
+    ScopedTimer timer("pattern match");
+    const int n = pages.size();
+    QVector<SearchHit> found;
+    if (n == 0) return found;
+
+    // pages are read and matched on all cores, like the pages of update()
+    const SearchHit none = { 0, 0, 0, 0 };
+    QVector<SearchHit> matched(n, none);
+    QAtomicInt next(0);
+    auto work = [&]() {
+        const QRegularExpression re(pattern, QRegularExpression::CaseInsensitiveOption
+                                    | QRegularExpression::UseUnicodePropertiesOption);
+        QByteArray utf8;
+        for (int i = next.fetchAndAddRelaxed(1); i < n; i = next.fetchAndAddRelaxed(1)) {
+            if (!pageText(pages.at(i), &utf8)) continue;
+            const QString text = QString::fromUtf8(utf8);
+            SearchHit &hit = matched[i];
+            hit.file = pages.at(i);
+            QRegularExpressionMatchIterator it = re.globalMatch(text);
+            while (it.hasNext()) {
+                const QRegularExpressionMatch m = it.next();
+                if (hit.hits == 0) hit.offset = quint32(text.leftRef(m.capturedStart()).toUtf8().size());
+                ++hit.hits;
+            }
+        }
+    };
+    const int workers = lowMemoryMode() ? 1 : qBound(1, threads > 0 ? threads : QThread::idealThreadCount(), n);
+    if (workers == 1) {
+        work();
+    } else {
+        QThreadPool pool;
+        pool.setMaxThreadCount(workers);
+        for (int w = 0; w < workers; ++w) QtConcurrent::run(&pool, work);
+        pool.waitForDone();
+    }
+    for (const SearchHit &hit : matched) {
+        if (hit.hits > 0) found.append(hit);
+    }
+    PerfStats::count("pages matched", n);
+    return found;
+}
+
+// The pages a query may list: those in within (sorted ids) if given, in one
+// of its site: folders if it has any, in none of the excluded folders, and
+// without its excluded words and phrases (patterns are left for later).
+static QVector<quint32> queryScope(const SearchIndex &index, const Query &query, const QVector<quint32> *within,
+                                   int flags) {
+    auto inFolder = [](const QString &path, const QStringList &folders) -> bool {
+        for (const QString &folder : folders) {
+            if (path.startsWith(folder, Qt::CaseInsensitive)) return true;
+        }
+        return false;
+    };
+    QVector<quint32> scope;
+    const int n = within ? within->size() : index.fileCount();
+    for (int i = 0; i < n; ++i) {
+        const quint32 id = within ? within->at(i) : quint32(i);
+        const QString &path = index.file(id).path;
+        if (!query.sites.isEmpty() && !inFolder(path, query.sites)) continue;
+        if (inFolder(path, query.excludedSites)) continue;
+        scope.append(id);
+    }
+    for (const QueryTerm &term : query.none) {
+        if (!term.pattern.isEmpty()) continue;
+        // an excluded word excludes its stem, but not whatever it might be a misspelling of
+        QVector<quint32> excluded;
+        for (const TermInPage &t : pagesWith(index, term, flags & ~SearchIndex::Fuzzy)) excluded.append(t.file);
+        QVector<quint32> kept;
+        std::set_difference(scope.constBegin(), scope.constEnd(), excluded.constBegin(), excluded.constEnd(),
+                            std::back_inserter(kept));
+        scope = kept;
+    }
+    return scope;
+}
+
+SearchIndex::Statistics SearchIndex::statistics(const QString &query, int flags) const {
+    Statistics stats;
+    stats.pages = files.size();
+    for (const IndexedFile &f : files) stats.words += f.words;
+    for (const QVector<QueryTerm> &clause : parseQuery(query).all) {
+        for (const QueryTerm &term : clause) {
+            // a pattern counts the pages that may match it, which needs no page text
+            stats.df.append(term.pattern.isEmpty() ? pagesWith(*this, term, flags).size()
+                                                   : patternCandidates(term.pattern).size());
+        }
+    }
+    return stats;
+}
+
+QVector<SearchHit> SearchIndex::search(const QString &text, const QVector<quint32> *within,
+                                       const Statistics *stats, int flags, bool *approximate) const {
+    ScopedTimer timer("index search");
+    if (approximate) *approximate = false;
+    const Query query = parseQuery(text);
+    QVector<SearchHit> hits;
+    if (files.isEmpty() || (query.all.isEmpty() && query.sites.isEmpty())) return hits;
+
+    double totalWords = 0;
+    if (stats) totalWords = stats->words;
+    else for (const IndexedFile &f : files) totalWords += f.words;
+    const double n = stats ? qMax(stats->pages, double(files.size())) : files.size();
+    const double avgWords = qMax(1.0, totalWords / n);
+    const double k1 = 1.2, b = 0.75;
+
+    const bool everything = !within && query.sites.isEmpty() && query.excludedSites.isEmpty() && query.none.isEmpty();
+    QVector<quint32> scope;
+    if (!everything) scope = queryScope(*this, query, within, flags);
+
+    // Clauses the index answers on its own go first, so a pattern is only
+    // matched on the pages they leave. Terms are numbered in query order,
+    // as statistics() counts them.
+    QVector<int> order, firstTerm;
+    int terms = 0;
+    for (int c = 0; c < query.all.size(); ++c) {
+        firstTerm.append(terms);
+        terms += query.all.at(c).size();
+        bool pattern = false;
+        for (const QueryTerm &term : query.all.at(c)) pattern = pattern || !term.pattern.isEmpty();
+        if (pattern) order.append(c);
+        else order.prepend(c);
+    }
+
+    bool started = false;
+    for (int c : order) {
+        const QVector<QueryTerm> &clause = query.all.at(c);
+        QVector<SearchHit> matched;
+        for (int a = 0; a < clause.size(); ++a) {
+            const QueryTerm &term = clause.at(a);
+            QVector<TermInPage> pages;
+            double df;
+            if (term.pattern.isEmpty()) {
+                pages = pagesWith(*this, term, flags, approximate);
+                df = pages.size();
+            } else {
+                QVector<quint32> candidates = patternCandidates(term.pattern);
+                df = candidates.size();
+                if (started) candidates = intersection(candidates, filesOf(hits));
+                else if (!everything) candidates = intersection(candidates, scope);
+                for (const SearchHit &h : matchPattern(term.pattern, candidates)) {
+                    TermInPage t = { h.file, h.hits, h.offset };
+                    pages.append(t);
+                }
+            }
+            const int number = firstTerm.at(c) + a;
+            if (stats && number < stats->df.size()) df = qMax(stats->df.at(number), df);
+            const double idf = std::log(1.0 + (n - df + 0.5) / (df + 0.5));
+            for (const TermInPage &t : pages) {
+                const double dl = files.at(int(t.file)).words;
+                const double tf = t.tf;
+                SearchHit hit;
+                hit.file = t.file;
+                hit.score = float(idf * tf * (k1 + 1) / (tf + k1 * (1 - b + b * dl / avgWords)));
+                hit.hits = t.tf;
+                hit.offset = t.first;
+                matched.append(hit);
+            }
+        }
+        // OR: a page scores for every term of the clause it has
+        std::sort(matched.begin(), matched.end(), [](const SearchHit &x, const SearchHit &y) {
+            return x.file < y.file;
+        });
+        QVector<SearchHit> clauseHits;
+        for (const SearchHit &h : matched) {
+            if (!clauseHits.isEmpty() && clauseHits.last().file == h.file) {
+                clauseHits.last().score += h.score;
+                clauseHits.last().hits += h.hits;
+                clauseHits.last().offset = qMin(clauseHits.last().offset, h.offset);
+            } else {
+                clauseHits.append(h);
+            }
+        }
+
+        // AND: merge with the pages matched by the clauses before (or the scope)
+        QVector<SearchHit> merged;
+        int h = 0;
+        int s = 0;
+        for (const SearchHit &hit : clauseHits) {
+            if (started) {
+                while (h < hits.size() && hits.at(h).file < hit.file) ++h;
+                if (h == hits.size()) break;
+                if (hits.at(h).file != hit.file) continue;
+                SearchHit sum = hits.at(h);
+                sum.score += hit.score;
+                sum.hits += hit.hits;
+                merged.append(sum);
+            } else {
+                if (!everything) {
+                    while (s < scope.size() && scope.at(s) < hit.file) ++s;
+                    if (s == scope.size()) break;
+                    if (scope.at(s) != hit.file) continue;
+                }
+                merged.append(hit);
+            }
+        }
+        hits = merged;
+        started = true;
+        if (hits.isEmpty()) return hits;
+    }
+
+    if (!started) {
+        // site: alone lists the folders' pages
+        for (quint32 id : scope) {
+            SearchHit hit = { id, 0, 0, 0 };
+            hits.append(hit);
+        }
+    }
+    for (const QueryTerm &term : query.none) {
+        if (term.pattern.isEmpty() || hits.isEmpty()) continue;
+        const QVector<quint32> excluded = filesOf(matchPattern(term.pattern, filesOf(hits)));
+        QVector<SearchHit> kept;
+        int e = 0;
+        for (const SearchHit &hit : hits) {
+            while (e < excluded.size() && excluded.at(e) < hit.file) ++e;
+            if (e < excluded.size() && excluded.at(e) == hit.file) continue;
+            kept.append(hit);
+        }
+        hits = kept;
+    }
+
+    std::stable_sort(hits.begin(), hits.end(), [](const SearchHit &x, const SearchHit &y) {
+        return x.score > y.score;
+    });
+    return hits;
+}
@@ -0,0 +1,251 @@
+#ifndef SEARCHINDEX_H
+#define SEARCHINDEX_H
+
+/*
+Persistent inverted index used by the "All subpages (folder)" search scope.
+
+Every word of the visible text of the site's *.html / *.htm files (see
+htmltext.h) is case-folded and mapped to a posting list of (file, offset,
+position) triples, the offset being a byte position in the page's extracted
+UTF-8 text and the position the word's number in the page, so a quoted
+phrase is matched from the postings alone. The index is stored beside the
+book in <siteDir>/.htmlbooks/index, and each indexed file keeps a size + mtime
+fingerprint so a reopened book can tell which pages (if any) need re-indexing
+without reading the others.
+
+Books of chapters and verses (bibles and the like) also get a table of
+references: a page whose <title> or <h1> reads "John 3" is chapter 3 of
+John, and its anchors named like verses ("V16", "16", "3:16", "c3v16") are
+its verses, so "John 3:16" (or "gen 1.1", "1 Cor 13") is looked up in one hash
+probe rather than searched for.
+
+The sorted list of terms (termdictionary.h) answers prefix lookups for the
+word being typed, and, when a search asks for it, finds the indexed words
+within a few edits of a misspelt one ("Nebuchadnezar") or sharing a word's
+stem ("blessed" finds "blesses", "blessing").
+
+Queries combine words with OR and NOT, limit pages to subfolders (site:) and
+match regular expressions against the page text. A pattern is only matched
+on pages that could hold it: the words it can't match without are looked up
+in the dictionary first, and the other clauses of the query are answered
+from the index before any page's text is read.
+
+A packed book (bookarchive.h) carries the index it was packed with as one of
+its entries; it is read from there and never written back.
+*/
+
+#include <QByteArray>
+#include <QHash>
+#include <QSharedPointer>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include "htmltext.h"
+#include "pagetextcache.h"
+#include "sitemanifest.h"
+#include "termdictionary.h"
+
+struct IndexedFile {
+    QString path;       // relative to the site directory
+    qint64 size = 0;
+    qint64 mtime = 0;   // msecs since epoch
+    quint32 words = 0;  // number of indexed words in the page
+};
+
+struct SearchHit {
+    quint32 file;
+    float score;        // BM25, higher is better
+    quint32 hits;       // occurrences of all query words in the page
+    quint32 offset;     // first occurrence of the first query word
+};
+
+struct Posting {
+    quint32 file;       // index into SearchIndex::files
+    quint32 offset;     // byte offset of the word in the page's extracted text
+    quint32 position;   // the word's number in the page, 0 for the first
+};
+
+// Where a chapter or verse is: a page, and the anchor (if any) to scroll to.
+struct VerseRef {
+    quint32 file;
+    quint32 offset;     // in the page's extracted text
+    QByteArray anchor;  // the element's id or name, empty for a whole page
+};
+
+class SearchIndex {
+public:
+    SearchIndex() {}
+    explicit SearchIndex(const QString &siteDir) : dir(siteDir) {}
+
+    static QString indexFilePath(const QString &siteDir);
+
+    QString siteDir() const { return dir; }
+    bool isEmpty() const { return files.isEmpty(); }
+    int fileCount() const { return files.size(); }
+    int termCount() const { return postings.size(); }
+    int referenceCount() const { return references.size(); }
+    const IndexedFile &file(quint32 id) const { return files.at(int(id)); }
+    QString absolutePath(quint32 id) const;
+
+    // Threads used to read and extract pages in build() and update(); 0 (the
+    // default) uses one per core.
+    void setThreadCount(int n) { threads = qMax(0, n); }
+
+    // (Re)build the whole index from the given pages.
+    void build(const QVector<SitePage> &pages, PageTextCache::Builder *texts = nullptr);
+
+    // Bring the index in line with pages: drop removed pages and re-index only
+    // pages that are new or whose size/mtime changed. Returns the number of
+    // pages added, removed or re-indexed, each once (0 means the index was up
+    // to date). A page that can't be read is left out, and not read again
+    // until its size or mtime changes.
+    // With texts, the extracted text of every page goes into a new text cache
+    // (pagetextcache.h), and pages the old cache lacks count as changed.
+    int update(const QVector<SitePage> &pages, PageTextCache::Builder *texts = nullptr);
+
+    bool load();
+    bool save() const;
+
+    // Postings of one (already normalized) term, sorted by file then offset.
+    QVector<Posting> lookup(const QByteArray &term) const { return postings.value(term); }
+
+    // Pages containing every word of query, best BM25 score first. The last
+    // word is a prefix ("lig" finds "light", "lightning") unless the query ends
+    // in whitespace. Words in double quotes must appear in that order, one
+    // after the other ("in the beginning"); a phrase counts as one term. A
+    // word followed by ~ ("nebuchadnezar~", "jeroboam~2") matches the indexed
+    // words within 1 or 2 edits of it.
+    //
+    // Terms either side of OR (or |) match as one: "moses OR aaron". NOT or a
+    // leading - excludes the pages with a term: "david -goliath". A term in
+    // slashes is a regular expression matched case-insensitively against the
+    // page text ("/sons? of (god|men)/"), counting every match as a hit.
+    // site:folder keeps the pages below a folder of the book (several are
+    // ORed, -site: excludes one); on its own it lists them. There are no
+    // parentheses: OR binds tighter than the implicit AND.
+    //
+    // With within (sorted file ids), only those pages are considered; searches
+    // that just append characters to a simple query (words and phrases, see
+    // isSimpleQuery()) pass the previous result's pages and narrow instead of
+    // starting over.
+    //
+    // With Stemmed in flags, a word matches every indexed word of the same
+    // stem; with Fuzzy, a word the index doesn't have matches the words
+    // closest to it (1 edit for words of 4 to 7 letters, 2 for longer ones).
+    // *approximate (when given) is set if any word was matched that way or
+    // with ~; appending characters to such a query can find pages its
+    // results lack, so they can't be narrowed.
+    //
+    // Scores are computed against stats when given, else against this index
+    // alone; a library (library.h) passes the sums over all its books so the
+    // scores of different indexes can be merged.
+    struct Statistics {
+        double pages = 0;
+        double words = 0;       // indexed words in all pages
+        QVector<double> df;     // pages containing each query word
+        void add(const Statistics &other);
+    };
+    enum MatchFlag { Exact = 0, Stemmed = 1, Fuzzy = 2 };
+    QVector<SearchHit> search(const QString &query, const QVector<quint32> *within = nullptr,
+                              const Statistics *stats = nullptr, int flags = Exact,
+                              bool *approximate = nullptr) const;
+    Statistics statistics(const QString &query, int flags = Exact) const;
+
+    // True if query is words and phrases only, without OR, NOT, site: or patterns.
+    static bool isSimpleQuery(const QString &query);
+    // True if query has a /pattern without its closing slash, which is
+    // searched as it stands but is likely still being typed.
+    static bool hasOpenPattern(const QString &query);
+    // What is wrong with query's patterns, or an empty string.
+    static QString queryError(const QString &query);
+
+    // Patterns are matched against the text in cache, for the pages whose size
+    // and mtime it has, instead of reading the pages again.
+    void setPageTexts(const QSharedPointer<PageTextCache> &cache) { pageTexts = cache; }
+    // The text of page id: from that cache when it has the page as indexed,
+    // else read from the page. Cached text belongs to the cache's mapping,
+    // which this index keeps alive.
+    bool pageText(quint32 id, QByteArray *text) const;
+    static const int MaxPatternTerms = 1024;
+
+    // The chapter or verse a reference such as "John 3:16", "Gen 1.1" or
+    // "Psalm 23" names. Book names may be abbreviated to any unambiguous
+    // prefix. False if query isn't a reference or the book doesn't have it.
+    bool findReference(const QString &query, VerseRef *ref) const;
+
+    // Up to limit indexed terms starting with prefix, in sorted order.
+    QList<QByteArray> termsWithPrefix(const QByteArray &prefix, int limit = MaxPrefixTerms) const {
+        return dictionary.withPrefix(prefix, limit);
+    }
+    static const int MaxPrefixTerms = 256;
+
+    // Up to limit indexed terms within maxEdits edits of word, closest first.
+    QList<QByteArray> similarTerms(const QByteArray &word, int maxEdits, int limit = MaxFuzzyTerms) const {
+        return dictionary.similar(word, qMin(maxEdits, int(MaxEdits)), limit);
+    }
+    static const int MaxFuzzyTerms = 64;
+    static const int MaxEdits = 2;
+
+    // The indexed terms with the same stem as word (see stemmer.h).
+    QList<QByteArray> termsWithStem(const QByteArray &word) const { return dictionary.withStem(word); }
+
+    // The case-folded words of a query, as they are looked up in the index.
+    static QList<QByteArray> queryWords(const QString &query);
+
+    // Split UTF-8 text into words: runs of letters, digits and combining marks.
+    // f(const char *word, int length, int offset) is called for every word.
+    template <typename F>
+    static void forEachWord(const char *data, int size, F f) {
+        int i = 0, start = -1;
+        while (i < size) {
+            uchar c = uchar(data[i]);
+            bool word;
+            int n = 1;
+            if (c < 0x80) word = isAsciiWordByte(c);
+            else n = utf8CharAt(data + i, size - i, &word);
+            if (word) {
+                if (start < 0) start = i;
+            } else if (start >= 0) {
+                f(data + start, i - start, start);
+                start = -1;
+            }
+            i += n;
+        }
+        if (start >= 0) f(data + start, size - start, start);
+    }
+
+    static QByteArray normalizeWord(const char *word, int length);
+
+private:
+    static bool isAsciiWordByte(uchar c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+    }
+    // Byte length of the non-ASCII character at p (1 if malformed).
+    static int utf8CharAt(const char *p, int size, bool *word);
+
+    void addPage(quint32 id, const QByteArray &text);
+    void addReferences(quint32 id, const PageStructure &structure);
+    void dropFiles(const QVector<bool> &drop);
+    void sortDictionary();
+    void sortBooks();
+
+    // Sorted ids of the pages holding (a term containing) every literal word
+    // pattern requires, or of every page if it requires none that helps.
+    QVector<quint32> patternCandidates(const QString &pattern) const;
+    // The pages matching pattern, of the given sorted ids, with the number of
+    // matches and the (UTF-8) offset of the first.
+    QVector<SearchHit> matchPattern(const QString &pattern, const QVector<quint32> &pages) const;
+
+    QString dir;
+    int threads = 0;
+    QVector<IndexedFile> files;
+    QHash<QString, IndexedFile> unreadable;     // by path: pages update() couldn't read
+    QHash<QByteArray, QVector<Posting> > postings;
+    TermDictionary dictionary;          // all terms, for prefix, fuzzy and stem lookups
+    QHash<QByteArray, VerseRef> references;     // "john 3:16", "john 3" (chapters)
+    QVector<QByteArray> books;          // book names in references, sorted
+    QSharedPointer<PageTextCache> pageTexts;
+};
+
+#endif // SEARCHINDEX_H
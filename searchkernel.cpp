@@ -0,0 +1,161 @@
+#include "searchkernel.h"
+
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define HTMLBOOKS_SSE2
+#  include <emmintrin.h>
+#  if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#    define HTMLBOOKS_AVX2
+#    include <immintrin.h>
+#  endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#  define HTMLBOOKS_NEON
+#  include <arm_neon.h>
+#endif
+
+typedef int (*SearchKernel)(const char *text, int size, const char *needle, int n);
+
+static inline unsigned char foldAscii(unsigned char c) {
+    return (c >= 'A' && c <= 'Z') ? (unsigned char)(c + ('a' - 'A')) : c;
+}
+
+// needle is already folded
+static inline bool equalsFolded(const char *text, const char *needle, int n) {
+    for (int i = 0; i < n; ++i) {
+        if (foldAscii((unsigned char)text[i]) != (unsigned char)needle[i]) return false;
+    }
+    return true;
+}
+
+static inline int countTrailingZeros(unsigned int v) {
+#if defined(__GNUC__)
+    return __builtin_ctz(v);
+#else
+    int n = 0;
+    while (!(v & 1u)) { v >>= 1; ++n; }
+    return n;
+#endif
+}
+
+static int searchScalar(const char *text, int size, const char *needle, int n) {
+    const unsigned char first = (unsigned char)needle[0];
+    for (int i = 0; i + n <= size; ++i) {
+        if (foldAscii((unsigned char)text[i]) == first && equalsFolded(text + i + 1, needle + 1, n - 1))
+            return i;
+    }
+    return -1;
+}
+
+#ifdef HTMLBOOKS_SSE2
+static int searchSse2(const char *text, int size, const char *needle, int n) {
+    const __m128i fold = _mm_set1_epi8(0x20);
+    const __m128i first = _mm_set1_epi8(char(needle[0] | 0x20));
+    const __m128i last = _mm_set1_epi8(char(needle[n - 1] | 0x20));
+    int i = 0;
+    for (; i + n - 1 + 16 <= size; i += 16) {
+        __m128i a = _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(text + i)), fold);
+        __m128i b = _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(text + i + n - 1)), fold);
+        unsigned int mask = unsigned(_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last))));
+        while (mask) {
+            int pos = i + countTrailingZeros(mask);
+            if (equalsFolded(text + pos, needle, n)) return pos;
+            mask &= mask - 1;
+        }
+    }
+    int rest = searchScalar(text + i, size - i, needle, n);
+    return rest < 0 ? -1 : i + rest;
+}
+#endif
+
+#ifdef HTMLBOOKS_AVX2
+__attribute__((target("avx2")))
+static int searchAvx2(const char *text, int size, const char *needle, int n) {
+    const __m256i fold = _mm256_set1_epi8(0x20);
+    const __m256i first = _mm256_set1_epi8(char(needle[0] | 0x20));
+    const __m256i last = _mm256_set1_epi8(char(needle[n - 1] | 0x20));
+    int i = 0;
+    for (; i + n - 1 + 32 <= size; i += 32) {
+        __m256i a = _mm256_or_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(text + i)), fold);
+        __m256i b = _mm256_or_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(text + i + n - 1)), fold);
+        unsigned int mask = unsigned(_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last))));
+        while (mask) {
+            int pos = i + countTrailingZeros(mask);
+            if (equalsFolded(text + pos, needle, n)) return pos;
+            mask &= mask - 1;
+        }
+    }
+    int rest = searchSse2(text + i, size - i, needle, n);
+    return rest < 0 ? -1 : i + rest;
+}
+#endif
+
+#ifdef HTMLBOOKS_NEON
+static int searchNeon(const char *text, int size, const char *needle, int n) {
+    const uint8x16_t fold = vdupq_n_u8(0x20);
+    const uint8x16_t first = vdupq_n_u8((unsigned char)(needle[0] | 0x20));
+    const uint8x16_t last = vdupq_n_u8((unsigned char)(needle[n - 1] | 0x20));
+    int i = 0;
+    for (; i + n - 1 + 16 <= size; i += 16) {
+        uint8x16_t a = vorrq_u8(vld1q_u8(reinterpret_cast<const uint8_t *>(text + i)), fold);
+        uint8x16_t b = vorrq_u8(vld1q_u8(reinterpret_cast<const uint8_t *>(text + i + n - 1)), fold);
+        uint8x16_t eq = vandq_u8(vceqq_u8(a, first), vceqq_u8(b, last));
+        // narrow to one nibble per byte so the mask fits in 64 bits
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+        while (mask) {
+#if defined(__GNUC__)
+            int bit = __builtin_ctzll(mask);
+#else
+            int bit = 0;
+            while (!((mask >> bit) & 1u)) ++bit;
+#endif
+            int pos = i + bit / 4;
+            if (equalsFolded(text + pos, needle, n)) return pos;
+            mask &= ~(uint64_t(0xF) << (bit & ~3));
+        }
+    }
+    int rest = searchScalar(text + i, size - i, needle, n);
+    return rest < 0 ? -1 : i + rest;
+}
+#endif
+
+static SearchKernel selectKernel(const char **name) {
+#ifdef HTMLBOOKS_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        *name = "avx2";
+        return searchAvx2;
+    }
+#endif
+#if defined(HTMLBOOKS_SSE2)
+    *name = "sse2";
+    return searchSse2;
+#elif defined(HTMLBOOKS_NEON)
+    *name = "neon";
+    return searchNeon;
+#else
+    *name = "scalar";
+    return searchScalar;
+#endif
+}
+
+static const char *kernelNameStorage = "scalar";
+static const SearchKernel kernel = selectKernel(&kernelNameStorage);
+
+const char *CaseInsensitiveMatcher::kernelName() {
+    return kernelNameStorage;
+}
+
+void CaseInsensitiveMatcher::setPattern(const QByteArray &needle) {
+    folded = needle;
+    for (int i = 0; i < folded.size(); ++i) folded[i] = char(foldAscii((unsigned char)folded.at(i)));
+}
+
+int CaseInsensitiveMatcher::indexIn(const char *text, int size, int from) const {
+    const int n = folded.size();
+    if (from < 0) from = 0;
+    if (n == 0) return from <= size ? from : -1;
+    if (size - from < n) return -1;
+    int pos = kernel(text + from, size - from, folded.constData(), n);
+    return pos < 0 ? -1 : from + pos;
+}
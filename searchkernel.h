@@ -0,0 +1,40 @@
+#ifndef SEARCHKERNEL_H
+#define SEARCHKERNEL_H
+
+/*
+Case-insensitive substring search over UTF-8 text.
+
+Like QByteArrayMatcher, but ASCII letters match regardless of case (other
+bytes, including UTF-8 sequences, must match exactly). Candidate positions are
+found 16 or 32 bytes at a time by comparing the first and last byte of the
+needle against the haystack (the "SIMD-friendly Rabin-Karp" filter), with both
+sides folded by OR-ing 0x20; only those candidates get a full comparison.
+
+The kernel is picked once at startup: AVX2 when the CPU supports it, else
+SSE2 on x86, NEON on ARM, and a portable scalar loop elsewhere.
+*/
+
+#include <QByteArray>
+
+class CaseInsensitiveMatcher {
+public:
+    CaseInsensitiveMatcher() {}
+    explicit CaseInsensitiveMatcher(const QByteArray &needle) { setPattern(needle); }
+
+    void setPattern(const QByteArray &needle);
+    QByteArray pattern() const { return folded; }
+
+    // Position of the first match at or after from, or -1.
+    int indexIn(const char *text, int size, int from = 0) const;
+    int indexIn(const QByteArray &text, int from = 0) const {
+        return indexIn(text.constData(), text.size(), from);
+    }
+
+    // "avx2", "sse2", "neon" or "scalar"
+    static const char *kernelName();
+
+private:
+    QByteArray folded;  // needle with ASCII letters lower-cased
+};
+
+#endif // SEARCHKERNEL_H
@@ -0,0 +1,390 @@
+#include "searchserver.h"
+#include "memorybudget.h"
+#include "perfstats.h"
+
+#include <QDateTime>
+#include <QFutureWatcher>
+#include <QHostAddress>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QList>
+#include <QPointer>
+#include <QSettings>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QThread>
+#include <QTimer>
+#include <QUrl>
+#include <QVector>
+#include <QtConcurrent/QtConcurrentRun>
+
+static const int MaxHeaderBytes = 16 * 1024;
+static const int MaxBodyBytes = 64 * 1024;      // read and ignored: every request is a GET
+static const int DefaultLimit = 20;
+static const int SnippetBefore = 60;     // bytes of page text around the match
+static const int SnippetAfter = 140;
+
+namespace {
+
+// A search handed to the pool, with everything it reads.
+struct SearchJob {
+    SearchSources sources;
+    QString query;
+    bool library = false;
+    int limit = DefaultLimit;
+    int flags = SearchIndex::Exact;
+    bool snippets = true;
+};
+
+} // namespace
+
+static SearchServer::Reply jsonReply(int status, const QJsonObject &object) {
+    SearchServer::Reply reply;
+    reply.status = status;
+    reply.body = QJsonDocument(object).toJson(QJsonDocument::Compact);
+    return reply;
+}
+
+static SearchServer::Reply errorReply(int status, const QString &message) {
+    QJsonObject object;
+    object["error"] = message;
+    return jsonReply(status, object);
+}
+
+static QByteArray reasonPhrase(int status) {
+    switch (status) {
+    case 200: return "OK";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 413: return "Payload Too Large";
+    case 431: return "Request Header Fields Too Large";
+    case 501: return "Not Implemented";
+    case 503: return "Service Unavailable";
+    default: return "Error";
+    }
+}
+
+static int utf8Boundary(const QByteArray &text, int pos) {
+    while (pos > 0 && pos < text.size() && (uchar(text.at(pos)) & 0xC0) == 0x80) --pos;
+    return pos;
+}
+
+// Plain-text excerpt of page file of index around offset, cut between words;
+// the text comes from the book's page text cache when it has the page.
+static QString snippetOf(const SearchIndex &index, quint32 file, int offset) {
+    QByteArray text;
+    if (!index.pageText(file, &text) || text.isEmpty()) return QString();
+    offset = qBound(0, offset, text.size() - 1);
+    int start = utf8Boundary(text, qMax(0, offset - SnippetBefore));
+    int end = utf8Boundary(text, qMin(text.size(), offset + SnippetAfter));
+    if (start > 0) {
+        int space = text.indexOf(' ', start);
+        if (space >= 0 && space < offset) start = space + 1;
+    }
+    if (end < text.size()) {
+        int space = text.lastIndexOf(' ', end);
+        if (space > offset) end = space;
+    }
+    return QString::fromUtf8(text.constData() + start, end - start);
+}
+
+static QJsonObject hitObject(const SearchIndex &index, const QString &book, const SearchHit &hit, bool snippet) {
+    QJsonObject object;
+    object["path"] = index.absolutePath(hit.file);
+    object["book"] = book;
+    object["score"] = double(hit.score);
+    object["hits"] = int(hit.hits);
+    object["offset"] = int(hit.offset);
+    if (snippet) object["snippet"] = snippetOf(index, hit.file, int(hit.offset));
+    return object;
+}
+
+// The place a verse reference ("John 3:16") names, listed before the hits.
+static QJsonObject referenceObject(const SearchIndex &index, const QString &book, const VerseRef &ref,
+                                   const QString &term, bool snippet) {
+    QJsonObject object;
+    object["path"] = index.absolutePath(ref.file);
+    object["book"] = book;
+    object["anchor"] = QString::fromUtf8(ref.anchor);
+    object["title"] = term;
+    object["offset"] = int(ref.offset);
+    if (snippet) object["snippet"] = snippetOf(index, ref.file, int(ref.offset));
+    return object;
+}
+
+// Runs on the server's pool.
+static SearchServer::Reply runSearch(const SearchJob &job) {
+    ScopedTimer timer("server search");
+    const QString term = job.query.trimmed();
+    QJsonArray results;
+    int total = 0;
+    if (job.library) {
+        const Library &library = job.sources.library;
+        for (const Library::Book &book : library.books()) {
+            VerseRef ref;
+            if (results.size() < job.limit && book.selected && book.segment.index
+                    && book.segment.index->findReference(term, &ref))
+                results.append(referenceObject(*book.segment.index, book.dir, ref, term, job.snippets));
+        }
+        const QVector<LibraryHit> hits = library.search(job.query, job.flags);
+        total = hits.size();
+        for (int i = 0; i < hits.size() && results.size() < job.limit; ++i) {
+            const Library::Book &book = library.books().at(hits.at(i).book);
+            results.append(hitObject(*book.segment.index, book.dir, hits.at(i).hit, job.snippets));
+        }
+    } else {
+        const SearchIndex &index = *job.sources.index;
+        VerseRef ref;
+        if (index.findReference(term, &ref))
+            results.append(referenceObject(index, job.sources.siteDir, ref, term, job.snippets));
+        const QVector<SearchHit> hits = index.search(job.query, nullptr, nullptr, job.flags);
+        total = hits.size();
+        for (int i = 0; i < hits.size() && results.size() < job.limit; ++i)
+            results.append(hitObject(index, job.sources.siteDir, hits.at(i), job.snippets));
+    }
+
+    QJsonObject object;
+    object["query"] = job.query;
+    object["scope"] = job.library ? "library" : "book";
+    object["total"] = total;
+    object["results"] = results;
+    return jsonReply(200, object);
+}
+
+SearchServer::SearchServer(QObject *parent)
+    : QObject(parent), server(new QTcpServer(this)), idleTimer(new QTimer(this)) {
+    QSettings settings;
+    const int threads = settings.value("server/threads", 0).toInt();
+    pool.setMaxThreadCount(threads > 0 ? threads : lowMemoryMode() ? 1 : QThread::idealThreadCount());
+    idleMs = qMax(1, settings.value("server/idleSec", 30).toInt()) * 1000;
+    maxConnections = qMax(1, settings.value("server/maxConnections", 32).toInt());
+    maxResults = qMax(1, settings.value("server/maxResults", 200).toInt());
+
+    connect(server, &QTcpServer::newConnection, this, &SearchServer::onNewConnection);
+    idleTimer->setInterval(5000);
+    connect(idleTimer, &QTimer::timeout, this, &SearchServer::closeIdle);
+    idleTimer->start();
+}
+
+SearchServer::~SearchServer() {
+    // searches already running hold sources of their own; their replies are dropped
+    pool.clear();
+    pool.waitForDone();
+}
+
+bool SearchServer::listen(const QHostAddress &address, quint16 port) {
+    return server->listen(address, port);
+}
+
+QString SearchServer::errorString() const {
+    return server->errorString();
+}
+
+QString SearchServer::address() const {
+    return QString("%1:%2").arg(server->serverAddress().toString()).arg(server->serverPort());
+}
+
+void SearchServer::onNewConnection() {
+    while (QTcpSocket *socket = server->nextPendingConnection()) {
+        clients[socket].lastActiveMs = QDateTime::currentMSecsSinceEpoch();
+        connect(socket, &QTcpSocket::readyRead, this, [this, socket]() { onReadyRead(socket); });
+        connect(socket, &QTcpSocket::disconnected, this, [this, socket]() {
+            clients.remove(socket);
+            socket->deleteLater();
+        });
+        if (clients.size() > maxConnections) write(socket, errorReply(503, "Too many connections"), false);
+    }
+}
+
+void SearchServer::onReadyRead(QTcpSocket *socket) {
+    auto it = clients.find(socket);
+    if (it == clients.end()) return;
+    const QByteArray received = socket->readAll();
+    if (it->closing) return;
+    it->buffer += received;
+    it->lastActiveMs = QDateTime::currentMSecsSinceEpoch();
+    // requests pipelined behind a running search wait in the buffer, within reason
+    if (it->buffer.size() > 4 * (MaxHeaderBytes + MaxBodyBytes)) {
+        socket->abort();
+        return;
+    }
+    handleRequests(socket);
+}
+
+void SearchServer::handleRequests(QTcpSocket *socket) {
+    // one request at a time, so the replies go out in the order asked;
+    // writing may drop the client, so it is looked up again after each
+    for (auto it = clients.find(socket); it != clients.end() && !it->busy && !it->closing; it = clients.find(socket)) {
+        Request request;
+        Reply bad;
+        const int length = parse(it->buffer, &request, &bad);
+        if (length == 0) return;
+        if (length < 0) {
+            it->buffer.clear();
+            write(socket, bad, false);
+            return;
+        }
+        it->buffer.remove(0, length);
+        answer(socket, request);
+    }
+}
+
+int SearchServer::parse(const QByteArray &buffer, Request *request, Reply *error) {
+    const int headerEnd = buffer.indexOf("\r\n\r\n");
+    if (headerEnd < 0) {
+        if (buffer.size() <= MaxHeaderBytes) return 0;
+        *error = errorReply(431, "Request header too large");
+        return -1;
+    }
+    const QList<QByteArray> lines = buffer.left(headerEnd).split('\n');
+    const QList<QByteArray> start = lines.first().trimmed().split(' ');
+    if (start.size() != 3 || !start.at(2).startsWith("HTTP/1.")) {
+        *error = errorReply(400, "Malformed request line");
+        return -1;
+    }
+    request->method = start.at(0);
+    const QByteArray target = start.at(1);
+    const int question = target.indexOf('?');
+    request->path = QUrl::fromPercentEncoding(question < 0 ? target : target.left(question));
+    // form encoding has + for a space; a literal + comes as %2B
+    if (question >= 0) request->query = QUrlQuery(QString::fromLatin1(target.mid(question + 1)).replace('+', "%20"));
+    request->keepAlive = start.at(2) != "HTTP/1.0";
+
+    qint64 bodyLength = 0;
+    for (int i = 1; i < lines.size(); ++i) {
+        const QByteArray &line = lines.at(i);
+        const int colon = line.indexOf(':');
+        if (colon <= 0) continue;
+        const QByteArray name = line.left(colon).trimmed().toLower();
+        const QByteArray value = line.mid(colon + 1).trimmed().toLower();
+        if (name == "connection") {
+            if (value == "close") request->keepAlive = false;
+            else if (value == "keep-alive") request->keepAlive = true;
+        } else if (name == "content-length") {
+            bool ok = false;
+            bodyLength = value.toLongLong(&ok);
+            if (!ok || bodyLength < 0) {
+                *error = errorReply(400, "Malformed Content-Length");
+                return -1;
+            }
+        } else if (name == "transfer-encoding" && value != "identity") {
+            *error = errorReply(501, "Chunked request bodies are not supported");
+            return -1;
+        }
+    }
+    if (bodyLength > MaxBodyBytes) {
+        *error = errorReply(413, "Request body too large");
+        return -1;
+    }
+    const qint64 length = headerEnd + 4 + bodyLength;
+    return buffer.size() < length ? 0 : int(length);
+}
+
+void SearchServer::answer(QTcpSocket *socket, const Request &request) {
+    PerfStats::count("server requests");
+    if (request.method != "GET") {
+        write(socket, errorReply(405, "Only GET is supported"), request.keepAlive);
+        return;
+    }
+    const SearchSources current = sources ? sources() : SearchSources();
+
+    if (request.path == "/status") {
+        QJsonObject object;
+        object["book"] = current.siteDir;
+        object["indexed"] = !current.index.isNull();
+        object["pages"] = current.index ? current.index->fileCount() : 0;
+        object["libraryBooks"] = current.library.size();
+        object["pendingBooks"] = current.library.pendingCount();
+        write(socket, jsonReply(200, object), request.keepAlive);
+        return;
+    }
+    if (request.path == "/books") {
+        QJsonArray books;
+        for (const Library::Book &book : current.library.books()) {
+            QJsonObject entry;
+            entry["dir"] = book.dir;
+            entry["selected"] = book.selected;
+            entry["indexed"] = !book.segment.index.isNull();
+            entry["pages"] = book.segment.index ? book.segment.index->fileCount() : 0;
+            books.append(entry);
+        }
+        QJsonObject object;
+        object["books"] = books;
+        write(socket, jsonReply(200, object), request.keepAlive);
+        return;
+    }
+    if (request.path != "/search") {
+        write(socket, errorReply(404, QString("No such resource %1").arg(request.path)), request.keepAlive);
+        return;
+    }
+
+    SearchJob job;
+    job.query = request.query.queryItemValue("q", QUrl::FullyDecoded);
+    const QString scope = request.query.queryItemValue("scope", QUrl::FullyDecoded);
+    QString problem;
+    if (job.query.trimmed().isEmpty()) problem = "Missing query q";
+    else if (!scope.isEmpty() && scope != "book" && scope != "library") problem = "scope is book or library";
+    else if (!SearchIndex::queryError(job.query).isEmpty()) problem = "Invalid pattern " + SearchIndex::queryError(job.query);
+    if (!problem.isEmpty()) {
+        write(socket, errorReply(400, problem), request.keepAlive);
+        return;
+    }
+    job.library = scope == "library";
+    if (!job.library && !current.index) {
+        write(socket, errorReply(503, "The book's search index is still being built"), request.keepAlive);
+        return;
+    }
+    if (request.query.hasQueryItem("limit")) job.limit = request.query.queryItemValue("limit").toInt();
+    job.limit = qBound(1, job.limit, maxResults);
+    job.flags = current.flags;
+    if (request.query.hasQueryItem("stem")) {
+        if (request.query.queryItemValue("stem") == "1") job.flags |= SearchIndex::Stemmed;
+        else job.flags &= ~SearchIndex::Stemmed;
+    }
+    if (request.query.hasQueryItem("fuzzy")) {
+        if (request.query.queryItemValue("fuzzy") == "1") job.flags |= SearchIndex::Fuzzy;
+        else job.flags &= ~SearchIndex::Fuzzy;
+    }
+    job.snippets = request.query.queryItemValue("snippets") != "0";
+    job.sources = current;
+
+    clients[socket].busy = true;
+    QPointer<QTcpSocket> target(socket);
+    const bool keepAlive = request.keepAlive;
+    QFutureWatcher<Reply> *watcher = new QFutureWatcher<Reply>(this);
+    connect(watcher, &QFutureWatcher<Reply>::finished, this, [this, watcher, target, keepAlive]() {
+        watcher->deleteLater();
+        if (!target || !clients.contains(target.data())) return;     // the client has gone
+        clients[target.data()].busy = false;
+        write(target.data(), watcher->result(), keepAlive);
+        handleRequests(target.data());
+    });
+    watcher->setFuture(QtConcurrent::run(&pool, runSearch, job));
+}
+
+void SearchServer::write(QTcpSocket *socket, const Reply &reply, bool keepAlive) {
+    auto it = clients.find(socket);
+    if (it == clients.end()) return;
+    it->lastActiveMs = QDateTime::currentMSecsSinceEpoch();
+    QByteArray head = "HTTP/1.1 " + QByteArray::number(reply.status) + ' ' + reasonPhrase(reply.status) + "\r\n";
+    head += "Content-Type: application/json; charset=utf-8\r\n";
+    head += "Content-Length: " + QByteArray::number(reply.body.size()) + "\r\n";
+    head += "Cache-Control: no-store\r\n";
+    head += keepAlive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+    socket->write(head + reply.body);
+    if (!keepAlive) {
+        it->closing = true;
+        socket->disconnectFromHost();   // once the reply is out; may drop the client at once
+    }
+}
+
+void SearchServer::closeIdle() {
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    QList<QTcpSocket *> idle;
+    for (auto it = clients.constBegin(); it != clients.constEnd(); ++it) {
+        if (!it->busy && now - it->lastActiveMs > idleMs) idle.append(it.key());
+    }
+    for (QTcpSocket *socket : idle) socket->disconnectFromHost();
+}
@@ -0,0 +1,108 @@
+#ifndef SEARCHSERVER_H
+#define SEARCHSERVER_H
+
+/*
+A small HTTP server answering searches of the open book and the library
+with JSON, for other programs on the kiosk (a voice assistant, a signage
+app) that would otherwise have to scan the pages themselves.
+
+The viewer starts it when server/port is set, on server/address (default
+127.0.0.1, so only local programs can connect). Requests:
+
+    GET /search?q=QUERY[&scope=book|library][&limit=N][&stem=0|1][&fuzzy=0|1][&snippets=0]
+    GET /books
+    GET /status
+
+/search takes the search box's query syntax (searchindex.h) and answers
+{"query", "scope", "total", "results": [{"path", "book", "score", "hits",
+"offset", "snippet"}, ...]}, best first, at most limit (default 20, at most
+server/maxResults) results; a verse reference comes first with its "anchor"
+and "title". /books lists the library, /status the open book and its index.
+Errors are {"error": message} with a 4xx or 5xx status.
+
+Connections are HTTP/1.1 and kept alive (server/idleSec, default 30, closes
+idle ones); a connection's requests are answered in the order they came.
+Sockets are served on the GUI thread, which only parses and writes; each
+search runs on a pool of server/threads (default one per core) against the
+same indexes the window searches. Those are immutable and shared, so the
+sources callback just hands over the current ones, and neither side ever
+waits for the other.
+*/
+
+#include <QByteArray>
+#include <QHash>
+#include <QObject>
+#include <QSharedPointer>
+#include <QString>
+#include <QThreadPool>
+#include <QUrlQuery>
+#include <functional>
+
+#include "library.h"
+#include "searchindex.h"
+
+class QHostAddress;
+class QTcpServer;
+class QTcpSocket;
+class QTimer;
+
+// What searches are answered from, as the window has it at the time.
+struct SearchSources {
+    QString siteDir;
+    QSharedPointer<SearchIndex> index;      // the open book's, null while it is built
+    Library library;                        // a shallow copy: its segments are shared
+    int flags = SearchIndex::Exact;         // the window's stemming and fuzzy settings
+};
+
+class SearchServer : public QObject {
+    Q_OBJECT
+public:
+    explicit SearchServer(QObject *parent = nullptr);
+    ~SearchServer();
+
+    // Called on the GUI thread for every request.
+    std::function<SearchSources()> sources;
+
+    bool listen(const QHostAddress &address, quint16 port);
+    QString errorString() const;
+    QString address() const;    // host:port listened on
+
+    struct Reply {
+        int status = 200;
+        QByteArray body;        // JSON
+    };
+
+private:
+    struct Request {
+        QByteArray method;
+        QString path;
+        QUrlQuery query;
+        bool keepAlive = true;
+    };
+    struct Client {
+        QByteArray buffer;      // received, not yet handled
+        bool busy = false;      // a search is running for its current request
+        bool closing = false;   // answered a request that ended the connection
+        qint64 lastActiveMs = 0;
+    };
+
+    void onNewConnection();
+    void onReadyRead(QTcpSocket *socket);
+    void handleRequests(QTcpSocket *socket);
+    // Parses the request at the start of client's buffer: 0 while it is
+    // incomplete, else its length, or -1 with *error set if it is malformed.
+    static int parse(const QByteArray &buffer, Request *request, Reply *error);
+    void answer(QTcpSocket *socket, const Request &request);
+    void write(QTcpSocket *socket, const Reply &reply, bool keepAlive);
+    void closeIdle();
+
+    QTcpServer *server;
+    QTimer *idleTimer;
+    QThreadPool pool;
+    QHash<QTcpSocket *, Client> clients;
+    int idleMs;
+    int maxConnections;
+    int maxResults;
+};
+
+#endif // SEARCHSERVER_H
@@ -0,0 +1,90 @@
+#include "sitemanifest.h"
+#include "bookarchive.h"
+#include "perfstats.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QtConcurrent/QtConcurrentMap>
+#include <algorithm>
+
+struct Subtree {
+    QVector<SitePage> pages;
+    QStringList dirs;
+};
+
+static bool isPage(const QString &name) {
+    return name.endsWith(QLatin1String(".html"), Qt::CaseInsensitive)
+            || name.endsWith(QLatin1String(".htm"), Qt::CaseInsensitive);
+}
+
+static SitePage pageOf(const QFileInfo &fi) {
+    SitePage p;
+    p.path = fi.absoluteFilePath();
+    p.size = fi.size();
+    p.mtime = fi.lastModified().toMSecsSinceEpoch();
+    return p;
+}
+
+static bool byPath(const SitePage &a, const SitePage &b) {
+    return a.path < b.path;
+}
+
+static Subtree walkSubtree(const QString &root) {
+    Subtree t;
+    t.dirs.append(root);
+    QDirIterator it(root, QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot | QDir::NoSymLinks,
+                    QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        it.next();
+        QFileInfo fi = it.fileInfo();
+        if (fi.isDir()) t.dirs.append(fi.absoluteFilePath());
+        else if (isPage(fi.fileName())) t.pages.append(pageOf(fi));
+    }
+    std::sort(t.pages.begin(), t.pages.end(), byPath);
+    return t;
+}
+
+static SiteManifest scanArchive(const QString &file) {
+    QSharedPointer<BookArchive> archive = BookArchive::open(file);
+    if (!archive) return SiteManifest();
+    QVector<SitePage> pages;
+    for (const ArchiveEntry &e : archive->entries()) {
+        if (!isPage(e.path) || e.path.startsWith(QLatin1Char('.'))) continue;
+        SitePage p;
+        p.path = archive->fileName() + QLatin1Char('/') + e.path;
+        p.size = e.size;
+        p.mtime = e.mtime;
+        pages.append(p);
+    }
+    return SiteManifest::fromPages(file, pages);
+}
+
+SiteManifest SiteManifest::fromPages(const QString &siteDir, const QVector<SitePage> &pages) {
+    SiteManifest m;
+    m.dir = siteDir;
+    m.pageList = pages;
+    return m;
+}
+
+SiteManifest SiteManifest::scan(const QString &siteDir) {
+    ScopedTimer timer("manifest scan");
+    if (BookArchive::isArchivePath(siteDir)) return scanArchive(siteDir);
+    SiteManifest m;
+    QDir root(siteDir);
+    m.dir = siteDir;
+    m.dirList.append(root.absolutePath());
+
+    QStringList subdirs;
+    for (const QFileInfo &fi : root.entryInfoList(QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot | QDir::NoSymLinks, QDir::Name)) {
+        if (fi.isDir()) subdirs.append(fi.absoluteFilePath());
+        else if (isPage(fi.fileName())) m.pageList.append(pageOf(fi));
+    }
+
+    const QList<Subtree> trees = QtConcurrent::blockingMapped(subdirs, walkSubtree);
+    for (const Subtree &t : trees) {
+        m.pageList += t.pages;
+        m.dirList += t.dirs;
+    }
+    return m;
+}
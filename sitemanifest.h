@@ -0,0 +1,50 @@
+#ifndef SITEMANIFEST_H
+#define SITEMANIFEST_H
+
+/*
+The list of pages (*.html / *.htm, any case) of a site directory or of an
+open book archive (see bookarchive.h), with the size + mtime fingerprints the
+search index keys on.
+
+A manifest is built with one non-recursive QDirIterator walk per top-level
+subdirectory, run in parallel, so a library of translations in sibling folders
+is enumerated on all cores. Hidden directories (such as .htmlbooks) and
+symlinks are skipped. Manifests are plain values: MiniBrowser keeps the
+current one and only rescans when the site watcher reports a change. An
+archive's pages are listed from its central directory without touching the
+file system.
+*/
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+struct SitePage {
+    QString path;       // absolute; "<archive>/<path inside>" for archived pages
+    qint64 size = 0;
+    qint64 mtime = 0;   // msecs since epoch
+};
+
+class SiteManifest {
+public:
+    SiteManifest() {}
+
+    // Walk siteDir: its own pages by name, then each top-level folder's pages
+    // by path. A siteDir naming a .hbk archive lists the archive's pages.
+    static SiteManifest scan(const QString &siteDir);
+    // A manifest of just the given pages (no directories), e.g. to narrow a search.
+    static SiteManifest fromPages(const QString &siteDir, const QVector<SitePage> &pages);
+
+    bool isValid() const { return !dir.isEmpty(); }
+    QString siteDir() const { return dir; }
+    const QVector<SitePage> &pages() const { return pageList; }
+    // siteDir and every directory below it, for QFileSystemWatcher (none for archives)
+    const QStringList &directories() const { return dirList; }
+
+private:
+    QString dir;
+    QVector<SitePage> pageList;
+    QStringList dirList;
+};
+
+#endif // SITEMANIFEST_H
@@ -0,0 +1,263 @@
+#include "stemmer.h"
+
+#include <cstring>
+
+namespace {
+
+// The steps of the algorithm over b[0..k], as in Porter's reference
+// implementation; j marks the end of the stem a suffix test leaves.
+class PorterStemmer {
+public:
+    explicit PorterStemmer(const QByteArray &word) : b(word), k(word.size() - 1) {
+        b.reserve(word.size() + 4);
+    }
+
+    QByteArray stem() {
+        step1ab();
+        if (k > 0) {
+            step1c();
+            step2();
+            step3();
+            step4();
+            step5();
+        }
+        return b.left(k + 1);
+    }
+
+private:
+    bool cons(int i) const {
+        switch (b[i]) {
+        case 'a': case 'e': case 'i': case 'o': case 'u': return false;
+        case 'y': return i == 0 ? true : !cons(i - 1);
+        default: return true;
+        }
+    }
+
+    // The number of vowel-consonant sequences in b[0..j].
+    int m() const {
+        int n = 0;
+        int i = 0;
+        for (;;) {
+            if (i > j) return n;
+            if (!cons(i)) break;
+            ++i;
+        }
+        ++i;
+        for (;;) {
+            for (;;) {
+                if (i > j) return n;
+                if (cons(i)) break;
+                ++i;
+            }
+            ++i;
+            ++n;
+            for (;;) {
+                if (i > j) return n;
+                if (!cons(i)) break;
+                ++i;
+            }
+            ++i;
+        }
+    }
+
+    bool vowelInStem() const {
+        for (int i = 0; i <= j; ++i) {
+            if (!cons(i)) return true;
+        }
+        return false;
+    }
+
+    bool doubleConsonant(int i) const {
+        return i >= 1 && b[i] == b[i - 1] && cons(i);
+    }
+
+    // consonant-vowel-consonant ending at i, the last not w, x or y: "hop"
+    bool cvc(int i) const {
+        if (i < 2 || !cons(i) || cons(i - 1) || !cons(i - 2)) return false;
+        const char c = b[i];
+        return c != 'w' && c != 'x' && c != 'y';
+    }
+
+    bool ends(const char *s) {
+        const int length = int(strlen(s));
+        if (s[length - 1] != b[k] || length > k + 1) return false;
+        if (memcmp(b.constData() + k - length + 1, s, size_t(length)) != 0) return false;
+        j = k - length;
+        return true;
+    }
+
+    void setTo(const char *s) {
+        const int length = int(strlen(s));
+        b.resize(j + 1);
+        b.append(s, length);
+        k = j + length;
+    }
+
+    void replace(const char *s) {
+        if (m() > 0) setTo(s);
+    }
+
+    // plurals and -ed or -ing: caresses -> caress, ponies -> poni,
+    // feed -> feed, agreed -> agree, hopping -> hop, filing -> file
+    void step1ab() {
+        if (b[k] == 's') {
+            if (ends("sses")) k -= 2;
+            else if (ends("ies")) setTo("i");
+            else if (b[k - 1] != 's') --k;
+        }
+        if (ends("eed")) {
+            if (m() > 0) --k;
+        } else if ((ends("ed") || ends("ing")) && vowelInStem()) {
+            k = j;
+            if (ends("at")) setTo("ate");
+            else if (ends("bl")) setTo("ble");
+            else if (ends("iz")) setTo("ize");
+            else if (doubleConsonant(k)) {
+                --k;
+                const char c = b[k];
+                if (c == 'l' || c == 's' || c == 'z') ++k;
+            } else if (m() == 1 && cvc(k)) {
+                setTo("e");
+            }
+        }
+    }
+
+    // a final y after a vowel in the stem: happy -> happi
+    void step1c() {
+        if (ends("y") && vowelInStem()) b[k] = 'i';
+    }
+
+    // double suffixes to single ones: relational -> relate, digitizer -> digitize
+    void step2() {
+        switch (b[k - 1]) {
+        case 'a':
+            if (ends("ational")) replace("ate");
+            else if (ends("tional")) replace("tion");
+            break;
+        case 'c':
+            if (ends("enci")) replace("ence");
+            else if (ends("anci")) replace("ance");
+            break;
+        case 'e':
+            if (ends("izer")) replace("ize");
+            break;
+        case 'l':
+            if (ends("bli")) replace("ble");
+            else if (ends("alli")) replace("al");
+            else if (ends("entli")) replace("ent");
+            else if (ends("eli")) replace("e");
+            else if (ends("ousli")) replace("ous");
+            break;
+        case 'o':
+            if (ends("ization")) replace("ize");
+            else if (ends("ation")) replace("ate");
+            else if (ends("ator")) replace("ate");
+            break;
+        case 's':
+            if (ends("alism")) replace("al");
+            else if (ends("iveness")) replace("ive");
+            else if (ends("fulness")) replace("ful");
+            else if (ends("ousness")) replace("ous");
+            break;
+        case 't':
+            if (ends("aliti")) replace("al");
+            else if (ends("iviti")) replace("ive");
+            else if (ends("biliti")) replace("ble");
+            break;
+        case 'g':
+            if (ends("logi")) replace("log");
+            break;
+        }
+    }
+
+    // -ic-, -full, -ness etc.: electrical -> electric, goodness -> good
+    void step3() {
+        switch (b[k]) {
+        case 'e':
+            if (ends("icate")) replace("ic");
+            else if (ends("ative")) replace("");
+            else if (ends("alize")) replace("al");
+            break;
+        case 'i':
+            if (ends("iciti")) replace("ic");
+            break;
+        case 'l':
+            if (ends("ical")) replace("ic");
+            else if (ends("ful")) replace("");
+            break;
+        case 's':
+            if (ends("ness")) replace("");
+            break;
+        }
+    }
+
+    // -ant, -ence etc. after a stem of two or more syllables: adjustment -> adjust
+    void step4() {
+        switch (b[k - 1]) {
+        case 'a':
+            if (ends("al")) break;
+            return;
+        case 'c':
+            if (ends("ance") || ends("ence")) break;
+            return;
+        case 'e':
+            if (ends("er")) break;
+            return;
+        case 'i':
+            if (ends("ic")) break;
+            return;
+        case 'l':
+            if (ends("able") || ends("ible")) break;
+            return;
+        case 'n':
+            if (ends("ant") || ends("ement") || ends("ment") || ends("ent")) break;
+            return;
+        case 'o':
+            if (ends("ion") && j >= 0 && (b[j] == 's' || b[j] == 't')) break;
+            if (ends("ou")) break;
+            return;
+        case 's':
+            if (ends("ism")) break;
+            return;
+        case 't':
+            if (ends("ate") || ends("iti")) break;
+            return;
+        case 'u':
+            if (ends("ous")) break;
+            return;
+        case 'v':
+            if (ends("ive")) break;
+            return;
+        case 'z':
+            if (ends("ize")) break;
+            return;
+        default:
+            return;
+        }
+        if (m() > 1) k = j;
+    }
+
+    // a final -e, and -ll to -l, after a long enough stem: probate -> probat
+    void step5() {
+        j = k;
+        if (b[k] == 'e') {
+            const int a = m();
+            if (a > 1 || (a == 1 && !cvc(k - 1))) --k;
+        }
+        if (b[k] == 'l' && doubleConsonant(k) && m() > 1) --k;
+    }
+
+    QByteArray b;
+    int k;
+    int j = 0;
+};
+
+} // namespace
+
+QByteArray porterStem(const QByteArray &word) {
+    if (word.size() <= 2) return word;
+    for (char c : word) {
+        if (c < 'a' || c > 'z') return word;
+    }
+    return PorterStemmer(word).stem();
+}
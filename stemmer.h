@@ -0,0 +1,20 @@
+#ifndef STEMMER_H
+#define STEMMER_H
+
+/*
+English word stems, for searches that match every form of a word.
+
+porterStem() is the Porter (1980) suffix-stripping algorithm: "connected",
+"connecting", "connection" and "connections" all become "connect", and
+"ponies" becomes "poni". Stems are only keys to group words by, not words
+themselves. The search index (searchindex.h) groups its terms by stem when
+the dictionary is built, so a stemmed query word is one hash probe.
+*/
+
+#include <QByteArray>
+
+// The stem of a lower-case word. Words of one or two letters, and words with
+// anything but ASCII letters in them, are returned as they are.
+QByteArray porterStem(const QByteArray &word);
+
+#endif // STEMMER_H
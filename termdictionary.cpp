@@ -0,0 +1,129 @@
+#include "termdictionary.h"
+#include "searchkernel.h"
+#include "stemmer.h"
+
+#include <QPair>
+#include <algorithm>
+#include <cstring>
+
+TermDictionary::TermDictionary(const QVector<QByteArray> &sortedTerms) : terms(sortedTerms) {
+    // a term is only stored under a stem it differs from, or one other terms share
+    QVector<bool> ownStem(terms.size(), false);
+    for (int i = 0; i < terms.size(); ++i) {
+        const QByteArray stem = porterStem(terms.at(i));
+        if (stem == terms.at(i)) ownStem[i] = true;
+        else stems[stem].append(i);
+    }
+    for (int i = 0; i < terms.size(); ++i) {
+        if (!ownStem.at(i)) continue;
+        auto it = stems.find(terms.at(i));
+        if (it == stems.end()) continue;
+        it->append(i);
+        std::sort(it->begin(), it->end());
+    }
+    stems.squeeze();
+}
+
+bool TermDictionary::contains(const QByteArray &term) const {
+    return std::binary_search(terms.constBegin(), terms.constEnd(), term);
+}
+
+QList<QByteArray> TermDictionary::withPrefix(const QByteArray &prefix, int limit) const {
+    QList<QByteArray> found;
+    auto it = std::lower_bound(terms.constBegin(), terms.constEnd(), prefix);
+    for (; it != terms.constEnd() && it->startsWith(prefix) && found.size() < limit; ++it)
+        found.append(*it);
+    return found;
+}
+
+int TermDictionary::skipPrefix(int i, int length) const {
+    const char *prefix = terms.at(i).constData();
+    auto end = std::partition_point(terms.constBegin() + i + 1, terms.constEnd(), [prefix, length](const QByteArray &t) {
+        return t.size() >= length && memcmp(t.constData(), prefix, size_t(length)) == 0;
+    });
+    return int(end - terms.constBegin());
+}
+
+QList<QByteArray> TermDictionary::similar(const QByteArray &word, int maxEdits, int limit) const {
+    QList<QByteArray> found;
+    if (word.isEmpty() || terms.isEmpty() || limit <= 0) return found;
+    const int m = word.size();
+    const int maxDepth = m + maxEdits;      // longer prefixes are always too far
+    const int width = m + 1;
+
+    // rows[d * width + c]: edits between the path's first d bytes and word's first c
+    QVector<int> rows((maxDepth + 1) * width);
+    for (int c = 0; c <= m; ++c) rows[c] = c;
+    int path = 0;       // the term the rows were computed along
+    int depth = 0;      // and how many of them are valid
+    QVector<QPair<int, int> > matches;      // (edits, term)
+
+    for (int i = 0; i < terms.size(); ) {
+        const QByteArray &t = terms.at(i);
+        // rows shared with the previous path need no work
+        const QByteArray &p = terms.at(path);
+        int d = 0;
+        while (d < depth && d < t.size() && p.at(d) == t.at(d)) ++d;
+        path = i;
+        depth = d;
+
+        bool pruned = false;
+        for (++d; d <= t.size(); ++d) {
+            if (d > maxDepth) {
+                pruned = true;
+                break;
+            }
+            const int *prev = rows.constData() + (d - 1) * width;
+            int *row = rows.data() + d * width;
+            const char ch = t.at(d - 1);
+            row[0] = d;
+            int best = d;
+            for (int c = 1; c <= m; ++c) {
+                const int edits = qMin(qMin(prev[c], row[c - 1]) + 1, prev[c - 1] + (word.at(c - 1) == ch ? 0 : 1));
+                row[c] = edits;
+                best = qMin(best, edits);
+            }
+            depth = d;
+            if (best > maxEdits) {
+                pruned = true;
+                break;
+            }
+        }
+        if (pruned) {
+            // no term below this prefix can be close enough
+            i = skipPrefix(i, d);
+            depth = d - 1;
+            continue;
+        }
+        const int edits = rows.at(t.size() * width + m);
+        if (edits <= maxEdits) matches.append(qMakePair(edits, i));
+        ++i;
+    }
+
+    std::sort(matches.begin(), matches.end());
+    for (int i = 0; i < matches.size() && found.size() < limit; ++i) found.append(terms.at(matches.at(i).second));
+    return found;
+}
+
+QList<QByteArray> TermDictionary::withStem(const QByteArray &word) const {
+    QList<QByteArray> found;
+    const QByteArray stem = porterStem(word);
+    auto it = stems.constFind(stem);
+    if (it != stems.constEnd()) {
+        for (int i : *it) found.append(terms.at(i));
+        return found;
+    }
+    // a term that is its own stem and shares it with no other term
+    if (contains(stem)) found.append(stem);
+    return found;
+}
+
+QList<QByteArray> TermDictionary::containing(const QByteArray &part, int limit) const {
+    QList<QByteArray> found;
+    const CaseInsensitiveMatcher matcher(part);
+    for (int i = 0; i < terms.size() && found.size() < limit; ++i) {
+        const QByteArray &t = terms.at(i);
+        if (t.size() >= part.size() && matcher.indexIn(t) >= 0) found.append(t);
+    }
+    return found;
+}
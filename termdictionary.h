@@ -0,0 +1,62 @@
+#ifndef TERMDICTIONARY_H
+#define TERMDICTIONARY_H
+
+/*
+The sorted term dictionary of a search index, for lookups by prefix, by
+spelling, by stem and by substring.
+
+Terms are kept in one sorted array, and the terms sharing a prefix are a
+contiguous range of it, so the array doubles as a trie: a node is a prefix
+and its subtree a range found by binary search. similar() walks that trie
+with the rows of the Levenshtein table. Terms sharing a prefix share the rows
+for it, and a subtree is skipped as soon as its row has no cell within the
+allowed edits, so a fuzzy lookup touches the few branches near the word
+rather than every term. Edits are counted in UTF-8 bytes, so outside ASCII a
+changed letter may count as two.
+
+The terms are also grouped by their Porter stem (stemmer.h) when the
+dictionary is built, and withStem() returns a word's group. containing()
+runs the SIMD matcher (searchkernel.h) over the terms, which are far fewer
+and shorter than the pages, to rule out pages for a regular expression.
+*/
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QVector>
+
+class TermDictionary {
+public:
+    TermDictionary() {}
+    // terms must be sorted and unique.
+    explicit TermDictionary(const QVector<QByteArray> &terms);
+
+    int size() const { return terms.size(); }
+    bool isEmpty() const { return terms.isEmpty(); }
+    const QByteArray &at(int i) const { return terms.at(i); }
+    bool contains(const QByteArray &term) const;
+
+    // Up to limit terms starting with prefix, in sorted order.
+    QList<QByteArray> withPrefix(const QByteArray &prefix, int limit) const;
+
+    // Up to limit terms at most maxEdits insertions, deletions or
+    // substitutions away from word, closest first (then in sorted order).
+    QList<QByteArray> similar(const QByteArray &word, int maxEdits, int limit) const;
+
+    // The terms sharing word's stem, word itself included if it is a term.
+    QList<QByteArray> withStem(const QByteArray &word) const;
+
+    // Up to limit terms with part in them, in sorted order.
+    QList<QByteArray> containing(const QByteArray &part, int limit) const;
+
+private:
+    // The first term after i that doesn't start with terms[i]'s first length bytes.
+    int skipPrefix(int i, int length) const;
+
+    QVector<QByteArray> terms;
+    // stem -> term numbers, for stems shared by several terms or differing
+    // from their only term; any other term is its own group
+    QHash<QByteArray, QVector<int> > stems;
+};
+
+#endif // TERMDICTIONARY_H
@@ -0,0 +1,36 @@
+#!/bin/sh
+# Packs the fixture book and searches the archive with the batch commands
+# (batchmode.h), which must find its pages through the packed index:
+#   sh tests/batch_archive.sh ./htmlbooks-index
+# (or "make check" in the cli/ build).
+set -e
+
+tool=${1:?usage: batch_archive.sh path/to/htmlbooks-index}
+here=$(cd "$(dirname "$0")" && pwd)
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+cp -R "$here/fixtures/book" "$work/book"
+"$tool" --pack "$work/book" "$work/book.hbk" > /dev/null
+
+fail() {
+    echo "FAIL: $1" >&2
+    exit 1
+}
+
+out=$("$tool" --search "$work/book.hbk" "quay")
+echo "$out" | grep -q "chapter2.html" || fail "--search book.hbk quay did not find chapter2.html: $out"
+echo "$out" | grep -q "chapter1.html" && fail "--search book.hbk quay listed chapter1.html: $out"
+
+out=$("$tool" --search "$work/book.hbk" "lamp")
+echo "$out" | grep -q "chapter1.html" || fail "--search book.hbk lamp did not find chapter1.html: $out"
+
+if "$tool" --search "$work/missing.hbk" "quay" > /dev/null 2>&1; then
+    fail "--search of a missing archive succeeded"
+fi
+echo "$work/book.hbk" > "$work/broken.hbk"
+if "$tool" --search "$work/broken.hbk" "quay" > /dev/null 2>&1; then
+    fail "--search of a file that is not an archive succeeded"
+fi
+
+echo "PASS: batch search of a packed book"